@@ -6,6 +6,7 @@
 namespace std {
    %template(VectorInt) vector<int>;
    %template(VectorDouble) vector<double>;
+   %template(VectorString) vector<string>;
 }
 
 %{
@@ -13,9 +14,13 @@ namespace std {
 #include <cstddef>
 #include "libplump/hpyp_model.h"
 #include "libplump/config.h"
+#include "libplump/symbol_sequence.h"
 #include "libplump/utils.h"
+#include "libplump/arena.h"
 #include "libplump/node_manager_interface.h"
 #include "libplump/node_manager.h"
+#include "libplump/flat_node_manager.h"
+#include "libplump/tracking_node_manager.h"
 #include "libplump/context_tree.h"
 #include "libplump/hpyp_restaurant_interface.h"
 #include "libplump/hpyp_restaurants.h"
@@ -23,6 +28,7 @@ namespace std {
 #include "libplump/hpyp_parameters.h"
 #include "libplump/random.h"
 #include "libplump/serialization.h"
+#include "libplump/snapshot.h"
 #include "libplump/pyp_sample.h"
 #include "libplump/stirling.h"
 %}
@@ -58,20 +64,28 @@ typedef int int32_t;
 }}
 
 %ignore getDFSPathIterator;
+%ignore gatsby::libplump::HPYPModel::predictBatchArray;
+%ignore gatsby::libplump::TrackingNodeManager::getStructureChanges;
+%ignore gatsby::libplump::TrackingNodeManager::getModified;
 
 /* Parse the header file to generate wrappers */
 %include "libplump/config.h"
+%include "libplump/symbol_sequence.h"
 %include "libplump/utils.h"
 %include "libplump/serialization.h"
 %include "libplump/context_tree.h"
+%include "libplump/arena.h"
 %include "libplump/node_manager_interface.h"
 %include "libplump/node_manager.h"
+%include "libplump/flat_node_manager.h"
+%include "libplump/tracking_node_manager.h"
 %include "libplump/hpyp_restaurant_interface.h"
 %include "libplump/hpyp_parameters_interface.h"
 %include "libplump/hpyp_restaurants.h"
 %include "libplump/hpyp_parameters.h"
 %include "libplump/random.h"
 %include "libplump/hpyp_model.h"
+%include "libplump/snapshot.h"
 %include "libplump/pyp_sample.h"
 %include "libplump/stirling.h"
  
@@ -83,11 +97,149 @@ namespace gatsby { namespace libplump {
 
 namespace gatsby { namespace libplump {
 %template(pushCharFileToVec) pushFileToVec<unsigned char, seq_type>;
+%template(pushShortFileToVec) pushFileToVec<unsigned short, seq_type>;
 %template(pushIntFileToVec) pushFileToVec<int, seq_type>;
 %template(prob2loss) prob2loss<double>;
 }}
 
 #if SWIGPYTHON
+%{
+/*
+ * Get a C-contiguous, one-dimensional buffer of n items of the given size and
+ * type code (struct module syntax) from obj, e.g. a numpy array. Sets a
+ * Python exception and returns false on failure.
+ */
+static bool getBatchBuffer(PyObject* obj, Py_buffer* view, const char* name,
+                           Py_ssize_t itemsize, char code, bool writable) {
+  int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT;
+  if (writable) {
+    flags |= PyBUF_WRITABLE;
+  }
+  if (PyObject_GetBuffer(obj, view, flags) != 0) {
+    return false;
+  }
+  const char* format = view->format ? view->format : "B";
+  if (format[0] == '<' || format[0] == '=' || format[0] == '@') {
+    ++format; // byte order prefix; we only run on little endian machines
+  }
+  if (view->ndim != 1 || view->itemsize != itemsize || 
+      format[0] != code || format[1] != '\0') {
+    PyErr_Format(PyExc_TypeError, 
+                 "%s must be a one-dimensional array of '%c' items of size %d",
+                 name, code, (int)itemsize);
+    PyBuffer_Release(view);
+    return false;
+  }
+  return true;
+}
+%}
+
+%extend gatsby::libplump::SymbolSequence {
+  %pythoncode %{
+    def __len__(self):
+        return self.size()
+
+    def __getitem__(self, i):
+        if i < 0:
+            i += self.size()
+        if i < 0 or i >= self.size():
+            raise IndexError("sequence index out of range")
+        return self.at(i)
+  %}
+}
+
+%extend gatsby::libplump::HPYPModel {
+  /*
+   * Batched prediction on objects supporting the buffer protocol without
+   * copying: starts, stops and obs must be int32 arrays and out a writable
+   * float64 array, all of the same length. Each query must satisfy
+   * 0 <= start <= stop <= len(seq) and 0 <= obs < numTypes, otherwise a
+   * ValueError is raised before anything is predicted.
+   * See HPYPModel::predictBatchArray.
+   */
+  PyObject* predictBatchInto(PyObject* starts, PyObject* stops, 
+                             PyObject* obs, PyObject* out, int mode = 0) {
+    if (mode < gatsby::libplump::HPYPModel::ABOVE || 
+        mode > gatsby::libplump::HPYPModel::BELOW) {
+      PyErr_SetString(PyExc_ValueError, "invalid prediction mode");
+      return NULL;
+    }
+    Py_buffer views[4];
+    int numViews = 0;
+    bool ok = 
+        getBatchBuffer(starts, &views[numViews++], "starts", 4, 'i', false) &&
+        getBatchBuffer(stops, &views[numViews++], "stops", 4, 'i', false) &&
+        getBatchBuffer(obs, &views[numViews++], "obs", 4, 'i', false) &&
+        getBatchBuffer(out, &views[numViews++], "out", 8, 'd', true);
+    if (!ok) {
+      --numViews; // the failing call released its own view
+    } else if (views[0].shape[0] != views[3].shape[0] || 
+               views[1].shape[0] != views[3].shape[0] ||
+               views[2].shape[0] != views[3].shape[0]) {
+      PyErr_SetString(PyExc_ValueError, "arrays must have the same length");
+      ok = false;
+    } else {
+      // the model does not check its arguments, so out-of-range values
+      // would read outside of the sequence and the restaurants
+      const gatsby::libplump::l_type* startData =
+          (const gatsby::libplump::l_type*) views[0].buf;
+      const gatsby::libplump::l_type* stopData =
+          (const gatsby::libplump::l_type*) views[1].buf;
+      const gatsby::libplump::e_type* obsData =
+          (const gatsby::libplump::e_type*) views[2].buf;
+      size_t length = $self->getSequenceLength();
+      int numTypes = $self->getNumTypes();
+      for (Py_ssize_t i = 0; ok && i < views[3].shape[0]; ++i) {
+        if (startData[i] < 0 || startData[i] > stopData[i] ||
+            (size_t) stopData[i] > length) {
+          PyErr_Format(PyExc_ValueError,
+                       "query %d: context [%d, %d) is not within the "
+                       "sequence of length %d", (int) i, startData[i],
+                       stopData[i], (int) length);
+          ok = false;
+        } else if (obsData[i] < 0 || obsData[i] >= numTypes) {
+          PyErr_Format(PyExc_ValueError,
+                       "query %d: observation %d is not in [0, %d)",
+                       (int) i, obsData[i], numTypes);
+          ok = false;
+        }
+      }
+    }
+    if (ok) {
+      $self->predictBatchArray(
+          (const gatsby::libplump::l_type*) views[0].buf,
+          (const gatsby::libplump::l_type*) views[1].buf,
+          (const gatsby::libplump::e_type*) views[2].buf,
+          views[3].shape[0],
+          (double*) views[3].buf,
+          (gatsby::libplump::HPYPModel::PredictMode) mode);
+    }
+    for (int i = 0; i < numViews; ++i) {
+      PyBuffer_Release(&views[i]);
+    }
+    if (!ok) {
+      return NULL;
+    }
+    Py_RETURN_NONE;
+  }
+
+  %pythoncode %{
+    def predictBatchNumpy(self, starts, stops, obs, mode=0):
+        """Batched prediction returning a numpy float64 array.
+
+        Inputs that already are contiguous int32 numpy arrays are
+        passed to the model without copying.
+        """
+        import numpy
+        starts = numpy.ascontiguousarray(starts, dtype=numpy.int32)
+        stops = numpy.ascontiguousarray(stops, dtype=numpy.int32)
+        obs = numpy.ascontiguousarray(obs, dtype=numpy.int32)
+        out = numpy.empty(obs.shape[0], dtype=numpy.float64)
+        self.predictBatchInto(starts, stops, obs, out, mode)
+        return out
+  %}
+}
+
 %init %{
   gatsby::libplump::init_rng();
 %}
@@ -17,7 +17,7 @@ def run(options):
   discounts = lp.VectorDouble(DISCOUNTS)
   parameters = lp.SimpleParameters(discounts, options.alpha)
   
-  seq = lp.VectorInt()
+  seq = lp.SymbolSequence()
   lp.pushIntFileToVec(options.train_file, seq)
   print >> sys.stderr, "Train seq length: %i" % (seq.size(),)
 
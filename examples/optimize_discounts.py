@@ -20,8 +20,8 @@ restaurant = libplump.HistogramRestaurant()
 nodeManager = libplump.SimpleNodeManager(restaurant.getFactory())
 parameters = libplump.SimpleParameters()
 
-parameters.discounts = libplump.VectorDouble(initial[1:])
-parameters.alpha = initial[0]
+parameters.setDiscounts(libplump.VectorDouble(initial[1:]))
+parameters.setAlpha(initial[0])
 
 train = aio.readBText(sys.argv[1])
 valid = aio.readBText(sys.argv[2])
@@ -32,8 +32,8 @@ num_samples = int(sys.argv[4])
 alldata = train.tolist() + valid.tolist() +test.tolist()
 print type(alldata)
 print type(alldata[0])
-seq = libplump.VectorInt(alldata)
-#seq = libplump.VectorInt(map(ord,'oacac'))
+seq = libplump.SymbolSequence(alldata)
+#seq = libplump.SymbolSequence(map(ord,'oacac'), libplump.SymbolSequence.BYTE)
 #numTypes = max(seq)
 numTypes = int(np.max(train) + 1)
 
@@ -41,8 +41,8 @@ model = libplump.HPYPModel(seq, nodeManager, restaurant, parameters, numTypes)
 trainLoss = model.computeLosses(0,len(train))
 
 def validLoss(params):
-  parameters.discounts = libplump.VectorDouble(params[1:])
-  parameters.alpha = params[0]
+  parameters.setDiscounts(libplump.VectorDouble(params[1:]))
+  parameters.setAlpha(params[0])
   probs = model.predictSequence(len(train), len(train)+len(valid))
   loss = np.mean(-np.log2(probs))
   print "evaluated at", params, "loss is", loss
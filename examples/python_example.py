@@ -12,8 +12,8 @@ nodeManager = libplump.SimpleNodeManager(restaurant.getFactory())
 parameters = libplump.SimpleParameters()
 
 #seq = libplump.vectori(range(10))
-seq = libplump.VectorInt([0,1,2,1,2])
-#seq = libplump.VectorInt(map(ord,'oacac'))
+seq = libplump.SymbolSequence([0,1,2,1,2])
+#seq = libplump.SymbolSequence(map(ord,'oacac'), libplump.SymbolSequence.BYTE)
 #numTypes = max(seq)
 numTypes = 3
 
@@ -29,6 +29,11 @@ for i in range(len(seq)):
    dist = model.predictiveDistribution(0,i)
    print dist, sum(dist)
 
+# the same predictions as model.predict(0, i, seq[i]) for all i in one batch;
+# inputs that are contiguous int32 numpy arrays are not copied
+print "Batched predictions:"
+print model.predictBatchNumpy([0]*len(seq), range(len(seq)), list(seq))
+
 # save model to file
 serializer = libplump.Serializer("model.dump")
 serializer.saveNodesAndPayloads(nodeManager, restaurant.getFactory())
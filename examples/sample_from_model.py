@@ -31,7 +31,7 @@ def buildModel(fn):
     nodeManager = libplump.SimpleNodeManager(restaurant.getFactory())
     parameters = libplump.SimpleParameters(DISCOUNTS, CONCENTRATION)
     
-    seq = libplump.VectorInt()
+    seq = libplump.SymbolSequence(libplump.SymbolSequence.BYTE)
     libplump.pushCharFileToVec(fn, seq)
     numTypes = 256
     
@@ -57,6 +57,19 @@ def sampleFromModel(prefix='', length=10):
     return out
 
 
+def sampleNextSymbols(prefix='', numSamples=10):
+    """Draw numSamples alternatives for the symbol following prefix."""
+    startPos = seq.size()
+    for c in prefix:
+        seq.push_back(ord(c))
+    predictive = model.predictiveDistribution(startPos, seq.size())
+    for c in prefix:
+        seq.pop_back()
+    # the alias table makes each draw O(1) after an O(numTypes) setup
+    sampler = libplump.AliasSampler(predictive)
+    return [chr(sampler.sample()) for i in xrange(numSamples)]
+
+
 def completion():
     """Simple command line word completion example."""
     key = None
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace gatsby { namespace libplump {
+
+Arena::Arena(size_t chunkSize) 
+    : chunkSize(chunkSize), chunks(), current(NULL), currentEnd(NULL),
+      reserved(0), freeLists(MAX_SMALL_SIZE / ALIGNMENT + 1, (FreeBlock*)NULL),
+      freeLargeBlocks(), mutex() {}
+
+
+Arena::~Arena() {
+  this->release();
+}
+
+
+void* Arena::allocate(size_t size) {
+  size = roundUp(std::max(size, sizeof(FreeBlock)));
+  boost::mutex::scoped_lock lock(this->mutex);
+  if (size <= MAX_SMALL_SIZE) {
+    FreeBlock*& head = this->freeLists[size / ALIGNMENT];
+    if (head != NULL) {
+      FreeBlock* block = head;
+      head = block->next;
+      return block;
+    }
+  } else {
+    for (size_t i = 0; i < this->freeLargeBlocks.size(); ++i) {
+      if (this->freeLargeBlocks[i].first == size) {
+        void* block = this->freeLargeBlocks[i].second;
+        this->freeLargeBlocks[i] = this->freeLargeBlocks.back();
+        this->freeLargeBlocks.pop_back();
+        return block;
+      }
+    }
+  }
+  return this->allocateFromChunk(size);
+}
+
+
+void Arena::deallocate(void* p, size_t size) {
+  if (p == NULL) {
+    return;
+  }
+  size = roundUp(std::max(size, sizeof(FreeBlock)));
+  boost::mutex::scoped_lock lock(this->mutex);
+  if (size <= MAX_SMALL_SIZE) {
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = this->freeLists[size / ALIGNMENT];
+    this->freeLists[size / ALIGNMENT] = block;
+  } else {
+    this->freeLargeBlocks.push_back(std::make_pair(size, p));
+  }
+}
+
+
+void Arena::release() {
+  for (size_t i = 0; i < this->chunks.size(); ++i) {
+    ::operator delete(this->chunks[i]);
+  }
+  this->chunks.clear();
+  this->current = this->currentEnd = NULL;
+  this->reserved = 0;
+  std::fill(this->freeLists.begin(), this->freeLists.end(), (FreeBlock*)NULL);
+  this->freeLargeBlocks.clear();
+}
+
+
+void* Arena::allocateFromChunk(size_t size) {
+  if (this->current == NULL || (size_t)(this->currentEnd - this->current) < size) {
+    if (size > this->chunkSize / 4) {
+      // large blocks get their own chunk, so that the rest of the current
+      // chunk is not wasted
+      char* chunk = static_cast<char*>(::operator new(size));
+      this->chunks.push_back(chunk);
+      this->reserved += size;
+      return chunk;
+    }
+    // the remainder of the current chunk is abandoned
+    this->current = static_cast<char*>(::operator new(this->chunkSize));
+    this->currentEnd = this->current + this->chunkSize;
+    this->chunks.push_back(this->current);
+    this->reserved += this->chunkSize;
+  }
+  void* block = this->current;
+  this->current += size;
+  return block;
+}
+
+}} // namespace gatsby::libplump
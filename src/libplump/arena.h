@@ -0,0 +1,163 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A region allocator that hands out memory from large chunks.
+ *
+ * Memory returned by deallocate is kept on a free list per size and reused
+ * by later allocations of the same size; it is only returned to the system
+ * by release() or when the arena is destroyed, which frees all chunks at 
+ * once without visiting the objects allocated in them.
+ *
+ * An arena is meant to hold the nodes and payloads of a single model, so 
+ * that tearing down the model does not require freeing every node 
+ * individually, and so that two models in the same process do not share 
+ * (and fragment) the same pools. 
+ *
+ * Allocation and deallocation are thread safe (payloads may grow while 
+ * predicting on several threads), release() is not. All allocations are
+ * aligned to 8 bytes.
+ */
+class Arena {
+  public:
+    /**
+     * Create an empty arena that reserves memory in chunks of (at least)
+     * chunkSize bytes.
+     */
+    explicit Arena(size_t chunkSize = 1 << 20);
+
+    ~Arena();
+
+    /**
+     * Return a block of at least size bytes.
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Return the block p of the given size, which must have been obtained
+     * from allocate(size) on this arena, for reuse. 
+     */
+    void deallocate(void* p, size_t size);
+
+    /**
+     * Free all memory held by the arena. Objects allocated in the arena are
+     * not destructed.
+     */
+    void release();
+
+    /**
+     * Number of bytes reserved from the system.
+     */
+    size_t bytesReserved() const {
+      return this->reserved;
+    }
+
+  private:
+    // not copyable
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    static const size_t ALIGNMENT = 8;
+
+    // blocks up to this size are tracked in freeLists, larger ones in 
+    // freeLargeBlocks
+    static const size_t MAX_SMALL_SIZE = 4096;
+
+    static size_t roundUp(size_t size) {
+      return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    void* allocateFromChunk(size_t size);
+    
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+
+    size_t chunkSize;
+    std::vector<char*> chunks;
+    // unused part of the current chunk
+    char* current;
+    char* currentEnd;
+    size_t reserved;
+    // freeLists[size / ALIGNMENT] holds freed blocks of the given size
+    std::vector<FreeBlock*> freeLists;
+    std::vector<std::pair<size_t, void*> > freeLargeBlocks;
+    boost::mutex mutex;
+};
+
+
+/**
+ * Raw memory allocator that uses the global operator new. 
+ *
+ * This and ArenaAllocator are the allocators used by MiniMap; they only 
+ * hand out raw memory and are not STL allocators.
+ */
+class HeapAllocator {
+  public:
+    void* allocate(size_t size) const {
+      return ::operator new(size);
+    }
+
+    void deallocate(void* p, size_t size) const {
+      ::operator delete(p);
+    }
+};
+
+
+/**
+ * Raw memory allocator that allocates from an Arena, or from the heap if
+ * the arena is NULL.
+ */
+class ArenaAllocator {
+  public:
+    ArenaAllocator(Arena* arena = NULL) : arena(arena) {}
+
+    void* allocate(size_t size) const {
+      if (this->arena != NULL) {
+        return this->arena->allocate(size);
+      }
+      return ::operator new(size);
+    }
+
+    void deallocate(void* p, size_t size) const {
+      if (this->arena != NULL) {
+        this->arena->deallocate(p, size);
+      } else {
+        ::operator delete(p);
+      }
+    }
+
+    Arena* getArena() const {
+      return this->arena;
+    }
+
+  private:
+    Arena* arena;
+};
+
+}} // namespace gatsby::libplump
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef COMPACT_ARRANGEMENTS_H_
+#define COMPACT_ARRANGEMENTS_H_
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <vector>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "libplump/config.h"
+#include "libplump/arena.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Per-type customer and table counts (cw, tw) of a compact restaurant,
+ * sorted by type and stored as three parallel arrays.
+ *
+ * Up to N types are stored inside the object itself, so that the typical
+ * restaurant with only a few types needs no allocation at all. When more
+ * types are added, the arrays move to a single block obtained from the
+ * Allocator (types, then cws, then tws), which is grown by doubling; it is
+ * only given back when the map is cleared or destroyed.
+ *
+ * Entries are accessed by their index, which find() and insert() return;
+ * indices of entries after an inserted one shift by one. Archives are
+ * compatible with those of a MiniMap<e_type, std::pair<int, int> >.
+ */
+template<unsigned int N, class Allocator = HeapAllocator>
+class CompactArrangements {
+  public:
+    typedef unsigned int size_type;
+
+    explicit CompactArrangements(const Allocator& allocator = Allocator())
+        : _size(0), allocator(allocator) {}
+
+    CompactArrangements(const CompactArrangements& other)
+        : _size(0), allocator(other.allocator) {
+      this->assign(other);
+    }
+
+    /**
+     * Copy the entries of other; the map keeps its own allocator.
+     */
+    CompactArrangements& operator=(const CompactArrangements& other) {
+      if (this != &other) {
+        this->clear();
+        this->assign(other);
+      }
+      return *this;
+    }
+
+    ~CompactArrangements() {
+      this->release();
+    }
+
+    size_type size() const {
+      return this->_size;
+    }
+
+    bool empty() const {
+      return this->_size == 0;
+    }
+
+    void clear() {
+      this->release();
+      this->_size = 0;
+    }
+
+    /**
+     * Return the index of the given type, or size() if it is not present.
+     */
+    size_type find(e_type type) const {
+      size_type i = this->lowerBound(type);
+      if (i != this->_size && this->typeArray()[i] == type) {
+        return i;
+      }
+      return this->_size;
+    }
+
+    /**
+     * Return the index of the first entry whose type is not less than the
+     * given type, i.e. the index of the type if it is present and the index
+     * it would be inserted at otherwise.
+     */
+    size_type lowerBound(e_type type) const {
+      const e_type* types = this->typeArray();
+      if (!this->spilled()) {
+        size_type i = 0;
+        while (i < this->_size && types[i] < type) {
+          ++i;
+        }
+        return i;
+      }
+      return std::lower_bound(types, types + this->_size, type) - types;
+    }
+
+    /**
+     * Return the index of the given type, inserting it with cw = tw = 0 if
+     * it is not present.
+     */
+    size_type insert(e_type type) {
+      return this->insertAt(this->lowerBound(type), type);
+    }
+
+    /**
+     * Same as insert, where pos is lowerBound(type), e.g. as remembered
+     * from an earlier lookup while the map has not changed since.
+     */
+    size_type insertAt(size_type pos, e_type type) {
+      assert(pos <= this->_size);
+      e_type* types = this->typeArray();
+      if (pos != this->_size && types[pos] == type) {
+        return pos;
+      }
+      if (this->_size == this->capacity()) {
+        this->grow(pos);
+      } else {
+        int* cws = this->cwArray();
+        int* tws = this->twArray();
+        std::copy_backward(types + pos, types + this->_size,
+                           types + this->_size + 1);
+        std::copy_backward(cws + pos, cws + this->_size,
+                           cws + this->_size + 1);
+        std::copy_backward(tws + pos, tws + this->_size,
+                           tws + this->_size + 1);
+      }
+      ++this->_size;
+      this->typeArray()[pos] = type;
+      this->cwArray()[pos] = 0;
+      this->twArray()[pos] = 0;
+      return pos;
+    }
+
+    e_type type(size_type i) const {
+      return this->typeArray()[i];
+    }
+
+    int& cw(size_type i) {
+      return this->cwArray()[i];
+    }
+
+    int cw(size_type i) const {
+      return this->cwArray()[i];
+    }
+
+    int& tw(size_type i) {
+      return this->twArray()[i];
+    }
+
+    int tw(size_type i) const {
+      return this->twArray()[i];
+    }
+
+  private:
+    struct Local {
+      e_type types[N];
+      int cws[N];
+      int tws[N];
+    };
+
+    struct Spilled {
+      // block holding capacity types, cws and tws
+      e_type* types;
+      size_type capacity;
+    };
+
+    union {
+      Local local;
+      Spilled external;
+    } storage;
+    size_type _size;
+    // after _size, so that a small allocator fits into the padding
+    Allocator allocator;
+
+    bool spilled() const {
+      return this->_size > N;
+    }
+
+    size_type capacity() const {
+      return this->spilled() ? this->storage.external.capacity : N;
+    }
+
+    e_type* typeArray() const {
+      return this->spilled() ? this->storage.external.types
+                             : const_cast<e_type*>(this->storage.local.types);
+    }
+
+    int* cwArray() const {
+      return this->spilled()
+          ? reinterpret_cast<int*>(this->storage.external.types
+                                   + this->storage.external.capacity)
+          : const_cast<int*>(this->storage.local.cws);
+    }
+
+    int* twArray() const {
+      return this->spilled()
+          ? reinterpret_cast<int*>(this->storage.external.types
+                                   + 2 * this->storage.external.capacity)
+          : const_cast<int*>(this->storage.local.tws);
+    }
+
+    static size_t blockSize(size_type capacity) {
+      return capacity * (sizeof(e_type) + 2 * sizeof(int));
+    }
+
+    e_type* allocateBlock(size_type capacity) {
+      return static_cast<e_type*>(this->allocator.allocate(
+          blockSize(capacity)));
+    }
+
+    void release() {
+      if (this->spilled()) {
+        this->allocator.deallocate(this->storage.external.types,
+                                   blockSize(this->storage.external.capacity));
+      }
+    }
+
+    /**
+     * Move the entries to a block of twice the capacity, leaving a gap at
+     * index gap for a new entry. The caller has to increment _size right
+     * away, as the block is only used once _size exceeds N.
+     */
+    void grow(size_type gap) {
+      size_type newCapacity = 2 * this->capacity();
+      e_type* block = this->allocateBlock(newCapacity);
+      e_type* newTypes = block;
+      int* newCws = reinterpret_cast<int*>(block + newCapacity);
+      int* newTws = reinterpret_cast<int*>(block + 2 * newCapacity);
+      const e_type* types = this->typeArray();
+      const int* cws = this->cwArray();
+      const int* tws = this->twArray();
+      std::copy(types, types + gap, newTypes);
+      std::copy(types + gap, types + this->_size, newTypes + gap + 1);
+      std::copy(cws, cws + gap, newCws);
+      std::copy(cws + gap, cws + this->_size, newCws + gap + 1);
+      std::copy(tws, tws + gap, newTws);
+      std::copy(tws + gap, tws + this->_size, newTws + gap + 1);
+      this->release();
+      this->storage.external.types = block;
+      this->storage.external.capacity = newCapacity;
+    }
+
+    /**
+     * Copy the entries of other into this empty map.
+     */
+    void assign(const CompactArrangements& other) {
+      assert(this->_size == 0);
+      if (other.spilled()) {
+        this->storage.external.types =
+            this->allocateBlock(other.storage.external.capacity);
+        this->storage.external.capacity = other.storage.external.capacity;
+      }
+      this->_size = other._size;
+      std::copy(other.typeArray(), other.typeArray() + other._size,
+                this->typeArray());
+      std::copy(other.cwArray(), other.cwArray() + other._size,
+                this->cwArray());
+      std::copy(other.twArray(), other.twArray() + other._size,
+                this->twArray());
+    }
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void save(Archive & ar, const unsigned int version) const {
+      // same layout as the archive of a MiniMap
+      std::vector<e_type> typeVec(this->typeArray(),
+                                  this->typeArray() + this->_size);
+      std::vector<std::pair<int, int> > countVec;
+      countVec.reserve(this->_size);
+      for (size_type i = 0; i < this->_size; ++i) {
+        countVec.push_back(std::make_pair(this->cw(i), this->tw(i)));
+      }
+      ar << _size;
+      ar << typeVec;
+      ar << countVec;
+    }
+
+    template<class Archive>
+    void load(Archive & ar, const unsigned int version) {
+      std::vector<e_type> typeVec;
+      std::vector<std::pair<int, int> > countVec;
+      size_type size;
+      ar >> size;
+      ar >> typeVec;
+      ar >> countVec;
+      this->clear();
+      if (size > N) {
+        size_type capacity = N;
+        while (capacity < size) {
+          capacity *= 2;
+        }
+        this->storage.external.types = this->allocateBlock(capacity);
+        this->storage.external.capacity = capacity;
+      }
+      this->_size = size;
+      for (size_type i = 0; i < size; ++i) {
+        this->typeArray()[i] = typeVec[i];
+        this->cw(i) = countVec[i].first;
+        this->tw(i) = countVec[i].second;
+      }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+}} // namespace gatsby::libplump
+
+#endif /* COMPACT_ARRANGEMENTS_H_ */
@@ -28,7 +28,13 @@ namespace gatsby { namespace libplump {
 
 typedef int32_t e_type;
 typedef int32_t l_type;
-typedef std::vector<e_type> seq_type;
+
+class SymbolSequence;
+
+/**
+ * Sequence type indexed by context trees and models; see symbol_sequence.h.
+ */
+typedef SymbolSequence seq_type;
 
 /*
  * We want an easy way to switch the map type that is used throughout to 
@@ -39,7 +45,8 @@ typedef std::vector<e_type> seq_type;
  */
 template<typename K, typename V>
 struct MapType {
-    typedef MiniMap<K,V> Type;
+    // ArenaAllocator lets a node manager keep the maps in its arena
+    typedef MiniMap<K,V,unsigned int,ArenaAllocator> Type;
     //typedef std::map<K,V> Type;
 };
 
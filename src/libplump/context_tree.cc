@@ -16,14 +16,17 @@
 
 #include "libplump/context_tree.h"
 
+#include <algorithm>
 #include <sstream>
 #include "libplump/subseq.h"
+#include "libplump/suffix_array.h"
+#include "libplump/symbol_sequence.h"
 #include "libplump/utils.h"
 
 namespace gatsby { namespace libplump {
 
 ContextTree::ContextTree(INodeManager& nodeManager, seq_type& seq) 
-    : nm(nodeManager), seq(seq) {
+    : nm(nodeManager), seq(seq), links() {
   root = nm.getRoot();
 }
 
@@ -40,12 +43,7 @@ l_type ContextTree::suffixUntil(l_type thisStart,
                                 l_type offset) const {
   //l_type l = ((tend-start) < s.length()) ? (end-start) : s.length();
   l_type l = thisEnd - thisStart; // assume this seq is always shorter
-  l_type i;
-  for (i = offset; i<l; i++) {
-    if (seq[thisEnd - 1 - i] != seq[otherEnd - 1 - i])
-      break;
-  }
-  return i;
+  return seq.commonSuffixLength(thisEnd, otherEnd, offset, l);
 }
 
 
@@ -55,21 +53,44 @@ l_type ContextTree::suffixUntilCheck(l_type thisStart,
                                      l_type otherEnd,
                                      l_type offset) const {
   l_type l = std::min(thisEnd-thisStart, otherEnd-otherStart);
-  l_type i;
-  for (i = offset; i<l; i++) {
-    if (seq[thisEnd - 1 - i] != seq[otherEnd - 1 - i])
-      break;
-  }
-  return i;
+  return seq.commonSuffixLength(thisEnd, otherEnd, offset, l);
 }
 
 
 ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end) 
 {
-  tracer << "ContextTree::insert(" << start << ", " << end << ")" << std::endl;
   ContextTree::InsertionResult result;
+  this->insert(start, end, result);
+  return result;
+}
+
+
+void ContextTree::insert(l_type start, l_type end, InsertionResult& result) 
+{
+  this->doInsert(start, end, result, NULL);
+}
+
+
+void ContextTree::insert(l_type start, l_type end, InsertionResult& result,
+                         Cursor& cursor) 
+{
+  this->doInsert(start, end, result, &cursor);
+}
+
+
+void ContextTree::doInsert(l_type start, l_type end, InsertionResult& result,
+                           Cursor* cursor) 
+{
+  tracer << "ContextTree::insert(" << start << ", " << end << ")" << std::endl;
+  const Cursor::NodePath* previous = 
+      (cursor != NULL) ? cursor->advance(start, end) : NULL;
+  // the first known symbols of the context are not compared; the node of
+  // the previous context only has a link if this context is in the tree
+  // already, which is rare when inserting consecutive contexts
+  const l_type known = this->knownMatch(start, end, previous, true);
   l_type offset = 0;
   WrappedNodeList& path = result.path;
+  path.clear();
   NodeId current = root;
   NodeId parent;
   e_type parentKey = 0;
@@ -80,13 +101,18 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
     l_type curLength = curEnd - curStart;
 
     // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
+    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth,
+                  nm.getDiscountCache(current));
     path.push_back(n);
 
     // determine the length l of the longest common suffix with s
-    l_type longestSuffixLen = suffixUntilCheck(curStart, curEnd,
-                                               start, end, offset); 
+    l_type longestSuffixLen = suffixUntilCheck(
+        curStart, curEnd, start, end, 
+        std::max(offset, std::min(known, curLength))); 
     if (curLength == longestSuffixLen) { // if context is fully consumed
+      if (cursor != NULL) {
+        cursor->push(current, curLength);
+      }
       if (curLength == end - start) { // context is already in the tree!
         result.action = InsertionResult::INSERT_ACTION_NO_SPLIT;
         break;
@@ -103,9 +129,14 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
         continue;
       } else {
         child = nm.setChild(current, key, start, end);
+        this->addSuffixLink(child, start, end, previous);
+        if (cursor != NULL) {
+          cursor->push(child, end - start);
+        }
         // The payload of the parent may have changed!
         path.back().payload = nm.getPayload(current);
-        WrappedNode wrapped_child(start, end, nm.getPayload(child), depth + 1);
+        WrappedNode wrapped_child(start, end, nm.getPayload(child), depth + 1,
+                                  nm.getDiscountCache(child));
         path.push_back(wrapped_child);
         result.action = InsertionResult::INSERT_ACTION_NO_SPLIT;
         break;
@@ -128,6 +159,10 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
                                           shorterStart,
                                           curEnd,
                                           oldNodeKey);
+      this->addSuffixLink(newParent, shorterStart, curEnd, previous);
+      if (cursor != NULL) {
+        cursor->push(newParent, longestSuffixLen);
+      }
 
       // return node B
       result.splitChild = path.back();
@@ -138,14 +173,20 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
       path.push_back(WrappedNode(shorterStart,
                                  curEnd,
                                  nm.getPayload(newParent),
-                                 depth));
+                                 depth,
+                                 nm.getDiscountCache(newParent)));
 
       // if C is a proper suffix of X, insert X as a child of C
       // and push C onto the path
       if (end - start > curEnd - shorterStart) {
         e_type childKey = seq[end - longestSuffixLen - 1];
         NodeId child = nm.setChild(newParent, childKey, start, end);
-        path.push_back(WrappedNode(start, end, nm.getPayload(child),depth+1));
+        this->addSuffixLink(child, start, end, previous);
+        if (cursor != NULL) {
+          cursor->push(child, end - start);
+        }
+        path.push_back(WrappedNode(start, end, nm.getPayload(child),depth+1,
+                                   nm.getDiscountCache(child)));
         result.action = InsertionResult::INSERT_ACTION_SPLIT;
       } else {   
         result.action = InsertionResult::INSERT_ACTION_SPLIT_SUFFIX;
@@ -153,7 +194,128 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
       break;
     }
   }
-  return result;
+}
+
+
+void ContextTree::insertAll(l_type start, l_type stop) {
+  assert(nm.getChildren(root).empty());
+  const l_type n = stop - start;
+  if (n <= 0) {
+    return;
+  }
+
+  // The context (start, i) read backwards is the suffix of the reversed
+  // sequence text starting at stop - i. The symbols are replaced by their
+  // ranks, starting at 1, and text ends with the sentinel 0.
+  std::vector<l_type> text(n + 1);
+  e_type minSymbol = seq[start], maxSymbol = seq[start];
+  for (l_type p = 0; p < n; ++p) {
+    text[p] = seq[stop - 1 - p];
+    minSymbol = std::min(minSymbol, (e_type)text[p]);
+    maxSymbol = std::max(maxSymbol, (e_type)text[p]);
+  }
+  l_type alphabetSize = 1;
+  if ((int64_t)maxSymbol - minSymbol < 2 * (int64_t)n + 256) {
+    // rank by a table over the range of symbols
+    std::vector<l_type> ranks(maxSymbol - minSymbol + 1, 0);
+    for (l_type p = 0; p < n; ++p) {
+      ranks[text[p] - minSymbol] = 1;
+    }
+    for (size_t s = 0; s < ranks.size(); ++s) {
+      ranks[s] = ranks[s] ? alphabetSize++ : 0;
+    }
+    for (l_type p = 0; p < n; ++p) {
+      text[p] = ranks[text[p] - minSymbol];
+    }
+  } else {
+    std::vector<e_type> alphabet(text.begin(), text.end() - 1);
+    std::sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(std::unique(alphabet.begin(), alphabet.end()),
+                   alphabet.end());
+    for (l_type p = 0; p < n; ++p) {
+      text[p] = 1 + (std::lower_bound(alphabet.begin(), alphabet.end(),
+                                      text[p]) - alphabet.begin());
+    }
+    alphabetSize += alphabet.size();
+  }
+  text[n] = 0;
+  std::vector<l_type> sa, lcp;
+  buildSuffixArray(text, alphabetSize, sa);
+  buildLcpArray(text, sa, lcp);
+  std::vector<l_type>().swap(text);
+
+  // Nodes of the tree, the root first, with their parent, their length 
+  // and their end. The contexts are visited in sorted order (sa[0] is the
+  // sentinel), keeping the path to the last one on a stack: a context 
+  // branches off that path where its common prefix with the last one ends,
+  // which requires a new node if none of that length is on the path. As
+  // insert() keeps the positions of a node when it is split, the end of 
+  // each node is the smallest end of the contexts below it.
+  std::vector<l_type> parent(1, -1), length(1, 0), ends(1, 0);
+  std::vector<l_type> stack(1, 0);
+  for (l_type k = 1; k <= n; ++k) {
+    l_type last = -1;
+    while (length[stack.back()] > lcp[k]) {
+      last = stack.back();
+      stack.pop_back();
+      ends[stack.back()] = std::min(ends[stack.back()], ends[last]);
+    }
+    if (length[stack.back()] < lcp[k]) {
+      parent.push_back(stack.back());
+      length.push_back(lcp[k]);
+      ends.push_back(ends[last]);
+      parent[last] = parent.size() - 1;
+      stack.push_back(parent.size() - 1);
+    }
+    parent.push_back(stack.back());
+    length.push_back(n - sa[k]);
+    ends.push_back(stop - sa[k]);
+    stack.push_back(parent.size() - 1);
+  }
+  while (stack.size() > 1) {
+    l_type last = stack.back();
+    stack.pop_back();
+    ends[stack.back()] = std::min(ends[stack.back()], ends[last]);
+  }
+  std::vector<l_type>().swap(sa);
+  std::vector<l_type>().swap(lcp);
+
+  // the children of each node; as the nodes were created in sorted order,
+  // these are ordered by their keys
+  const l_type numNodes = parent.size();
+  std::vector<l_type> firstChild(numNodes + 1, 0);
+  for (l_type v = 1; v < numNodes; ++v) {
+    ++firstChild[parent[v] + 1];
+  }
+  for (l_type v = 0; v < numNodes; ++v) {
+    firstChild[v + 1] += firstChild[v];
+  }
+  std::vector<l_type> children(numNodes - 1);
+  std::vector<l_type> next(firstChild.begin(), firstChild.end() - 1);
+  for (l_type v = 1; v < numNodes; ++v) {
+    children[next[parent[v]]++] = v;
+  }
+  std::vector<l_type>().swap(next);
+  std::vector<l_type>().swap(parent);
+
+  // create the nodes top-down
+  std::vector<NodeId> ids(numNodes, NULL);
+  ids[0] = this->root;
+  stack.assign(1, 0);
+  while (!stack.empty()) {
+    const l_type v = stack.back();
+    stack.pop_back();
+    for (l_type c = firstChild[v]; c < firstChild[v + 1]; ++c) {
+      const l_type child = children[c];
+      ids[child] = nm.setChild(ids[v], seq[ends[child] - 1 - length[v]],
+                               ends[child] - length[child], ends[child]);
+      stack.push_back(child);
+    }
+  }
+
+  if (this->links.get() != NULL) {
+    this->addAllSuffixLinks();
+  }
 }
 
 
@@ -162,8 +324,33 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
  * subsequence within the tree.
  */
 WrappedNodeList ContextTree::findLongestSuffix (l_type start, l_type end) const {
-  l_type offset = 0;
   WrappedNodeList path;
+  this->findLongestSuffix(start, end, path);
+  return path;
+}
+
+
+void ContextTree::findLongestSuffix (l_type start, l_type end,
+                                     WrappedNodeList& path) const {
+  this->doFindLongestSuffix(start, end, path, NULL);
+}
+
+
+void ContextTree::findLongestSuffix (l_type start, l_type end,
+                                     WrappedNodeList& path,
+                                     Cursor& cursor) const {
+  this->doFindLongestSuffix(start, end, path, &cursor);
+}
+
+
+void ContextTree::doFindLongestSuffix (l_type start, l_type end,
+                                       WrappedNodeList& path,
+                                       Cursor* cursor) const {
+  const Cursor::NodePath* previous = 
+      (cursor != NULL) ? cursor->advance(start, end) : NULL;
+  const l_type known = this->knownMatch(start, end, previous, false);
+  l_type offset = 0;
+  path.clear();
   NodeId current = root;
   NodeId parent;
   e_type parentKey = 0;
@@ -174,12 +361,17 @@ WrappedNodeList ContextTree::findLongestSuffix (l_type start, l_type end) const
     l_type curEnd = nm.getEnd(current);
     l_type curLength = curEnd - curStart;
     // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
+    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth,
+                  nm.getDiscountCache(current));
     path.push_back(n);
     // determine the length l of the longest common suffix with s
-    l_type longestSuffixLen = suffixUntilCheck(curStart, curEnd, 
-                                               start, end, offset);
+    l_type longestSuffixLen = suffixUntilCheck(
+        curStart, curEnd, start, end, 
+        std::max(offset, std::min(known, curLength)));
     if (curLength == longestSuffixLen) { // if context is fully consumed
+      if (cursor != NULL) {
+        cursor->push(current, curLength);
+      }
       if (curLength == end - start) { // no more input to consume
         done = true;
       } else {
@@ -201,7 +393,6 @@ WrappedNodeList ContextTree::findLongestSuffix (l_type start, l_type end) const
       done = true;
     }
   }
-  return path;
 }
 
 
@@ -209,8 +400,16 @@ WrappedNodeList ContextTree::findLongestSuffix (l_type start, l_type end) const
  * Find an existing node in the tree
  */
 WrappedNodeList ContextTree::findNode (l_type start, l_type end) const {
-  l_type offset = 0;
   WrappedNodeList path;
+  this->findNode(start, end, path);
+  return path;
+}
+
+
+void ContextTree::findNode (l_type start, l_type end, 
+                            WrappedNodeList& path) const {
+  l_type offset = 0;
+  path.clear();
   NodeId current = root;
   NodeId parent;
   e_type parentKey = 0;
@@ -221,7 +420,8 @@ WrappedNodeList ContextTree::findNode (l_type start, l_type end) const {
     l_type curEnd = nm.getEnd(current);
     l_type curLength = curEnd - curStart;
     // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
+    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth,
+                  nm.getDiscountCache(current));
     path.push_back(n);
     if (curLength == end - start) { // no more input to consume
       done = true;
@@ -239,7 +439,6 @@ WrappedNodeList ContextTree::findNode (l_type start, l_type end) const {
       depth++;
     }
   }
-  return path;
 }
 
 
@@ -250,9 +449,33 @@ WrappedNodeList ContextTree::findNode (l_type start, l_type end) const {
 std::pair<int,WrappedNodeList> ContextTree::findLongestSuffixVirtual(
     l_type start, l_type end) const {
   std::pair<int,WrappedNodeList> ret;
-  ret.first = 0;
+  ret.first = this->findLongestSuffixVirtual(start, end, ret.second);
+  return ret;
+}
+
+
+int ContextTree::findLongestSuffixVirtual(l_type start, l_type end,
+                                          WrappedNodeList& path) const {
+  return this->doFindLongestSuffixVirtual(start, end, path, NULL);
+}
+
+
+int ContextTree::findLongestSuffixVirtual(l_type start, l_type end,
+                                          WrappedNodeList& path,
+                                          Cursor& cursor) const {
+  return this->doFindLongestSuffixVirtual(start, end, path, &cursor);
+}
+
+
+int ContextTree::doFindLongestSuffixVirtual(l_type start, l_type end,
+                                            WrappedNodeList& path,
+                                            Cursor* cursor) const {
+  const Cursor::NodePath* previous = 
+      (cursor != NULL) ? cursor->advance(start, end) : NULL;
+  const l_type known = this->knownMatch(start, end, previous, false);
+  int fragmentLength = 0;
   l_type offset = 0;
-  WrappedNodeList& path = ret.second;
+  path.clear();
   NodeId current = root;
   NodeId parent;
   e_type parentKey = 0;
@@ -263,12 +486,17 @@ std::pair<int,WrappedNodeList> ContextTree::findLongestSuffixVirtual(
     l_type curEnd = nm.getEnd(current);
     l_type curLength = curEnd - curStart;
     // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
+    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth,
+                  nm.getDiscountCache(current));
     path.push_back(n);
     // determine the length l of the longest common suffix with s
-    l_type longestSuffixLen = suffixUntilCheck(curStart, curEnd, 
-                                               start, end, offset);
+    l_type longestSuffixLen = suffixUntilCheck(
+        curStart, curEnd, start, end, 
+        std::max(offset, std::min(known, curLength)));
     if (curLength == longestSuffixLen) { // if context is fully consumed
+      if (cursor != NULL) {
+        cursor->push(current, curLength);
+      }
       if (curLength == end - start) { // no more input to consume
         done = true;
       } else {
@@ -285,11 +513,113 @@ std::pair<int,WrappedNodeList> ContextTree::findLongestSuffixVirtual(
         depth++;
       }
     } else {
-      ret.first = longestSuffixLen; // length of 
+      fragmentLength = longestSuffixLen; // length of 
       done = true;
     }
   }
-  return ret;
+  return fragmentLength;
+}
+
+
+l_type ContextTree::knownMatch(l_type start, l_type end,
+                               const Cursor::NodePath* previous,
+                               bool skipPrevious) const {
+  if (previous == NULL || this->links.get() == NULL) {
+    return 0;
+  }
+  // The context (start, end) is the symbol at end - 1 followed by the
+  // context (start, end - 1). Going up from the deepest node of the latter,
+  // the first node with a link for that symbol thus leads to a node that is
+  // a prefix of the context, one symbol longer than the node itself.
+  const e_type symbol = this->seq[end - 1];
+  for (size_t i = previous->size(); i > 0; --i) {
+    const Cursor::Node& node = (*previous)[i - 1];
+    if (skipPrevious && node.length == end - 1 - start) {
+      continue;
+    }
+    if (this->links->find(node.node, symbol) != NULL) {
+      return node.length + 1;
+    }
+  }
+  return 0;
+}
+
+
+void ContextTree::addSuffixLink(NodeId node, l_type start, l_type end,
+                                const Cursor::NodePath* previous) {
+  if (this->links.get() == NULL) {
+    return;
+  }
+  // the suffix of the node is the context (start, end - 1), which is
+  // on the path of the previous context if that is (start', end - 1)
+  const l_type suffixLength = end - start - 1;
+  NodeId suffix = NULL;
+  if (previous != NULL) {
+    for (size_t i = previous->size(); i > 0; --i) {
+      const Cursor::Node& candidate = (*previous)[i - 1];
+      if (candidate.length <= suffixLength) {
+        if (candidate.length == suffixLength) {
+          suffix = candidate.node;
+        }
+        break;
+      }
+    }
+  } else {
+    suffix = this->findExactNode(start, end - 1);
+  }
+  if (suffix != NULL) {
+    this->links->insert(suffix, this->seq[end - 1], node);
+  }
+}
+
+
+ContextTree::NodeId ContextTree::findExactNode(l_type start, 
+                                               l_type end) const {
+  l_type offset = 0;
+  NodeId current = this->root;
+  while (true) {
+    l_type curStart = nm.getStart(current);
+    l_type curEnd = nm.getEnd(current);
+    l_type curLength = curEnd - curStart;
+    if (curLength > end - start
+        || suffixUntil(curStart, curEnd, start, end, offset) < curLength) {
+      return NULL;
+    }
+    if (curLength == end - start) {
+      return current;
+    }
+    current = nm.getChild(current, seq[end - 1 - curLength]);
+    if (current == NULL) {
+      return NULL;
+    }
+    offset = curLength;
+  }
+}
+
+
+void ContextTree::enableSuffixLinks() {
+  if (this->links.get() != NULL) {
+    return;
+  }
+  this->links.reset(new SuffixLinks());
+  this->addAllSuffixLinks();
+}
+
+
+void ContextTree::addAllSuffixLinks() {
+  std::vector<NodeId> stack(1, this->root);
+  while (!stack.empty()) {
+    NodeId node = stack.back();
+    stack.pop_back();
+    if (node != this->root) {
+      this->addSuffixLink(node, nm.getStart(node), nm.getEnd(node), NULL);
+    }
+    const INodeManager::ChildMap& children = nm.getChildren(node);
+    for (INodeManager::ChildMapIterator it = children.begin();
+         it != children.end(); ++it) {
+      stack.push_back((*it).second);
+    }
+  }
 }
 
 
@@ -297,7 +627,8 @@ WrappedNode ContextTree::wrap(NodeId node, l_type depth) const {
   return WrappedNode(nm.getStart(node),
                      nm.getEnd(node),
                      nm.getPayload(node),
-                     depth); 
+                     depth,
+                     nm.getDiscountCache(node)); 
 }
 
 
@@ -306,7 +637,40 @@ ContextTree::DFSPathIterator ContextTree::getDFSPathIterator() const {
 }
 
 
-std::string ContextTree::pathToString(WrappedNodeList path,
+void ContextTree::splitAtDepth(
+    l_type splitDepth,
+    std::vector<ContextTree::DFSPathIterator>& subtrees,
+    std::vector<WrappedNodeList>& topPaths) const {
+  WrappedNodeList path;
+  this->splitAtDepth(this->root, splitDepth, path, subtrees, topPaths);
+}
+
+
+void ContextTree::splitAtDepth(
+    NodeId node,
+    l_type splitDepth,
+    WrappedNodeList& path,
+    std::vector<ContextTree::DFSPathIterator>& subtrees,
+    std::vector<WrappedNodeList>& topPaths) const {
+  l_type depth = path.size();
+  if (depth == splitDepth) {
+    subtrees.push_back(DFSPathIterator(path, node, nm, *this));
+  }
+  path.push_back(this->wrap(node, depth));
+  if (depth < splitDepth) {
+    INodeManager::ChildMap& children = nm.getChildren(node);
+    for (INodeManager::ChildMapIterator it = children.begin();
+         it != children.end(); ++it) {
+      this->splitAtDepth((*it).second, splitDepth, path, subtrees, topPaths);
+    }
+  }
+  // children first, as in DFSPathIterator
+  topPaths.push_back(path);
+  path.pop_back();
+}
+
+
+std::string ContextTree::pathToString(const WrappedNodeList& path,
                                       bool printString,
                                       bool printPayload) const {
   std::ostringstream outstream;
@@ -369,10 +733,24 @@ ContextTree::DFSPathIterator::DFSPathIterator(NodeId root,
                                             const INodeManager& nm, 
                                             const ContextTree& ct) 
     : root(root), nm(nm), ct(ct) {
+  this->descend();
+}
+
+ContextTree::DFSPathIterator::DFSPathIterator(const WrappedNodeList& prefix,
+                                              NodeId root, 
+                                              const INodeManager& nm, 
+                                              const ContextTree& ct) 
+    : root(root), nm(nm), ct(ct), currentPath(prefix) {
+  this->descend();
+}
+
+// push the root and then the first child on each level up to a leaf
+void ContextTree::DFSPathIterator::descend() {
+  int j = this->currentPath.size();
   IteratorState r(this->nm, this->root);
   this->iteratorStateStack.push(r);
-  this->currentPath.push_back(ct.wrap(this->root, 0));
-  int j = 1;
+  this->currentPath.push_back(ct.wrap(this->root, j));
+  ++j;
   while (this->iteratorStateStack.top().moreChildren()) {
     IteratorState c(this->nm,this->iteratorStateStack.top().pop());
     this->iteratorStateStack.push(c);
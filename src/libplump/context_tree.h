@@ -21,8 +21,12 @@
 #include <string>
 #include <sstream>
 #include <stack>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
 #include "libplump/config.h"
 #include "libplump/node_manager_interface.h"
+#include "libplump/small_vector.h"
+#include "libplump/suffix_links.h"
 
 namespace gatsby { namespace libplump {
 
@@ -34,15 +38,32 @@ namespace gatsby { namespace libplump {
  *
  * WrappedNodes and lists of wrapped Nodes (WrappedNodeList) are used in the
  * interface of the ContextTree.
+ *
+ * The discount, concentration, probability and slot fields are not touched
+ * by the ContextTree; they hold the per-level values HPYPModel computes 
+ * along a path, so that these are stored next to the nodes they belong to.
+ * discountCache points to the discount cached with the node in the tree, 
+ * if the node manager caches discounts.
  */ 
 class WrappedNode {
  public:
   l_type start, end, depth;
 
-  // non-owning pointer
+  // where the restaurant of the node keeps the observed type (see 
+  // PathOperations); kept apart from the other per-level values below, 
+  // where it would not fit into padding
+  int slot;
+
+  // non-owning pointers
   void* payload;
+  DiscountCache* discountCache;
+
+  // per-level values of the node on a path, filled in by the model
+  double discount, concentration, probability;
 
-  WrappedNode() : start(0), end(0), depth(0), payload(NULL) {}
+  WrappedNode() : start(0), end(0), depth(0), slot(0), payload(NULL), 
+                  discountCache(NULL), discount(0), concentration(0), 
+                  probability(0) {}
 
   WrappedNode(const WrappedNode& other) {
     *this = other;
@@ -55,15 +76,24 @@ class WrappedNode {
    * @param end   End position
    * @param payload Payload for this node (by value!)
    * @param depth Depth of this node in the tree
+   * @param discountCache Discount cache of this node, if any
    */
-  WrappedNode(l_type start, l_type end, void* payload, l_type depth) : 
-    start(start), end(end), depth(depth), payload(payload) {}
+  WrappedNode(l_type start, l_type end, void* payload, l_type depth,
+              DiscountCache* discountCache = NULL) : 
+    start(start), end(end), depth(depth), slot(0), payload(payload), 
+    discountCache(discountCache), discount(0), concentration(0), 
+    probability(0) {}
 
   WrappedNode& operator=(const WrappedNode& other) {
     this->start   = other.start;
   	this->end     = other.end;
   	this->depth   = other.depth;
+  	this->slot    = other.slot;
   	this->payload = other.payload;
+  	this->discountCache = other.discountCache;
+  	this->discount      = other.discount;
+  	this->concentration = other.concentration;
+  	this->probability   = other.probability;
   	return *this;
   }
 
@@ -78,8 +108,11 @@ class WrappedNode {
 /**
  * List of WrappedNodes; mainly used for representing pathes through the
  * context tree, e.g. as returned by ContextTree::findLongestSuffix.
+ * Paths up to PATH_INLINE_LENGTH nodes are stored without any heap 
+ * allocation.
  */
-typedef std::list<WrappedNode> WrappedNodeList;
+const unsigned int PATH_INLINE_LENGTH = 32;
+typedef SmallVector<WrappedNode, PATH_INLINE_LENGTH> WrappedNodeList;
 
 /**
  * The ContextTree class implements basic operations on context trees 
@@ -92,6 +125,7 @@ class ContextTree {
     typedef INodeManager::NodeId NodeId;
     class DFSPathIterator; // defined further below
     class InsertionResult; // defined further below
+    class Cursor; // defined further below
 
 
     ContextTree(INodeManager& nodeManager, seq_type& seq);
@@ -103,11 +137,49 @@ class ContextTree {
      */
     InsertionResult insert(l_type start, l_type end); 
 
+    /**
+     * Same as above, but stores the result in result, whose path is
+     * cleared first; reusing result across calls avoids allocations.
+     */
+    void insert(l_type start, l_type end, InsertionResult& result); 
+
+    /**
+     * Same as above, but if cursor was last used for the context 
+     * (start, end - 1), the suffix links are used to skip comparing the 
+     * part of the context that is known to be in the tree. Afterwards 
+     * cursor holds the path to the inserted node.
+     */
+    void insert(l_type start, l_type end, InsertionResult& result, 
+                Cursor& cursor); 
+
+    /**
+     * Insert all contexts (start, i) for start < i <= stop into the tree,
+     * which has to be empty (i.e. consist of the root only).
+     *
+     * The resulting tree is the same as after calling insert() for each i
+     * in increasing order, but is computed from the suffix array of the
+     * reversed sequence in linear time and written to the node manager
+     * top-down, without any splits. The new nodes have fresh payloads.
+     */
+    void insertAll(l_type start, l_type stop);
+
     /**
      * Find the path to the node which is the longest suffix of the given
      * subsequence within the tree.
      */
     WrappedNodeList findLongestSuffix (l_type start, l_type end) const;
+
+    /**
+     * Same as above, but stores the path in path, which is cleared first.
+     */
+    void findLongestSuffix (l_type start, l_type end, 
+                            WrappedNodeList& path) const;
+
+    /**
+     * Same as above, continuing from cursor as insert() does.
+     */
+    void findLongestSuffix (l_type start, l_type end, 
+                            WrappedNodeList& path, Cursor& cursor) const;
     
     /**
      * Find the node in the tree that corresponds to the given subsequence.
@@ -115,16 +187,82 @@ class ContextTree {
      */
     WrappedNodeList findNode(l_type start, l_type end) const;
 
+    /**
+     * Same as above, but stores the path in path, which is cleared first.
+     */
+    void findNode(l_type start, l_type end, WrappedNodeList& path) const;
+
     /**
      * Find the path to the node which is the longest suffix of the given
      * subsequence within the tree.
      */
     std::pair<int, WrappedNodeList> findLongestSuffixVirtual (l_type start,
                                                               l_type end) const;
+
+    /**
+     * Same as above, but stores the path in path, which is cleared first,
+     * and returns the length of the common suffix with the node below the
+     * end of the path (0 if the subsequence ends in the last node).
+     */
+    int findLongestSuffixVirtual (l_type start, l_type end,
+                                  WrappedNodeList& path) const;
+
+    /**
+     * Same as above, continuing from cursor as insert() does.
+     */
+    int findLongestSuffixVirtual (l_type start, l_type end,
+                                  WrappedNodeList& path, 
+                                  Cursor& cursor) const;
+
+    /**
+     * Keep the suffix links of all nodes, starting with those already in
+     * the tree (which takes one lookup per node). 
+     *
+     * With the links, the methods taking a Cursor find the node for the
+     * context ending at end from the path to the one ending at end - 1: the
+     * deepest node on that path with a link for the symbol at end - 1 leads
+     * to the deepest node known to be a suffix of the new context, so that 
+     * only the part of the context below it needs to be compared. For 
+     * consecutive contexts this takes amortized constant time in the length
+     * of the contexts, at the cost of one hash table entry per node.
+     */
+    void enableSuffixLinks();
+
+    bool hasSuffixLinks() const {
+      return this->links.get() != NULL;
+    }
     
     DFSPathIterator getDFSPathIterator() const;
 
-    std::string pathToString(WrappedNodeList path, 
+    /**
+     * Split the tree at the given depth (the root has depth 0).
+     *
+     * For every node at depth splitDepth, subtrees receives a DFSPathIterator
+     * over the subtree rooted at that node, whose paths start at the root of
+     * the tree. topPaths receives the paths to all nodes of depth at most
+     * splitDepth, in the order in which a DFSPathIterator visits them.
+     */
+    void splitAtDepth(l_type splitDepth,
+                      std::vector<DFSPathIterator>& subtrees,
+                      std::vector<WrappedNodeList>& topPaths) const;
+
+    /**
+     * Notify the node manager that the payload of the given node has been
+     * changed in place.
+     */
+    void markModified(const WrappedNode& node) {
+      this->nm.markModified(node.start, node.end, node.payload);
+    }
+
+    /**
+     * Notify the node manager that the payloads of all nodes may have been
+     * changed.
+     */
+    void markAllModified() {
+      this->nm.markAllModified();
+    }
+
+    std::string pathToString(const WrappedNodeList& path, 
                              bool printString = false, 
                              bool printPayload = true) const;
 
@@ -163,6 +301,61 @@ class ContextTree {
 
 
 
+    /**
+     * State carried from one lookup to the next: the nodes that fully 
+     * match the last context looked up or inserted with this cursor. Each
+     * thread needs its own cursor; cursors are cheap to construct.
+     */
+    class Cursor {
+      public:
+        Cursor() : start(0), end(0), current(0), valid(false) {}
+
+        /**
+         * Forget the last context, e.g. after the tree has been changed
+         * by other means (this is never required for correctness).
+         */
+        void reset() {
+          this->valid = false;
+        }
+
+      private:
+        friend class ContextTree;
+
+        struct Node {
+          NodeId node;
+          l_type length;
+        };
+
+        typedef SmallVector<Node, PATH_INLINE_LENGTH> NodePath;
+
+        /**
+         * Start a lookup of (start, end). Returns the nodes of 
+         * (start, end - 1) if the cursor holds them, and NULL otherwise.
+         */
+        const NodePath* advance(l_type start, l_type end) {
+          bool follows = this->valid && start == this->start 
+                         && end == this->end + 1;
+          this->current ^= 1;
+          this->paths[this->current].clear();
+          this->start = start;
+          this->end = end;
+          this->valid = true;
+          return follows ? &this->paths[this->current ^ 1] : NULL;
+        }
+
+        void push(NodeId node, l_type length) {
+          Node n = {node, length};
+          this->paths[this->current].push_back(n);
+        }
+
+        l_type start, end;
+        // the current path and the one of the previous context
+        NodePath paths[2];
+        int current;
+        bool valid;
+    };
+
+
     class ToStringVisitor {
       public:
         ToStringVisitor(seq_type& seq);
@@ -183,12 +376,21 @@ class ContextTree {
       public:
         DFSPathIterator(NodeId root, const INodeManager& nm, 
                         const ContextTree& ct);
+
+        /**
+         * Iterate over the subtree rooted at root, where prefix is the path
+         * from the root of the tree to the parent of root. 
+         */
+        DFSPathIterator(const WrappedNodeList& prefix, NodeId root,
+                        const INodeManager& nm, const ContextTree& ct);
         WrappedNodeList& operator*();
         DFSPathIterator& operator ++(); // prefix version
         DFSPathIterator operator ++(int); // postfix version
         bool hasMore();
       
       private:
+        void descend(); 
+
         class IteratorState {
           public:
             IteratorState(const INodeManager& nm, NodeId node);
@@ -214,6 +416,46 @@ class ContextTree {
     INodeManager& nm;
     seq_type& seq;
     INodeManager::NodeId root;
+    // NULL unless enableSuffixLinks() has been called
+    boost::scoped_ptr<SuffixLinks> links;
+
+    // implementations of the public methods; cursor may be NULL
+    void doInsert(l_type start, l_type end, InsertionResult& result,
+                  Cursor* cursor);
+
+    void doFindLongestSuffix(l_type start, l_type end, WrappedNodeList& path,
+                             Cursor* cursor) const;
+
+    int doFindLongestSuffixVirtual(l_type start, l_type end, 
+                                   WrappedNodeList& path, 
+                                   Cursor* cursor) const;
+
+    /**
+     * Length of the prefix of the context (start, end) that is known to
+     * be in the tree, given the nodes of (start, end - 1). If skipPrevious
+     * is set, the node of (start, end - 1) itself is not considered.
+     */
+    l_type knownMatch(l_type start, l_type end, 
+                      const Cursor::NodePath* previous,
+                      bool skipPrevious) const;
+
+    /**
+     * Add the suffix link of the new node for the context (start, end); 
+     * previous holds the nodes of (start, end - 1) if known.
+     */
+    void addSuffixLink(NodeId node, l_type start, l_type end,
+                       const Cursor::NodePath* previous);
+
+    /**
+     * Return the node for exactly the context (start, end), or NULL if 
+     * there is none.
+     */
+    NodeId findExactNode(l_type start, l_type end) const;
+
+    /**
+     * Add the suffix links of all nodes in the tree.
+     */
+    void addAllSuffixLinks();
 
     /**
      * Determine the first position where the subsequence delimited by start 
@@ -239,6 +481,12 @@ class ContextTree {
     
     WrappedNode wrap(NodeId node, l_type depth) const;
 
+    void splitAtDepth(NodeId node,
+                      l_type splitDepth,
+                      WrappedNodeList& path,
+                      std::vector<DFSPathIterator>& subtrees,
+                      std::vector<WrappedNodeList>& topPaths) const;
+
 
 
 };
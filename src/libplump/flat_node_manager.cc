@@ -0,0 +1,194 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/flat_node_manager.h"
+
+#include <cassert>
+#include <stack>
+
+namespace gatsby { namespace libplump {
+
+FlatNodeManager::FlatNodeManager(const IPayloadFactory& payloadFactory,
+                                 bool cacheDiscounts)
+    : payloadFactory(payloadFactory), blocks(), 
+      cacheDiscounts(cacheDiscounts), discountCaches(), numAllocated(1), 
+      freeNodes(), childMaps(1), freeChildMaps(), noChildren(), root(NULL) {
+  this->root = handle(this->createNode(0, 0));
+}
+
+
+FlatNodeManager::~FlatNodeManager() {
+  this->destroyNode(this->root);
+  for (size_t i = 0; i < this->blocks.size(); ++i) {
+    delete this->blocks[i];
+  }
+  for (size_t i = 0; i < this->discountCaches.size(); ++i) {
+    delete[] this->discountCaches[i];
+  }
+}
+
+
+INodeManager::NodeId FlatNodeManager::setChild(NodeId node, 
+                                               e_type key, 
+                                               l_type start, 
+                                               l_type end,
+                                               void* payload) {
+  NodeId newNode = handle(this->createNode(start, end, payload));
+  this->makeChildMap(index(node))[key] = newNode;
+  return newNode;
+}
+
+
+INodeManager::NodeId FlatNodeManager::insertBetween(NodeId parent, 
+                                                    e_type oldKey,
+                                                    l_type newStart, 
+                                                    l_type newEnd,  
+                                                    e_type newKey) {
+  // we can safely assume that parent is an inner node
+  ChildMap& parentChildren = this->makeChildMap(index(parent));
+  NodeId oldChild = parentChildren[oldKey];
+  // create intermediate node
+  Index newParent = this->createNode(newStart, newEnd);
+  // make old node child of intermediate; this may add a map to childMaps,
+  // but does not invalidate parentChildren
+  this->makeChildMap(newParent)[newKey] = oldChild;
+  // make intermediate node child of parent
+  parentChildren[oldKey] = handle(newParent);
+  return handle(newParent);
+}
+
+
+void FlatNodeManager::removeChild(NodeId node, e_type key) {
+  Index& maps = this->childMapOf(index(node));
+  if (maps == NO_INDEX) {
+    return;
+  }
+  ChildMap& children = this->childMaps[maps];
+  children.erase(key);
+  if (children.empty()) {
+    // the node is a leaf again
+    children.clear();
+    this->freeChildMaps.push_back(maps);
+    maps = NO_INDEX;
+  }
+}
+
+
+void FlatNodeManager::setPayload(NodeId node, void* payload) {
+  Index i = index(node);
+  void*& slot = this->blocks[i >> BLOCK_BITS]->payload[i & BLOCK_MASK];
+  this->payloadFactory.recycle(slot);
+  slot = payload;
+}
+
+
+void FlatNodeManager::destroyNode(NodeId node) {
+  if (node == NULL) {
+    return;
+  }
+  Index i = index(node);
+  this->payloadFactory.recycle(
+      this->blocks[i >> BLOCK_BITS]->payload[i & BLOCK_MASK]);
+  Index& maps = this->childMapOf(i);
+  if (maps != NO_INDEX) {
+    this->childMaps[maps].clear();
+    this->freeChildMaps.push_back(maps);
+    maps = NO_INDEX;
+  }
+  this->freeNodes.push_back(i);
+}
+
+
+void FlatNodeManager::destroyNodeRecursive(NodeId node) {
+  if (node == NULL) {
+    return;
+  }
+  // iterative, as context trees can be much deeper than the call stack
+  std::stack<NodeId> toDestroy;
+  toDestroy.push(node);
+  while (!toDestroy.empty()) {
+    NodeId current = toDestroy.top();
+    toDestroy.pop();
+    ChildMap& children = this->getChildren(current);
+    for (ChildMapIterator it = children.begin(); it != children.end(); ++it) {
+      toDestroy.push((*it).second);
+    }
+    this->destroyNode(current);
+  }
+  if (node == this->root) {
+    // if we have destroyed the root, create a new one
+    this->root = handle(this->createNode(0, 0));
+  }
+}
+
+
+size_t FlatNodeManager::memoryUsage() const {
+  size_t bytes = this->blocks.size() * sizeof(Block);
+  bytes += this->discountCaches.size() * BLOCK_SIZE * sizeof(DiscountCache);
+  for (size_t i = 1; i < this->childMaps.size(); ++i) {
+    bytes += sizeof(ChildMap) + this->childMaps[i].memoryUsage();
+  }
+  bytes += this->freeNodes.capacity() * sizeof(Index);
+  bytes += this->freeChildMaps.capacity() * sizeof(Index);
+  return bytes;
+}
+
+
+INodeManager::ChildMap& FlatNodeManager::makeChildMap(Index i) {
+  Index& maps = this->childMapOf(i);
+  if (maps == NO_INDEX) {
+    if (!this->freeChildMaps.empty()) {
+      maps = this->freeChildMaps.back();
+      this->freeChildMaps.pop_back();
+    } else {
+      maps = this->childMaps.size();
+      this->childMaps.push_back(ChildMap());
+    }
+  }
+  return this->childMaps[maps];
+}
+
+
+FlatNodeManager::Index FlatNodeManager::createNode(l_type start, 
+                                                   l_type end, 
+                                                   void* payload) {
+  Index i;
+  if (!this->freeNodes.empty()) {
+    i = this->freeNodes.back();
+    this->freeNodes.pop_back();
+  } else {
+    assert(this->numAllocated != NO_INDEX); // out of 32 bit indices
+    i = this->numAllocated++;
+    if ((i >> BLOCK_BITS) == this->blocks.size()) {
+      this->blocks.push_back(new Block());
+      if (this->cacheDiscounts) {
+        this->discountCaches.push_back(new DiscountCache[BLOCK_SIZE]);
+      }
+    }
+  }
+  if (this->cacheDiscounts) {
+    this->discountCaches[i >> BLOCK_BITS][i & BLOCK_MASK].invalidate();
+  }
+  Block& block = *this->blocks[i >> BLOCK_BITS];
+  block.start[i & BLOCK_MASK] = start;
+  block.end[i & BLOCK_MASK] = end;
+  block.payload[i & BLOCK_MASK] = 
+      (payload != NULL) ? payload : this->payloadFactory.make();
+  block.childMap[i & BLOCK_MASK] = NO_INDEX;
+  return i;
+}
+
+}} // namespace gatsby::libplump
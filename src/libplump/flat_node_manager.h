@@ -0,0 +1,214 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAT_NODE_MANAGER_H_
+#define FLAT_NODE_MANAGER_H_
+
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/node_manager_interface.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A FlatNodeManager stores the nodes in arrays (one per field) that are 
+ * indexed by 32 bit node indices, rather than allocating each node 
+ * separately. The NodeId of a node is its index, so handles can be used
+ * exactly like those of SimpleNodeManager.
+ *
+ * The arrays are allocated in blocks of a fixed number of nodes, so that 
+ * growing the store never moves existing nodes. Child maps are only created
+ * for nodes that get children; as most nodes of a context tree are leaves,
+ * this saves the space of a ChildMap for most nodes.
+ *
+ * The map returned by getChildren for a node without children is shared
+ * between all such nodes and must not be modified.
+ *
+ * If cacheDiscounts is set, each node also stores a DiscountCache (in 
+ * blocks of their own, so that nothing is allocated otherwise).
+ */
+class FlatNodeManager : public INodeManager {
+
+  public:
+
+    FlatNodeManager(const IPayloadFactory& payloadFactory,
+                    bool cacheDiscounts = false);
+
+    ~FlatNodeManager();
+
+    NodeId getRoot() const {
+      return this->root;
+    }
+
+    NodeId getChild(NodeId node, e_type key) const {
+      Index maps = this->childMapOf(index(node));
+      if (maps == NO_INDEX) {
+        return NULL;
+      }
+      const ChildMap& children = this->childMaps[maps];
+      ChildMapIterator child = children.find(key);
+      if (child != children.end()) {
+        return (*child).second;
+      } else {
+        return NULL;
+      }
+    }
+
+    /**
+     * Create a new child of node with the given key, start and end positions 
+     * and returns a handle to the newly created node.
+     *
+     * As for SimpleNodeManager, an existing child with the same key is 
+     * replaced without being destroyed.
+     */
+    NodeId setChild(NodeId node, e_type key, l_type start, l_type end,
+                    void* payload = NULL);
+
+    NodeId insertBetween(NodeId parent, e_type oldKey,
+                         l_type newStart, l_type newEnd,  e_type newKey);
+
+    /**
+     * Remove the child with key key from node's child list; the child 
+     * itself is not destroyed. 
+     */
+    void removeChild(NodeId node, e_type key);
+
+    void* getPayload(NodeId node) const {
+      Index i = index(node);
+      return this->blocks[i >> BLOCK_BITS]->payload[i & BLOCK_MASK];
+    }
+
+    void setPayload(NodeId node, void* payload);
+
+    l_type getStart(NodeId node) const {
+      Index i = index(node);
+      return this->blocks[i >> BLOCK_BITS]->start[i & BLOCK_MASK];
+    }
+
+    l_type getEnd(NodeId node) const {
+      Index i = index(node);
+      return this->blocks[i >> BLOCK_BITS]->end[i & BLOCK_MASK];
+    }
+
+    ChildMap& getChildren(NodeId node) const {
+      Index maps = this->childMapOf(index(node));
+      if (maps == NO_INDEX) {
+        return this->noChildren;
+      }
+      return this->childMaps[maps];
+    }
+
+    DiscountCache* getDiscountCache(NodeId node) const {
+      if (!this->cacheDiscounts) {
+        return NULL;
+      }
+      Index i = index(node);
+      return &this->discountCaches[i >> BLOCK_BITS][i & BLOCK_MASK];
+    }
+
+    /**
+     * Destroy the node with the given handle and make its index available 
+     * for reuse; its children are not destroyed.
+     */
+    void destroyNode(NodeId node);
+
+    /**
+     * Destroy the given node and all its children.
+     */
+    void destroyNodeRecursive(NodeId node);
+
+    /**
+     * Number of nodes currently in use.
+     */
+    size_t numNodes() const {
+      return this->numAllocated - this->freeNodes.size();
+    }
+
+    /**
+     * Approximate number of bytes used by the node store, not including 
+     * payloads.
+     */
+    size_t memoryUsage() const;
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(FlatNodeManager);
+
+    typedef uint32_t Index;
+
+    // index 0 is never used, so that the NodeId of a node is never NULL
+    static const Index NO_INDEX = 0;
+    static const int BLOCK_BITS = 16;
+    static const Index BLOCK_SIZE = 1 << BLOCK_BITS;
+    static const Index BLOCK_MASK = BLOCK_SIZE - 1;
+
+    /**
+     * Storage for BLOCK_SIZE nodes, one array per field. 
+     */
+    struct Block {
+      l_type start[BLOCK_SIZE];
+      l_type end[BLOCK_SIZE];
+      void* payload[BLOCK_SIZE];
+      // index into childMaps, or NO_INDEX if the node has no children
+      Index childMap[BLOCK_SIZE];
+    };
+
+    static Index index(NodeId node) {
+      return (Index)(uintptr_t)node;
+    }
+
+    static NodeId handle(Index i) {
+      return (NodeId)(uintptr_t)i;
+    }
+
+    Index& childMapOf(Index i) const {
+      return this->blocks[i >> BLOCK_BITS]->childMap[i & BLOCK_MASK];
+    }
+
+    /**
+     * Return the child map of node i, creating it if necessary.
+     */
+    ChildMap& makeChildMap(Index i);
+
+    /**
+     * Create a new, initally unreferenced node and return its index.
+     */
+    Index createNode(l_type start, l_type end, void* payload = NULL);
+
+    const IPayloadFactory& payloadFactory;
+    std::vector<Block*> blocks;
+    // if cacheDiscounts, one array of BLOCK_SIZE caches per block
+    bool cacheDiscounts;
+    std::vector<DiscountCache*> discountCaches;
+    // number of indices handed out so far, including NO_INDEX
+    Index numAllocated;
+    std::vector<Index> freeNodes;
+
+    // a deque, so that references returned by getChildren stay valid when
+    // maps are added; element 0 is unused 
+    mutable std::deque<ChildMap> childMaps;
+    std::vector<Index> freeChildMaps;
+    mutable ChildMap noChildren;
+
+    NodeId root;
+};
+
+}} // namespace gatsby::libplump
+
+#endif
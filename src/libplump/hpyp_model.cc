@@ -16,9 +16,14 @@
 
 #include "libplump/hpyp_model.h"
 
+#include <algorithm>
 #include <cmath>
+#include <map>
 #include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "libplump/utils.h"
 #include "libplump/subseq.h"
@@ -39,25 +44,28 @@ HPYPModel::HPYPModel(seq_type& seq,
       contextTree(*contextTree_), 
       restaurant(restaurant),
       parameters(parameters), 
+      pathOperations(NULL),
       numTypes(numTypes) {
     baseProb = 1./((double) numTypes);
   }
  
 
+size_t HPYPModel::getSequenceLength() const {
+  return this->seq.size();
+}
+
+
 void HPYPModel::insertRoot(e_type obs) {
-  WrappedNodeList root_path = this->contextTree.findLongestSuffix(0,0);
-  d_vec discount_path = this->parameters.getDiscounts(root_path);
-  d_vec concentration_path = this->parameters.getConcentrations(root_path,
-                                                                discount_path);
-  d_vec prob_path = this->computeProbabilityPath(root_path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  this->updatePath(root_path,
-                   prob_path,
-                   discount_path,
-                   concentration_path,
-                   obs);
+  WrappedNodeList root_path;
+  this->contextTree.findLongestSuffix(0, 0, root_path);
+  this->setPathParameters(root_path);
+  this->computeProbabilityPath(root_path, obs);
+  this->updatePath(root_path, obs);
+}
+
+
+WrappedNodeList HPYPModel::insertContext(l_type start, l_type stop) {
+  return this->insertContextPath(start, stop);
 }
 
 
@@ -65,11 +73,12 @@ void HPYPModel::insertRoot(e_type obs) {
  * Insert a context into the tree and handle a potentially occuring 
  * split.
  */
-WrappedNodeList HPYPModel::insertContext(l_type start, l_type stop) {
+WrappedNodeList& HPYPModel::insertContextPath(l_type start, l_type stop) {
   typedef ContextTree::InsertionResult InsertionResult;
 
   // insert context
-  InsertionResult insertionResult = contextTree.insert(start, stop);
+  InsertionResult& insertionResult = this->insertion;
+  contextTree.insert(start, stop, insertionResult, this->insertionCursor);
 
   // handle split if one occurred
   if (insertionResult.action != InsertionResult::INSERT_ACTION_NO_SPLIT) { 
@@ -107,22 +116,23 @@ WrappedNodeList HPYPModel::insertContext(l_type start, l_type stop) {
 d_vec HPYPModel::insertContextAndObservation(l_type start, 
                                              l_type stop,
                                              e_type obs) {
+  return this->probabilityVector(
+      this->insertContextAndObservationPath(start, stop, obs));
+}
+
+
+const WrappedNodeList& HPYPModel::insertContextAndObservationPath(
+    l_type start, l_type stop, e_type obs) {
   // insert context (and handle a potential split)
-  WrappedNodeList path = insertContext(start, stop);
+  WrappedNodeList& path = this->insertContextPath(start, stop);
 
   // insert observation
-  d_vec discountPath = this->parameters.getDiscounts(path);
-  d_vec concentrationPath = this->parameters.getConcentrations(path,
-                                                               discountPath);
-  d_vec probabilityPath = this->computeProbabilityPath(path,
-                                                       discountPath,
-                                                       concentrationPath,
-                                                       obs);
-  this->parameters.accumulateParameterGradient(this->restaurant, 
-      path, probabilityPath, discountPath, concentrationPath, obs);
-
-  this->updatePath(path, probabilityPath, discountPath,
-                   concentrationPath, obs);
+  this->setPathParameters(path);
+  this->computeProbabilityPath(path, obs);
+  this->parameters.accumulatePathGradient(this->restaurant, path, 
+                                          this->baseProb, obs);
+
+  this->updatePath(path, obs);
 
   // static int j = 0;
   //if (j == 1) {
@@ -131,7 +141,7 @@ d_vec HPYPModel::insertContextAndObservation(l_type start,
   //}
   
 
-  return probabilityPath; 
+  return path; 
 }
 
 
@@ -144,22 +154,16 @@ d_vec HPYPModel::insertObservation(l_type start, l_type stop, e_type obs,
   if (cached_path != NULL) {
     path = *cached_path;
   } else {
-    path = this->contextTree.findLongestSuffix(start,stop);
+    this->contextTree.findLongestSuffix(start, stop, path);
   }
   
   tracer << "  HPYPModel::insertObservation: longest suffix path: " 
          << std::endl << this->contextTree.pathToString(path) << std::endl;
   
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
-  d_vec prob_path = this->computeProbabilityPath(path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  this->updatePath(path, prob_path, discount_path,
-                   concentration_path, obs);
-  return prob_path; 
+  this->setPathParameters(path);
+  this->computeProbabilityPath(path, obs);
+  this->updatePath(path, obs);
+  return this->probabilityVector(path); 
 }
 
 
@@ -226,8 +230,9 @@ d_vec HPYPModel::computeLosses(l_type start, l_type stop) {
   start_t = clock();
 
   for (l_type i=start+1; i < stop; i++) {
-    d_vec prob_path = this->insertContextAndObservation(start,i,this->seq[i]);
-    double prob = prob_path[prob_path.size()-2];
+    const WrappedNodeList& path = this->insertContextAndObservationPath(
+        start, i, this->seq[i]);
+    double prob = this->parentProbability(path, path.size() - 1);
     losses.push_back(-log2(prob));
     
     if (i%10000==0) {
@@ -260,8 +265,9 @@ d_vec HPYPModel::computeLossesWithDeletion(l_type start, l_type stop, l_type lag
   start_t = clock();
 
   for (l_type i=start+1; i < stop; i++) {
-    d_vec prob_path = this->insertContextAndObservation(start,i,this->seq[i]);
-    double prob = prob_path[prob_path.size()-2];
+    const WrappedNodeList& path = this->insertContextAndObservationPath(
+        start, i, this->seq[i]);
+    double prob = this->parentProbability(path, path.size() - 1);
     losses.push_back(-log2(prob));
     if (i - lag >= start) {
       HPYPModel::PayloadDataPath payloadDataPath;
@@ -287,51 +293,210 @@ d_vec HPYPModel::computeLossesWithDeletion(l_type start, l_type stop, l_type lag
 }
 
 
-d_vec HPYPModel::predictSequence(l_type start, l_type stop, PredictMode mode) {
-  d_vec probs;
-  for (l_type i = start; i < stop; i++) {
+d_vec HPYPModel::predictSequence(l_type start, 
+                                 l_type stop, 
+                                 PredictMode mode,
+                                 int numThreads) const {
+  d_vec probs(std::max(stop - start, 0));
+  if (probs.empty()) {
+    return probs;
+  }
+  numThreads = std::max(1, std::min(numThreads, (int)probs.size()));
+  
+  // payloads are made and recycled here rather than in the threads, as
+  // the payload pools are not thread safe
+  std::vector<void*> scratchPayloads(numThreads, (void*)NULL);
+  if (mode == FRAGMENT) {
+    for (int t = 0; t < numThreads; ++t) {
+      scratchPayloads[t] = this->restaurant.getFactory().make();
+    }
+  }
+
+  // the chunks, and in FRAGMENT mode their random streams, do not depend
+  // on numThreads, so that neither do the results; small chunks keep the 
+  // threads balanced, as the cost per position depends on the depth of its
+  // context
+  l_type chunkSize = std::max(1, std::min(1024, (int)probs.size() / 64));
+  SequenceCursor cursor(start, stop, chunkSize);
+  boost::scoped_ptr<RngContext> rootRng(
+      (mode == FRAGMENT) ? new RngContext(gsl_rng_get(current_rng())) : NULL);
+  if (numThreads == 1) {
+    this->predictSequenceWorker(start, mode, scratchPayloads[0], 
+                                rootRng.get(), &cursor, &probs[0]);
+  } else {
+    boost::thread_group threads;
+    for (int t = 0; t < numThreads; ++t) {
+      threads.create_thread(boost::bind(&HPYPModel::predictSequenceWorker,
+                                        this, start, mode, scratchPayloads[t],
+                                        rootRng.get(), &cursor, &probs[0]));
+    }
+    threads.join_all();
+  }
+
+  if (mode == FRAGMENT) {
+    for (int t = 0; t < numThreads; ++t) {
+      this->restaurant.getFactory().recycle(scratchPayloads[t]);
+    }
+  }
+  return probs;
+}
+
+
+void HPYPModel::predictSequenceRange(l_type start,
+                                     l_type from,
+                                     l_type to,
+                                     PredictMode mode,
+                                     void* scratchPayload,
+                                     double* out) const {
+  ContextTree::Cursor cursor;
+  for (l_type i = from; i < to; i++) {
     switch(mode) {
       case ABOVE:
-        probs.push_back(this->predict(start, i, this->seq[i]));
+        out[i - start] = this->predict(start, i, this->seq[i], cursor);
         break;
       case FRAGMENT:
-        probs.push_back(this->predictWithFragmentation(start, i, this->seq[i]));
+        out[i - start] = this->predictWithFragmentation(start, i, this->seq[i],
+                                                        scratchPayload, 
+                                                        cursor);
         break;
       case BELOW:
-        probs.push_back(this->predictBelow(start, i, this->seq[i]));
+        out[i - start] = this->predictBelow(start, i, this->seq[i], cursor);
         break;
     }
   }
-  return probs;
+}
+
+
+void HPYPModel::predictSequenceWorker(l_type start,
+                                      PredictMode mode,
+                                      void* scratchPayload,
+                                      const RngContext* rootRng,
+                                      SequenceCursor* cursor,
+                                      double* out) const {
+  l_type chunkFrom, chunkTo;
+  while (cursor->take(chunkFrom, chunkTo)) {
+    if (rootRng == NULL) {
+      this->predictSequenceRange(start, chunkFrom, chunkTo, mode, 
+                                 scratchPayload, out);
+      continue;
+    }
+    RngContext chunkRng(*rootRng, chunkFrom);
+    ThreadRngScope rngScope(chunkRng);
+    this->predictSequenceRange(start, chunkFrom, chunkTo, mode, 
+                               scratchPayload, out);
+  }
 }
 
 
 void HPYPModel::buildTree(l_type stop) {
   this->insertRoot(this->seq[0]);
   for (l_type i=1; i < stop; ++i) {
-    this->insertContextAndObservation(0, i, this->seq[i]);
+    this->insertContextAndObservationPath(0, i, this->seq[i]);
   }
 }
 
 
 void HPYPModel::updateTree(l_type start, l_type stop) {
   for (l_type i = start; i < stop; ++i) {
-    this->insertContextAndObservation(0, i, this->seq[i]);
+    this->insertContextAndObservationPath(0, i, this->seq[i]);
   }
 }
 
 
-double HPYPModel::predict(l_type start, l_type stop, e_type obs) {
-  WrappedNodeList path = this->contextTree.findLongestSuffix(start,stop);
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
+void HPYPModel::bulkTrain(l_type start, l_type stop, int numThreads,
+                          int splitDepth) {
+  assert(this->restaurant.isDeterministic());
+  if (stop <= start) {
+    return;
+  }
+  numThreads = std::max(1, numThreads);
+  splitDepth = std::max(0, splitDepth);
+  // computeLosses inserts the contexts (start, i) for start < i < stop
+  this->contextTree.insertAll(start, stop - 1);
+  this->contextTree.markAllModified();
+  std::vector<ContextTree::DFSPathIterator> subtrees;
+  std::vector<WrappedNodeList> topPaths;
+  this->contextTree.splitAtDepth(splitDepth, subtrees, topPaths);
+
+  // each node only receives customers from its own children, so the 
+  // subtrees are independent
+  SubtreeCursor cursor(subtrees.size());
+  if (numThreads == 1) {
+    this->bulkTrainSubtrees(start, stop, splitDepth, &subtrees, &cursor);
+  } else {
+    boost::thread_group threads;
+    for (int t = 0; t < numThreads; ++t) {
+      threads.create_thread(boost::bind(&HPYPModel::bulkTrainSubtrees,
+                                        this, start, stop, splitDepth,
+                                        &subtrees, &cursor));
+    }
+    threads.join_all();
+  }
+
+  // topPaths lists children before their parents
+  for (std::vector<WrappedNodeList>::const_iterator it = topPaths.begin();
+       it != topPaths.end(); ++it) {
+    this->bulkTrainNode(start, stop, *it);
+  }
+}
+
 
-  d_vec prob_path = this->computeProbabilityPath(path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  return prob_path.back();
+void HPYPModel::bulkTrainSubtrees(
+    l_type start,
+    l_type stop,
+    int splitDepth,
+    std::vector<ContextTree::DFSPathIterator>* subtrees,
+    SubtreeCursor* cursor) {
+  int i;
+  while (cursor->take(i)) {
+    // the last path visited is the one to the subtree root
+    ContextTree::DFSPathIterator& pathIterator = (*subtrees)[i];
+    while ((int)(*pathIterator).size() > splitDepth + 1) {
+      this->bulkTrainNode(start, stop, *pathIterator);
+      ++pathIterator;
+    }
+  }
+}
+
+
+void HPYPModel::bulkTrainNode(l_type start, l_type stop, 
+                              const WrappedNodeList& path) {
+  const WrappedNode& node = path.back();
+  // the root is the context (start, start); any other node is a context 
+  // (start, i) if it starts at start (see ContextTree::insertAll)
+  if (path.size() == 1 || node.start == start) {
+    l_type end = (path.size() == 1) ? start : node.end;
+    if (end < stop) {
+      this->restaurant.addCustomer(node.payload, this->seq[end], 0, 0, 0);
+    }
+  }
+  if (path.size() == 1) {
+    return;
+  }
+  void* parent = path[path.size() - 2].payload;
+  IHPYPBaseRestaurant::TypeVector types = 
+      this->restaurant.getTypeVector(node.payload);
+  for (IHPYPBaseRestaurant::TypeVectorIterator it = types.begin();
+       it != types.end(); ++it) {
+    for (l_type t = this->restaurant.getT(node.payload, *it); t > 0; --t) {
+      this->restaurant.addCustomer(parent, *it, 0, 0, 0);
+    }
+  }
+}
+
+
+double HPYPModel::predict(l_type start, l_type stop, e_type obs) const {
+  ContextTree::Cursor cursor;
+  return this->predict(start, stop, obs, cursor);
+}
+
+
+double HPYPModel::predict(l_type start, l_type stop, e_type obs,
+                          ContextTree::Cursor& cursor) const {
+  WrappedNodeList path;
+  this->contextTree.findLongestSuffix(start, stop, path, cursor);
+  this->setPathParameters(path);
+  return this->computeProbabilityPath(path, obs);
 }
 
 
@@ -339,115 +504,257 @@ double HPYPModel::predict(l_type start, l_type stop, e_type obs) {
  * Predict prob; in the case of required fragmentation, predict form 
  * _below_ the split point!
  */
-double HPYPModel::predictBelow(l_type start, l_type stop, e_type obs) {
-  WrappedNodeList path = 
-      this->contextTree.findLongestSuffixVirtual(start,stop).second;
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
-
-  d_vec prob_path = this->computeProbabilityPath(path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  return prob_path.back();
+double HPYPModel::predictBelow(l_type start, l_type stop, e_type obs) const {
+  ContextTree::Cursor cursor;
+  return this->predictBelow(start, stop, obs, cursor);
+}
+
+
+double HPYPModel::predictBelow(l_type start, l_type stop, e_type obs,
+                               ContextTree::Cursor& cursor) const {
+  WrappedNodeList path;
+  this->contextTree.findLongestSuffixVirtual(start, stop, path, cursor);
+  this->setPathParameters(path);
+  return this->computeProbabilityPath(path, obs);
 }
 
 
 double HPYPModel::predictWithFragmentation(l_type start, 
                                            l_type stop,
                                            e_type obs) {
-  std::pair<int, WrappedNodeList> path = contextTree.findLongestSuffixVirtual(
-      start, stop);
+  void* scratchPayload = this->restaurant.getFactory().make();
+  double probability = this->predictWithFragmentation(start, stop, obs,
+                                                      scratchPayload);
+  this->restaurant.getFactory().recycle(scratchPayload);
+  return probability;
+}
 
-  d_vec discountPath = parameters.getDiscounts(path.second);
-  d_vec concentrationPath = parameters.getConcentrations(path.second,
-                                                         discountPath);
-  d_vec probabilityPath = this->computeProbabilityPath(path.second,
-                                                       discountPath,
-                                                       concentrationPath,
-                                                       obs);
-
-  double probability = 0;
-  if (path.first != 0) {
-    // create a new payload for the node we are predicting from
+
+double HPYPModel::predictWithFragmentation(l_type start, 
+                                           l_type stop,
+                                           e_type obs,
+                                           void* scratchPayload) const {
+  ContextTree::Cursor cursor;
+  return this->predictWithFragmentation(start, stop, obs, scratchPayload, 
+                                        cursor);
+}
+
+
+double HPYPModel::predictWithFragmentation(l_type start, 
+                                           l_type stop,
+                                           e_type obs,
+                                           void* scratchPayload,
+                                           ContextTree::Cursor& cursor) const {
+  WrappedNodeList path;
+  int fragmentLength = contextTree.findLongestSuffixVirtual(start, stop, path,
+                                                            cursor);
+
+  this->setPathParameters(path);
+  double probability = this->computeProbabilityPath(path, obs);
+
+  if (fragmentLength != 0) {
+    // fill the scratch payload with the node we are predicting from
     // fragmentation -- last probability on the path needs to be recomputed
-    // by creating a new, split node of length path.second. 
-    void* splitNode = this->restaurant.getFactory().make();
-    WrappedNodeList::iterator it = path.second.end();
-    it--; it--; // one before last; parent of node we need to split
-    int parentLength = it->end - it->start; 
-    // path.first is length of parent after split
-    double discountAfter = parameters.getDiscount(path.first, it->end - it->start);
-    it++; // last node
-    double discountFragmented = this->parameters.getDiscount(parentLength,
-                                                             path.first);
-    this->restaurant.updateAfterSplit(
-        it->payload,
-        splitNode,
-        discountPath.back(),
-        discountFragmented,
-        true); // update splitNode only
-    double concentrationFragmented = this->parameters.getConcentration(
-        discountFragmented, parentLength, path.first);
+    // by creating a new, split node of length fragmentLength. 
+    double discountFragmented, concentrationFragmented;
+    this->fragmentLastNode(path, fragmentLength, scratchPayload, 
+                           discountFragmented, concentrationFragmented);
     probability = this->restaurant.computeProbability(
-        splitNode, obs, probabilityPath[probabilityPath.size()-2],
+        scratchPayload, obs, this->parentProbability(path, path.size() - 1),
         discountFragmented, concentrationFragmented);
-    this->restaurant.getFactory().recycle(splitNode);
-  } else {
-    probability = probabilityPath.back();
+    this->restaurant.getFactory().reset(scratchPayload);
   }
   return probability;
 }
 
 
-d_vec HPYPModel::predictiveDistribution(l_type start, l_type stop) {
-  d_vec predictive;
-  predictive.reserve(this->numTypes);
-  WrappedNodeList path = this->contextTree.findLongestSuffix(start,stop);
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
-
-  for(int i = 0; i < this->numTypes; ++i) {
-    d_vec prob_path = this->computeProbabilityPath(path,
-                                                   discount_path,
-                                                   concentration_path,
-                                                   i);
-    predictive.push_back(prob_path.back());
+void HPYPModel::fragmentLastNode(const WrappedNodeList& path,
+                                 int fragmentLength,
+                                 void* splitPayload,
+                                 double& discount,
+                                 double& concentration) const {
+  WrappedNodeList::const_iterator it = path.end();
+  it--; it--; // one before last; parent of node we need to split
+  int parentLength = it->end - it->start; 
+  it++; // last node
+  discount = this->parameters.getDiscount(parentLength, fragmentLength);
+  this->restaurant.updateAfterSplit(
+      it->payload,
+      splitPayload,
+      it->discount,
+      discount,
+      true); // update splitPayload only
+  concentration = this->parameters.getConcentration(
+      discount, parentLength, fragmentLength);
+}
+
+
+void HPYPModel::predictBatchArray(const l_type* starts,
+                                  const l_type* stops,
+                                  const e_type* obs,
+                                  int n,
+                                  double* out,
+                                  PredictMode mode) {
+  // sort queries by context so that identical contexts are looked up once
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), ContextOrder(starts, stops));
+
+  // group queries by the node their context resolves to; contexts that end
+  // up in the same node share the whole path from the root
+  std::vector<PredictionGroup> groups;
+  std::map<std::pair<void*, int>, int> groupIndex;
+  WrappedNodeList path;
+  int i = 0;
+  while (i < n) {
+    int q = order[i];
+    int fragmentLength = 0;
+    if (mode == ABOVE) {
+      this->contextTree.findLongestSuffix(starts[q], stops[q], path);
+    } else {
+      fragmentLength = this->contextTree.findLongestSuffixVirtual(
+          starts[q], stops[q], path);
+      if (mode == BELOW) {
+        fragmentLength = 0;
+      }
+    }
+    std::pair<void*, int> key(path.back().payload, fragmentLength);
+    std::map<std::pair<void*, int>, int>::iterator it = groupIndex.find(key);
+    int g;
+    if (it == groupIndex.end()) {
+      g = groups.size();
+      groupIndex[key] = g;
+      groups.push_back(PredictionGroup());
+      groups.back().path.assign(path.begin(), path.end());
+      groups.back().fragmentLength = fragmentLength;
+    } else {
+      g = it->second;
+    }
+    // add all queries with the same context
+    do {
+      groups[g].queries.push_back(order[i]);
+      ++i;
+    } while (i < n && starts[order[i]] == starts[q] 
+                   && stops[order[i]] == stops[q]);
   }
 
+  d_vec probs;
+  for (std::vector<PredictionGroup>::iterator g = groups.begin(); 
+       g != groups.end(); ++g) {
+    path.assign(g->path.begin(), g->path.end());
+    const std::vector<int>& queries = g->queries;
+    this->parameters.setPathParameters(path);
+    // probs[k] is the probability of the k-th query of the group under 
+    // the current node 
+    probs.assign(queries.size(), this->baseProb);
+    WrappedNodeList::const_iterator last = path.end() - 1;
+    for (WrappedNodeList::const_iterator it = path.begin(); 
+         it != path.end(); ++it) {
+      void* payload = it->payload;
+      double discount = it->discount;
+      double concentration = it->concentration;
+      if (it == last && g->fragmentLength != 0) {
+        payload = this->restaurant.getFactory().make();
+        this->fragmentLastNode(path, g->fragmentLength, payload,
+                               discount, concentration);
+      }
+      for (size_t k = 0; k < queries.size(); ++k) {
+        probs[k] = this->restaurant.computeProbability(payload,
+                                                       obs[queries[k]],
+                                                       probs[k],
+                                                       discount,
+                                                       concentration);
+      }
+      if (payload != it->payload) {
+        this->restaurant.getFactory().recycle(payload);
+      }
+    }
+    for (size_t k = 0; k < queries.size(); ++k) {
+      out[queries[k]] = probs[k];
+    }
+  }
+}
+
+
+d_vec HPYPModel::predictBatch(const std::vector<l_type>& starts,
+                              const std::vector<l_type>& stops,
+                              const std::vector<e_type>& obs,
+                              PredictMode mode) {
+  assert(starts.size() == obs.size() && stops.size() == obs.size());
+  d_vec out(obs.size());
+  if (!obs.empty()) {
+    this->predictBatchArray(&starts[0], &stops[0], &obs[0], obs.size(),
+                            &out[0], mode);
+  }
+  return out;
+}
+
+
+d_vec HPYPModel::predictiveDistribution(l_type start, l_type stop) {
+  d_vec predictive;
+  this->predictiveDistribution(start, stop, predictive);
   return predictive;
 }
 
 
+void HPYPModel::predictiveDistribution(l_type start,
+                                       l_type stop,
+                                       d_vec& distribution) {
+  WrappedNodeList path;
+  this->contextTree.findLongestSuffix(start, stop, path);
+  this->parameters.setPathParameters(path);
+  this->computePredictiveDistribution(path, distribution);
+}
+
+
 d_vec HPYPModel::predictiveDistributionWithMixing(l_type start, 
                                                   l_type stop, 
                                                   d_vec& mixingWeights) {
   d_vec predictive;
-  predictive.reserve(this->numTypes);
-  const WrappedNodeList path = this->contextTree.findLongestSuffix(start, stop);
-  const d_vec discount_path = this->parameters.getDiscounts(path);
-  const d_vec concentration_path 
-      = this->parameters.getConcentrations(path, discount_path);
-
-  for(int i = 0; i < this->numTypes; ++i) {
-    d_vec prob_path = this->computeProbabilityPath(path,
-                                                   discount_path,
-                                                   concentration_path,
-                                                   i);
-    double prob = 0;
-    double sum = 0;
-    for (int j = 0; 
-         j < std::min<int>(mixingWeights.size(), prob_path.size());
-         ++j) {
-      prob += mixingWeights[j]*prob_path[j];
+  this->predictiveDistributionWithMixing(start, stop, mixingWeights,
+                                         predictive);
+  return predictive;
+}
+
+
+void HPYPModel::predictiveDistributionWithMixing(l_type start, 
+                                                 l_type stop, 
+                                                 const d_vec& mixingWeights,
+                                                 d_vec& distribution) {
+  WrappedNodeList path;
+  this->contextTree.findLongestSuffix(start, stop, path);
+  this->parameters.setPathParameters(path);
+
+  // level j holds the distribution after the first j restaurants on the
+  // path, i.e. what used to be prob_path[j] for each type
+  int numLevels = std::min<int>(mixingWeights.size(), path.size() + 1);
+  d_vec& level = this->levelDistribution;
+  level.assign(this->numTypes, this->baseProb);
+  distribution.assign(this->numTypes, 0.0);
+  double sum = 0;
+  int j = 0;
+  for(WrappedNodeList::const_iterator it = path.begin();; ++it) {
+    if (j < numLevels) {
+      for (int i = 0; i < this->numTypes; ++i) {
+        distribution[i] += mixingWeights[j]*level[i];
+      }
       sum += mixingWeights[j];
     }
-    predictive.push_back(prob + (1 - sum)*prob_path.back());
+    if (it == path.end()) {
+      break;
+    }
+    this->restaurant.updatePredictiveDistribution(it->payload, 
+                                                  it->discount,
+                                                  it->concentration,
+                                                  &level[0],
+                                                  this->numTypes);
+    j++;
+  }
+  for (int i = 0; i < this->numTypes; ++i) {
+    distribution[i] = distribution[i] + (1 - sum)*level[i];
   }
-
-  return predictive;
 }
         
 
@@ -487,7 +794,7 @@ void HPYPModel::addRemoveSamplePath(
                                                          type);
     WrappedNodeList::const_iterator current;
     for (l_type i = 0; i < cw; ++i) { // for each customer of this type
-      current = --path.end(); // set current to last restaurant in path
+      current = path.end() - 1; // set current to last restaurant in path
       
       // index into d/alpha vectors for current restaurant
       int j = discountPath.size() - 1;
@@ -510,7 +817,8 @@ void HPYPModel::addRemoveSamplePath(
         }
       }
 
-      // recompute probabilities back down; need not recompute last probability
+      // recompute probabilities back down; need not recompute last 
+      // probability
       while(j < (int)probabilityPath.size() - 1) {
         if (j == -1) {
           // can't recompute base distribution probabilities at prob_path[0]
@@ -527,7 +835,7 @@ void HPYPModel::addRemoveSamplePath(
       }
 
       // set current and j to the last restaurant on path
-      current = --path.end(); 
+      current = path.end() - 1; 
       j = discountPath.size() - 1; 
       goUp = true;
       while(goUp && j != -1) {
@@ -548,7 +856,6 @@ void HPYPModel::addRemoveSamplePath(
           goUp = false;
         }
       }
-
     }
 
   }
@@ -566,11 +873,16 @@ void HPYPModel::directGibbsSamplePath(
     const d_vec& discountPath, 
     const d_vec& concentrationPath, 
     const HPYPModel::PayloadDataPath& payloadDataPath,
-    double baseProb) {
+    double baseProb,
+    SharedAncestors* shared) {
   assert(path.size() > 0);
   assert(path.size() == discountPath.size());
   assert(path.size() == concentrationPath.size());
 
+  // the table counts of nodes with index <= lastFixed are not resampled,
+  // so that customers of their parents are left unchanged
+  int lastFixed = (shared == NULL) ? -1 : shared->depth;
+
   bool useAdditionalData = payloadDataPath.size() == path.size();
   // XXX: HACK! We assume this is the type of addData for the used restaurant
   stirling_generator_full_log *stirlingGenCurrent = NULL;
@@ -590,13 +902,13 @@ void HPYPModel::directGibbsSamplePath(
     }
 
     WrappedNodeList::const_iterator current;
-    current = --path.end(); // set current to last restaurant in path
+    current = path.end() - 1; // set current to last restaurant in path
 
     // index into d/alpha vectors for current restaurant
     int j = discountPath.size() - 1;
 
     bool goUp = true;
-    while(goUp && j != -1) {
+    while(goUp && j > lastFixed) {
       goUp = false;
       stirlingGenCurrent = (stirling_generator_full_log*)payloadDataPath[j].get();
       void* currentPayload = (*current).payload;
@@ -699,17 +1011,77 @@ void HPYPModel::directGibbsSamplePath(
 boost::shared_ptr<void> HPYPModel::makeAdditionalDataPtr(void* payload, 
                                                          double discount, 
                                                          double concentration) const {
+  boost::mutex::scoped_lock lock(this->additionalDataMutex);
   return boost::shared_ptr<void>(
       this->restaurant.createAdditionalData(payload,
         discount,
         concentration),
-      boost::bind(&IAddRemoveRestaurant::freeAdditionalData, 
-        &(this->restaurant),
-        _1));
+      boost::bind(&HPYPModel::freeAdditionalData, this, _1));
+}
+
+
+void HPYPModel::freeAdditionalData(void* additionalData) const {
+  boost::mutex::scoped_lock lock(this->additionalDataMutex);
+  this->restaurant.freeAdditionalData(additionalData);
+}
+
+
+void HPYPModel::advancePathData(const WrappedNodeList& path,
+                                size_t previousLength,
+                                d_vec& discountPath,
+                                d_vec& concentrationPath,
+                                HPYPModel::PayloadDataPath& payloadDataPath) const {
+  if (path.size() == previousLength) {
+    // sibling
+    discountPath.pop_back();
+    parameters.extendDiscounts(path, discountPath);
+    concentrationPath.pop_back();
+    parameters.extendConcentrations(path,
+                                    discountPath, 
+                                    concentrationPath);
+    payloadDataPath.pop_back();
+    payloadDataPath.push_back(
+        this->makeAdditionalDataPtr(path.back().payload, 
+                                    discountPath.back(), 
+                                    concentrationPath.back()));
+
+  } else {
+    if (path.size() == previousLength - 1) {
+      // we went up -- just drop the last term
+      discountPath.pop_back();
+      concentrationPath.pop_back();
+      payloadDataPath.pop_back();
+    } else {
+      // we went up one and then down some number of levels -- recompute
+      discountPath.pop_back();
+      concentrationPath.pop_back();
+      parameters.extendDiscounts(path, discountPath);
+      parameters.extendConcentrations(path,
+                                      discountPath,
+                                      concentrationPath);
+      payloadDataPath.pop_back();
+      WrappedNodeList::const_iterator it = path.begin();
+      // move it to the first item not covered by the payloadDataPath
+      for (size_t i = 0; i < payloadDataPath.size(); ++i) {
+        ++it;
+      }
+      for (size_t i = payloadDataPath.size(); i < discountPath.size(); ++i) {
+        payloadDataPath.push_back(
+            this->makeAdditionalDataPtr(it->payload, 
+                                        discountPath[i], 
+                                        concentrationPath[i]));
+
+        ++it;
+      }
+      assert(it == path.end());
+    }
+  }
 }
 
 
 void HPYPModel::runGibbsSampler(bool directGibbs) {
+  // a sweep reseats the customers of every restaurant
+  this->contextTree.markAllModified();
   ContextTree::DFSPathIterator pathIterator = contextTree.getDFSPathIterator();
   d_vec discountPath = parameters.getDiscounts(*pathIterator);
   d_vec concentrationPath = parameters.getConcentrations(*pathIterator, 
@@ -742,51 +1114,8 @@ void HPYPModel::runGibbsSampler(bool directGibbs) {
       break;
     }
 
-    if ((*pathIterator).size() == pathLength) {
-      // sibling
-      discountPath.pop_back();
-      parameters.extendDiscounts(*pathIterator, discountPath);
-      concentrationPath.pop_back();
-      parameters.extendConcentrations(*pathIterator,
-                                      discountPath, 
-                                      concentrationPath);
-      payloadDataPath.pop_back();
-      payloadDataPath.push_back(
-          this->makeAdditionalDataPtr((*pathIterator).back().payload, 
-                                      discountPath.back(), 
-                                      concentrationPath.back()));
-
-    } else {
-      if ((*pathIterator).size() == pathLength - 1) {
-        // we went up -- just drop the last term
-        discountPath.pop_back();
-        concentrationPath.pop_back();
-        payloadDataPath.pop_back();
-      } else {
-        // we went up one and then down some number of levels -- recompute
-        discountPath.pop_back();
-        concentrationPath.pop_back();
-        parameters.extendDiscounts(*pathIterator, discountPath);
-        parameters.extendConcentrations(*pathIterator,
-                                        discountPath,
-                                        concentrationPath);
-        payloadDataPath.pop_back();
-        WrappedNodeList::const_iterator it = (*pathIterator).begin();
-        // move it to the first item not covered by the payloadDataPath
-        for (size_t i = 0; i < payloadDataPath.size(); ++i) {
-          ++it;
-        }
-        for (size_t i = payloadDataPath.size(); i < discountPath.size(); ++i) {
-          payloadDataPath.push_back(
-              this->makeAdditionalDataPtr(it->payload, 
-                                          discountPath[i], 
-                                          concentrationPath[i]));
-
-          ++it;
-        }
-        assert(it == (*pathIterator).end());
-      }
-    }
+    this->advancePathData(*pathIterator, pathLength, discountPath,
+                          concentrationPath, payloadDataPath);
     pathLength = (*pathIterator).size();
     
     tracer << (*pathIterator).size() << " " << discountPath.size() << " " 
@@ -805,10 +1134,141 @@ void HPYPModel::runGibbsSampler(bool directGibbs) {
 }
 
 
+d_vec HPYPModel::runParallelGibbsSampler(bool directGibbs,
+                                         int numThreads,
+                                         int splitDepth) {
+  if (!directGibbs) {
+    // see the header: customers of the add/remove sampler may propagate 
+    // across the subtree roots, so it is not split into subtrees
+    this->runGibbsSampler(false);
+    return d_vec();
+  }
+  numThreads = std::max(1, numThreads);
+  splitDepth = std::max(0, splitDepth);
+  this->contextTree.markAllModified();
+  std::vector<ContextTree::DFSPathIterator> subtrees;
+  std::vector<WrappedNodeList> topPaths;
+  this->contextTree.splitAtDepth(splitDepth, subtrees, topPaths);
+
+  // subtree i is sampled with stream i of rootRng, so that its random 
+  // numbers do not depend on the thread it is assigned to
+  RngContext rootRng(gsl_rng_get(current_rng()));
+
+  // additional data for the nodes above the subtree roots is shared by all
+  // threads, so that there is only one instance per node
+  std::map<void*, boost::shared_ptr<void> > sharedPayloadData;
+  for (std::vector<WrappedNodeList>::const_iterator it = topPaths.begin();
+       it != topPaths.end(); ++it) {
+    if ((int)it->size() <= splitDepth) {
+      d_vec discountPath = this->parameters.getDiscounts(*it);
+      d_vec concentrationPath = this->parameters.getConcentrations(
+          *it, discountPath);
+      sharedPayloadData[it->back().payload] = this->makeAdditionalDataPtr(
+          it->back().payload, discountPath.back(), concentrationPath.back());
+    }
+  }
+
+  SharedAncestors shared(splitDepth);
+  SubtreeCursor cursor(subtrees.size());
+  d_vec throughput(numThreads, 0.0);
+  boost::thread_group threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.create_thread(boost::bind(&HPYPModel::gibbsSampleSubtrees,
+                                      this, &subtrees, &rootRng,
+                                      &sharedPayloadData, &shared, &cursor,
+                                      &throughput[t]));
+  }
+  threads.join_all();
+
+  // sample the nodes down to the subtree roots on this thread
+  for (std::vector<WrappedNodeList>::const_iterator it = topPaths.begin();
+       it != topPaths.end(); ++it) {
+    d_vec discountPath = this->parameters.getDiscounts(*it);
+    d_vec concentrationPath = this->parameters.getConcentrations(
+        *it, discountPath);
+    HPYPModel::PayloadDataPath payloadDataPath;
+    int j = 0;
+    for (WrappedNodeList::const_iterator node = it->begin();
+         node != it->end(); ++node) {
+      payloadDataPath.push_back(this->makeAdditionalDataPtr(
+            node->payload, discountPath[j], concentrationPath[j]));
+      j++;
+    }
+    this->directGibbsSamplePath(*it, discountPath, concentrationPath,
+                                payloadDataPath, baseProb);
+  }
+  return throughput;
+}
+
+
+void HPYPModel::gibbsSampleSubtrees(
+    std::vector<ContextTree::DFSPathIterator>* subtrees,
+    const RngContext* rootRng,
+    const std::map<void*, boost::shared_ptr<void> >* sharedPayloadData,
+    SharedAncestors* shared,
+    SubtreeCursor* cursor,
+    double* throughput) {
+  boost::posix_time::ptime startTime = 
+      boost::posix_time::microsec_clock::universal_time();
+  long numNodes = 0;
+  int i;
+  while (cursor->take(i)) {
+    RngContext subtreeRng(*rootRng, i);
+    ThreadRngScope rngScope(subtreeRng);
+    numNodes += this->gibbsSampleSubtree((*subtrees)[i],
+                                         *sharedPayloadData, shared);
+  }
+  double seconds = (boost::posix_time::microsec_clock::universal_time() 
+                    - startTime).total_microseconds() / 1e6;
+  *throughput = (seconds > 0) ? numNodes / seconds : 0;
+}
+
+
+long HPYPModel::gibbsSampleSubtree(
+    ContextTree::DFSPathIterator& subtree,
+    const std::map<void*, boost::shared_ptr<void> >& sharedPayloadData,
+    SharedAncestors* shared) {
+  ContextTree::DFSPathIterator& pathIterator = subtree;
+  d_vec discountPath = parameters.getDiscounts(*pathIterator);
+  d_vec concentrationPath = parameters.getConcentrations(*pathIterator, 
+                                                         discountPath);
+
+  HPYPModel::PayloadDataPath payloadDataPath;
+  int j = 0;
+  for (WrappedNodeList::const_iterator it = (*pathIterator).begin();
+       it != (*pathIterator).end(); ++it) {
+    if (j < shared->depth) {
+      payloadDataPath.push_back(sharedPayloadData.find(it->payload)->second);
+    } else {
+      payloadDataPath.push_back(this->makeAdditionalDataPtr(
+            it->payload, discountPath[j], concentrationPath[j]));
+    }
+    j++;
+  }
+
+  // the last path visited is the one to the subtree root, which is sampled
+  // after the parallel phase
+  long numNodes = 0;
+  size_t pathLength = (*pathIterator).size();
+  while ((int)pathLength > shared->depth + 1) {
+    this->directGibbsSamplePath(*pathIterator, discountPath, 
+                                concentrationPath, payloadDataPath, 
+                                baseProb, shared);
+    ++numNodes;
+
+    ++pathIterator;
+    this->advancePathData(*pathIterator, pathLength, discountPath,
+                          concentrationPath, payloadDataPath);
+    pathLength = (*pathIterator).size();
+  }
+  return numNodes;
+}
+
+
 d_vec HPYPModel::computeProbabilityPath(const WrappedNodeList& path, 
                                         const d_vec& discount_path, 
                                         const d_vec& concentration_path,
-                                        e_type obs) {
+                                        e_type obs) const {
   d_vec out;
   out.reserve(path.size() + 1);
   
@@ -831,28 +1291,82 @@ d_vec HPYPModel::computeProbabilityPath(const WrappedNodeList& path,
 }
 
 
-void HPYPModel::updatePath(const WrappedNodeList& path, 
-                           const d_vec& prob_path, 
-                           const d_vec& discount_path, 
-                           const d_vec& concentration_path, 
-                           e_type obs) {
+double HPYPModel::computeProbabilityPath(WrappedNodeList& path, 
+                                         e_type obs) const {
+  if (this->pathOperations != NULL) {
+    return this->pathOperations->computeProbabilityPath(path, obs,
+                                                        this->baseProb);
+  }
+  double prob = this->baseProb; // base distribution
+  for(WrappedNodeList::iterator it = path.begin(); it != path.end(); ++it) {
+    prob = this->restaurant.computeProbability(it->payload, 
+                                               obs,
+                                               prob,
+                                               it->discount,
+                                               it->concentration);
+    it->probability = prob;
+  } 
+  return prob;
+}
 
-  unsigned int j=path.size()-1;
-  double newTable = 1;
-  for(WrappedNodeList::const_reverse_iterator it = path.rbegin(); 
-      it != path.rend();
+
+void HPYPModel::setPathParameters(WrappedNodeList& path) const {
+  if (this->pathOperations != NULL) {
+    this->pathOperations->setPathParameters(path);
+  } else {
+    this->parameters.setPathParameters(path);
+  }
+}
+
+
+d_vec HPYPModel::probabilityVector(const WrappedNodeList& path) const {
+  d_vec out;
+  out.reserve(path.size() + 1);
+  out.push_back(this->baseProb);
+  for(WrappedNodeList::const_iterator it = path.begin(); 
+      it != path.end(); ++it) {
+    out.push_back(it->probability);
+  }
+  return out;
+}
+
+
+void HPYPModel::computePredictiveDistribution(
+    const WrappedNodeList& path,
+    d_vec& distribution) {
+  distribution.assign(this->numTypes, this->baseProb);
+  for(WrappedNodeList::const_iterator it = path.begin();
+      it!= path.end();
       ++it) {
-    newTable = this->restaurant.addCustomer(it->payload,
+    this->restaurant.updatePredictiveDistribution(it->payload, 
+                                                  it->discount,
+                                                  it->concentration,
+                                                  &distribution[0],
+                                                  this->numTypes);
+  } 
+}
+
+
+void HPYPModel::updatePath(const WrappedNodeList& path, e_type obs) {
+  if (this->pathOperations != NULL) {
+    this->pathOperations->updatePath(path, obs, this->baseProb, 
+                                     this->contextTree);
+    return;
+  }
+  double newTable = 1;
+  for(int j = path.size() - 1; j >= 0; --j) {
+    const WrappedNode& node = path[j];
+    newTable = this->restaurant.addCustomer(node.payload,
                                             obs,
-                                            prob_path[j],
-                                            discount_path[j],
-                                            concentration_path[j],
+                                            this->parentProbability(path, j),
+                                            node.discount,
+                                            node.concentration,
                                             NULL,
                                             newTable);
+    this->contextTree.markModified(node);
     if (newTable==0) {
       break;
     }
-    j--;
   }
 }
     
@@ -879,6 +1393,7 @@ void HPYPModel::removeObservationFromPath(
                                              obs,
                                              discountPath[j],
                                              payloadData, frac_t);
+    this->contextTree.markModified(*it);
     if (frac_t == 0.)
       break;
     j--;
@@ -904,6 +1419,12 @@ void HPYPModel::handleSplit(const WrappedNode& nodeA,
                                       nodeC.payload, 
                                       discBBeforeSplit,
                                       discBAfterSplit);
+    if (nodeB.discountCache != NULL) {
+      // B has a new parent, and thus a new discount
+      nodeB.discountCache->invalidate();
+    }
+    this->contextTree.markModified(nodeB);
+    this->contextTree.markModified(nodeC);
 }
 
 
@@ -1023,51 +1544,8 @@ double HPYPModel::computeLogJoint() const {
       break;
     }
 
-    if ((*pathIterator).size() == pathLength) {
-      // sibling
-      discountPath.pop_back();
-      parameters.extendDiscounts(*pathIterator, discountPath);
-      concentrationPath.pop_back();
-      parameters.extendConcentrations(*pathIterator,
-                                      discountPath, 
-                                      concentrationPath);
-      payloadDataPath.pop_back();
-      payloadDataPath.push_back(
-          this->makeAdditionalDataPtr((*pathIterator).back().payload, 
-                                      discountPath.back(), 
-                                      concentrationPath.back()));
-
-    } else {
-      if ((*pathIterator).size() == pathLength - 1) {
-        // we went up -- just drop the last term
-        discountPath.pop_back();
-        concentrationPath.pop_back();
-        payloadDataPath.pop_back();
-      } else {
-        // we went up one and then down some number of levels -- recompute
-        discountPath.pop_back();
-        concentrationPath.pop_back();
-        parameters.extendDiscounts(*pathIterator, discountPath);
-        parameters.extendConcentrations(*pathIterator,
-                                        discountPath,
-                                        concentrationPath);
-        payloadDataPath.pop_back();
-        WrappedNodeList::const_iterator it = (*pathIterator).begin();
-        // move it to the first item not covered by the payloadDataPath
-        for (size_t i = 0; i < payloadDataPath.size(); ++i) {
-          ++it;
-        }
-        for (size_t i = payloadDataPath.size(); i < discountPath.size(); ++i) {
-          payloadDataPath.push_back(
-              this->makeAdditionalDataPtr(it->payload, 
-                                          discountPath[i], 
-                                          concentrationPath[i]));
-
-          ++it;
-        }
-        assert(it == (*pathIterator).end());
-      }
-    }
+    this->advancePathData(*pathIterator, pathLength, discountPath,
+                          concentrationPath, payloadDataPath);
     pathLength = (*pathIterator).size();
 
     logJoint += computeLogRestaurantProb(*pathIterator, discountPath, concentrationPath, payloadDataPath, baseProb);
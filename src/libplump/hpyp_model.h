@@ -18,15 +18,20 @@
 #define HPYP_MODEL_H_
 
 
+#include <algorithm>
+#include <map>
 #include <vector>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "libplump/config.h"
 #include "libplump/context_tree.h"
 #include "libplump/node_manager_interface.h"
 #include "libplump/hpyp_restaurant_interface.h"
 #include "libplump/hpyp_parameters_interface.h"
+#include "libplump/hpyp_path_operations.h"
+#include "libplump/random.h"
 
 namespace gatsby { namespace libplump {
   
@@ -48,6 +53,18 @@ class HPYPModel {
 
     ~HPYPModel() {}
 
+    /**
+     * Number of types; observations are in [0, numTypes).
+     */
+    int getNumTypes() const {
+      return this->numTypes;
+    }
+
+    /**
+     * Length of the sequence the contexts refer to.
+     */
+    size_t getSequenceLength() const;
+
     /**
      * Create the root node and insert the given observation into it.
      */
@@ -124,19 +141,56 @@ class HPYPModel {
      */
     void updateTree(l_type start, l_type stop);
 
+    /**
+     * Bring the model into the same state as computeLosses(start, stop), 
+     * without computing the losses, if the restaurant is deterministic (see
+     * IAddRestaurant::isDeterministic) and the parameters are not adapted
+     * while training. The tree has to be empty.
+     *
+     * The tree is built at once (ContextTree::insertAll), and each node 
+     * then gets its customers bottom-up: the observation following its
+     * context, if it is a context (start, i), and one customer per table 
+     * of each child. As in runParallelGibbsSampler, the subtrees rooted at
+     * depth splitDepth are processed on numThreads threads and the nodes
+     * above them on the calling thread afterwards.
+     */
+    void bulkTrain(l_type start, l_type stop, int numThreads, int splitDepth);
+
+    /**
+     * Keep suffix links in the context tree (see 
+     * ContextTree::enableSuffixLinks), so that passes over consecutive 
+     * positions (computeLosses, buildTree, predictSequence, ...) find each
+     * context starting from the previous one.
+     */
+    void enableSuffixLinks() {
+      this->contextTree.enableSuffixLinks();
+    }
+
+    /**
+     * Run the per-node loops of prediction and training through 
+     * pathOperations instead of the restaurant and parameter interfaces;
+     * pathOperations has to work on the restaurant and parameters of this
+     * model, e.g. a PathOperations specialized for their classes (see 
+     * makePathOperations). NULL switches back to the interfaces. The model 
+     * does not take ownership.
+     */
+    void setPathOperations(const IPathOperations* pathOperations) {
+      this->pathOperations = pathOperations;
+    }
+
     /**
      * Compute the predictive probability of the given observation
      * in the context [start, stop). If the required context is not in tree, 
      * use the parent node of the required context for prediction (i.e. this
      * method does _not_ use fragmentation for prediction)..
      */
-    double predict(l_type start, l_type stop, e_type obs);
+    double predict(l_type start, l_type stop, e_type obs) const;
 
     /**
      * Predict prob; in the case of required fragmentation, predict form 
      * _below_ the split point!
      */
-    double predictBelow(l_type start, l_type stop, e_type obs);
+    double predictBelow(l_type start, l_type stop, e_type obs) const;
 
     /**
      * Compute the predictive probability of the given observation
@@ -146,19 +200,73 @@ class HPYPModel {
      */
     double predictWithFragmentation(l_type start, l_type stop, e_type obs);
 
+    /**
+     * Like predictWithFragmentation above, but use scratchPayload (obtained
+     * from the restaurant's payload factory) to hold the fragmented node
+     * instead of allocating a new payload. scratchPayload is reset before 
+     * returning, so it can be reused for the next call.
+     */
+    double predictWithFragmentation(l_type start, 
+                                    l_type stop, 
+                                    e_type obs,
+                                    void* scratchPayload) const;
+
+
+    /**
+     * Compute the predictive probabilities of a batch of n queries, where
+     * out[i] is the probability of obs[i] in the context 
+     * [starts[i], stops[i]), computed as by predict, predictWithFragmentation
+     * or predictBelow depending on mode.
+     *
+     * Queries are grouped by the tree path they resolve to, so that the
+     * path, discount path and concentration path are computed once per
+     * group and the per-node arithmetic runs over all queries of the group.
+     * In FRAGMENT mode, the queries of a group share one fragmented node.
+     */
+    void predictBatchArray(const l_type* starts,
+                           const l_type* stops,
+                           const e_type* obs,
+                           int n,
+                           double* out,
+                           PredictMode mode = ABOVE);
+
+    /**
+     * Vector version of predictBatchArray.
+     */
+    d_vec predictBatch(const std::vector<l_type>& starts,
+                       const std::vector<l_type>& stops,
+                       const std::vector<e_type>& obs,
+                       PredictMode mode = ABOVE);
 
     /**
      * Compute predictive probability for a sequence of observations, 
      * i.e. for each i in [start, stop), compute p(x_i|x_{start:i}).
+     *
+     * If numThreads > 1, the positions are distributed over numThreads 
+     * threads that only read the model, and each result is written to its
+     * own slot, so that the output is the same as for the serial version.
+     * The model must not be modified while this runs. In FRAGMENT mode, each
+     * thread uses its own scratch payload, and each chunk of positions its
+     * own random stream derived from one number drawn from the current RNG;
+     * as the chunks do not depend on numThreads, the results are the same
+     * for any number of threads.
      */
     d_vec predictSequence(l_type start, l_type stop,
-                          PredictMode mode = ABOVE);
+                          PredictMode mode = ABOVE,
+                          int numThreads = 1) const;
 
     /**
      * Compute the entire predictive distribution in the given context.
      */
     d_vec predictiveDistribution(l_type start, l_type stop);
 
+    /**
+     * Compute the entire predictive distribution in the given context and
+     * store it in distribution, which is resized to numTypes. Passing the 
+     * same vector to repeated calls avoids reallocating it.
+     */
+    void predictiveDistribution(l_type start, l_type stop, d_vec& distribution);
+
     /**
      * Compute the entire predictive distribution in the given context by
      * mixing the distributions in all contexts up to the root with
@@ -168,6 +276,15 @@ class HPYPModel {
                                            l_type stop,
                                            d_vec& mixingWeights);
 
+    /**
+     * Like predictiveDistributionWithMixing above, but store the result
+     * in distribution, which is resized to numTypes.
+     */
+    void predictiveDistributionWithMixing(l_type start, 
+                                          l_type stop,
+                                          const d_vec& mixingWeights,
+                                          d_vec& distribution);
+
     /**
      * Run one iteration of Gibbs sampling in the model.
      *
@@ -176,6 +293,33 @@ class HPYPModel {
      */
     void runGibbsSampler(bool directGibbs);
 
+    /**
+     * Run one iteration of Gibbs sampling on numThreads threads.
+     *
+     * The tree is split into the subtrees rooted at the nodes of depth 
+     * splitDepth. The nodes below these subtree roots are sampled in 
+     * parallel, where each subtree is processed by a single thread using its
+     * own random number stream; then the nodes of depth at most splitDepth
+     * are sampled on the calling thread. 
+     *
+     * This is done for the direct Gibbs sampler, which keeps the table 
+     * counts of the subtree roots fixed in the parallel phase, so that the
+     * subtrees are conditionally independent and each is sampled exactly as
+     * in runGibbsSampler. The random streams are derived per subtree from 
+     * the current RNG (see RngContext), so the result does not depend on 
+     * numThreads. 
+     *
+     * The add/remove sampler moves customers across the subtree roots, so 
+     * its subtrees are not independent; for it, this runs runGibbsSampler 
+     * on the calling thread.
+     *
+     * Returns the number of nodes sampled per second by each thread in the
+     * parallel phase, which is empty for the add/remove sampler.
+     */
+    d_vec runParallelGibbsSampler(bool directGibbs, 
+                                  int numThreads, 
+                                  int splitDepth);
+
     /**
      * Return a string representation of entire model.
      */
@@ -203,19 +347,111 @@ class HPYPModel {
     d_vec computeProbabilityPath(const WrappedNodeList& path, 
                                  const d_vec& discount_path, 
                                  const d_vec& concentration_path,
-                                 e_type obs);
+                                 e_type obs) const;
+
+    /** 
+     * Same as above, but takes the discounts and concentrations from the
+     * nodes of path (see IParameters::setPathParameters) and stores the 
+     * probability at each node in the node; returns the probability at the
+     * last node.
+     */
+    double computeProbabilityPath(WrappedNodeList& path, e_type obs) const;
+
+    /**
+     * Set the discounts and concentrations of the nodes of path (see
+     * IParameters::setPathParameters).
+     */
+    void setPathParameters(WrappedNodeList& path) const;
+
+    /**
+     * The probability at the parent of node j of a path filled in by 
+     * computeProbabilityPath, i.e. baseProb for the root.
+     */
+    double parentProbability(const WrappedNodeList& path, size_t j) const {
+      return (j == 0) ? this->baseProb : path[j - 1].probability;
+    }
+
+    /**
+     * Same as insertContext, but returns a reference to a path that is 
+     * reused by the next call.
+     */
+    WrappedNodeList& insertContextPath(l_type start, l_type stop);
+
+    /**
+     * Same as insertContextAndObservation, but returns a reference to the
+     * path of the context, with discounts, concentrations and probabilities
+     * filled in, that is reused by the next call.
+     */
+    const WrappedNodeList& insertContextAndObservationPath(l_type start, 
+                                                           l_type stop,
+                                                           e_type obs);
+
+    /**
+     * Copy the probabilities of a path filled in by computeProbabilityPath
+     * into the format returned by the first version: baseProb followed by
+     * the probability at each node.
+     */
+    d_vec probabilityVector(const WrappedNodeList& path) const;
+
+
+    /**
+     * Compute the predictive distribution over all types at the end of path
+     * by starting from the base distribution and letting each restaurant on 
+     * the path update the whole vector in turn.
+     */
+    void computePredictiveDistribution(const WrappedNodeList& path,
+                                       d_vec& distribution);
+
+
+    /**
+     * Fragment the last node on path at length fragmentLength into the empty
+     * payload splitPayload, so that it can be used for prediction in place
+     * of the last node. The discount and concentration of the fragment are
+     * returned in discount and concentration. The discount of the last node
+     * has to be set in the path.
+     */
+    void fragmentLastNode(const WrappedNodeList& path,
+                          int fragmentLength,
+                          void* splitPayload,
+                          double& discount,
+                          double& concentration) const;
+
+
+    /**
+     * Versions of predict, predictBelow and predictWithFragmentation that
+     * look up the context starting from cursor.
+     */
+    double predict(l_type start, l_type stop, e_type obs, 
+                   ContextTree::Cursor& cursor) const;
+
+    double predictBelow(l_type start, l_type stop, e_type obs,
+                        ContextTree::Cursor& cursor) const;
+
+    double predictWithFragmentation(l_type start, 
+                                    l_type stop, 
+                                    e_type obs,
+                                    void* scratchPayload,
+                                    ContextTree::Cursor& cursor) const;
+
+    /**
+     * Compute out[i - start] = p(x_i|x_{start:i}) for each i in [from, to)
+     * using the given mode; scratchPayload is only used in FRAGMENT mode.
+     */
+    void predictSequenceRange(l_type start,
+                              l_type from,
+                              l_type to,
+                              PredictMode mode,
+                              void* scratchPayload,
+                              double* out) const;
 
 
     /**
      * Insert a customer of type obs into the last node in path, then
      * recursively insert customers up the path if a new table was created by
-     * the last insertion.
+     * the last insertion. The path has to be filled in by 
+     * computeProbabilityPath.
      */
-    void updatePath(const WrappedNodeList& path, 
-                    const d_vec& prob_path, 
-                    const d_vec& discount_path, 
-                    const d_vec& concentration_path, 
-                    e_type obs);
+    void updatePath(const WrappedNodeList& path, e_type obs);
     
 
 
@@ -254,17 +490,106 @@ class HPYPModel {
                      const WrappedNode& nodeC);
 
 
+    /**
+     * The nodes above the split depth of a parallel Gibbs sweep, which are
+     * shared by all threads; depth is the number of shared nodes on 
+     * every path.
+     */
+    struct SharedAncestors {
+      SharedAncestors(int depth) : depth(depth) {}
+      int depth;
+    };
+
+    /**
+     * Hands out the indices of the subtrees of a parallel Gibbs sweep.
+     */
+    class SubtreeCursor {
+      public:
+        SubtreeCursor(int numSubtrees) 
+            : next(0), numSubtrees(numSubtrees), mutex() {}
+
+        bool take(int& subtree) {
+          boost::mutex::scoped_lock lock(this->mutex);
+          if (this->next >= this->numSubtrees) {
+            return false;
+          }
+          subtree = this->next++;
+          return true;
+        }
+
+      private:
+        int next;
+        int numSubtrees;
+        boost::mutex mutex;
+    };
+
     void addRemoveSamplePath(const WrappedNodeList& path, 
                          const d_vec& discountPath, 
                          const d_vec& concentrationPath, 
                          const PayloadDataPath& payloadDataPath,
                          double baseProb);
     
+    /**
+     * If shared is not NULL, the table counts of the node at depth
+     * shared->depth and above are not changed.
+     */
     void directGibbsSamplePath(const WrappedNodeList& path, 
                          const d_vec& discountPath, 
                          const d_vec& concentrationPath, 
                          const PayloadDataPath& payloadDataPath,
-                         double baseProb);
+                         double baseProb,
+                         SharedAncestors* shared = NULL);
+
+    /**
+     * Bring discountPath, concentrationPath and payloadDataPath in line with
+     * path, the successor of a path of length previousLength in a 
+     * DFSPathIterator.
+     */
+    void advancePathData(const WrappedNodeList& path,
+                         size_t previousLength,
+                         d_vec& discountPath,
+                         d_vec& concentrationPath,
+                         PayloadDataPath& payloadDataPath) const;
+
+    /**
+     * Body of one thread of runParallelGibbsSampler: sample the subtrees 
+     * taken from cursor, sampling subtree i with stream i of rootRng, and 
+     * store the number of nodes sampled per second 
+     * in throughput.
+     */
+    void gibbsSampleSubtrees(std::vector<ContextTree::DFSPathIterator>* subtrees,
+                             const RngContext* rootRng,
+                             const std::map<void*, boost::shared_ptr<void> >* 
+                                 sharedPayloadData,
+                             SharedAncestors* shared,
+                             SubtreeCursor* cursor,
+                             double* throughput);
+
+    /**
+     * Body of one thread of bulkTrain: seat the customers of the subtrees
+     * taken from cursor, except for their roots.
+     */
+    void bulkTrainSubtrees(l_type start, 
+                           l_type stop,
+                           int splitDepth,
+                           std::vector<ContextTree::DFSPathIterator>* subtrees,
+                           SubtreeCursor* cursor);
+
+    /**
+     * Seat the customers of the last node of path in bulkTrain, whose 
+     * children have to be done, and send one customer per table to its 
+     * parent.
+     */
+    void bulkTrainNode(l_type start, l_type stop, const WrappedNodeList& path);
+
+    /**
+     * Sample all nodes visited by subtree except its root with the direct
+     * sampler; returns the number of nodes sampled.
+     */
+    long gibbsSampleSubtree(ContextTree::DFSPathIterator& subtree,
+                            const std::map<void*, boost::shared_ptr<void> >& 
+                                sharedPayloadData,
+                            SharedAncestors* shared);
 
     double computeLogRestaurantProb(const WrappedNodeList& path, 
                          const d_vec& discountPath, 
@@ -275,6 +600,8 @@ class HPYPModel {
     boost::shared_ptr<void> makeAdditionalDataPtr(void* payload, 
                                                   double discount, 
                                                   double concentration) const;
+
+    void freeAdditionalData(void* additionalData) const;
     
 
     bool checkConsistency(const WrappedNode& node, 
@@ -282,7 +609,79 @@ class HPYPModel {
     
     
     
-    class ToStringVisitor {
+    /**
+     * Orders query indices of a batch by their context (start, stop).
+     */
+    class ContextOrder {
+      public:
+        ContextOrder(const l_type* starts, const l_type* stops) 
+            : starts(starts), stops(stops) {}
+        bool operator()(int a, int b) const {
+          if (starts[a] != starts[b]) {
+            return starts[a] < starts[b];
+          }
+          return stops[a] < stops[b];
+        }
+      private:
+        const l_type* starts;
+        const l_type* stops;
+    };
+
+    /**
+     * Hands out consecutive chunks of the positions [from, stop) to the
+     * threads of a parallel predictSequence.
+     */
+    class SequenceCursor {
+      public:
+        SequenceCursor(l_type from, l_type stop, l_type chunkSize)
+            : next(from), stop(stop), chunkSize(chunkSize), mutex() {}
+
+        /**
+         * Claim the next chunk [chunkFrom, chunkTo); returns false when
+         * all positions have been handed out.
+         */
+        bool take(l_type& chunkFrom, l_type& chunkTo) {
+          boost::mutex::scoped_lock lock(this->mutex);
+          if (this->next >= this->stop) {
+            return false;
+          }
+          chunkFrom = this->next;
+          chunkTo = std::min(this->next + this->chunkSize, this->stop);
+          this->next = chunkTo;
+          return true;
+        }
+
+      private:
+        l_type next;
+        l_type stop;
+        l_type chunkSize;
+        boost::mutex mutex;
+    };
+
+    /**
+     * Body of one thread of predictSequence: predict chunks taken from 
+     * cursor until none are left, drawing random numbers for the chunk 
+     * starting at chunkFrom from stream chunkFrom of rootRng (which is NULL
+     * in the modes that do not sample).
+     */
+    void predictSequenceWorker(l_type start,
+                               PredictMode mode,
+                               void* scratchPayload,
+                               const RngContext* rootRng,
+                               SequenceCursor* cursor,
+                               double* out) const;
+
+    /**
+     * A group of batch queries that resolve to the same tree path.
+     */
+    struct PredictionGroup {
+      // a plain vector, as there may be many groups
+      std::vector<WrappedNode> path;
+      int fragmentLength;
+      std::vector<int> queries;
+    };
+
+        class ToStringVisitor {
       public:
         ToStringVisitor(seq_type& seq, const IHPYPBaseRestaurant& restaurant);
         void operator()(const WrappedNode& n);
@@ -319,9 +718,23 @@ class HPYPModel {
     ContextTree& contextTree;
     const IAddRemoveRestaurant& restaurant;
     IParameters& parameters;
+    const IPathOperations* pathOperations;
     int numTypes;
     double baseProb;
 
+    // per-level scratch distribution for predictiveDistributionWithMixing
+    d_vec levelDistribution;
+
+    // scratch insertion result (and thus path) for insertContextPath
+    ContextTree::InsertionResult insertion;
+
+    // cursor of the contexts inserted by insertContextPath
+    ContextTree::Cursor insertionCursor;
+
+    // serializes creating and freeing additional data, which some 
+    // restaurants allocate from the (not thread safe) payload pools
+    mutable boost::mutex additionalDataMutex;
+
 
 };
 
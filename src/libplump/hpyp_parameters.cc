@@ -23,15 +23,55 @@
 
 namespace gatsby { namespace libplump {
 
+namespace {
 
-SimpleParameters::SimpleParameters() : discounts(), alpha(0) {
+/**
+ * Set the discount of each node of path to getDiscount of its parent's and
+ * its own length, taking it from the node's discount cache if that is up
+ * to date and filling the cache otherwise, and the concentrations to alpha
+ * times the product of the discounts above the node.
+ *
+ * Parameters is the class of parameters, whose getDiscount is called 
+ * non-virtually, so that it can be inlined into the loop.
+ */
+template <class Parameters>
+void setCachedPathParameters(const Parameters& parameters,
+                             double alpha,
+                             WrappedNodeList& path) {
+  unsigned int version = parameters.Parameters::getVersion();
+  int parent_length = -1;
+  double concentration = alpha;
+  for (WrappedNodeList::iterator it = path.begin(); it != path.end(); ++it) {
+    int this_length = it->end - it->start;
+    DiscountCache* cache = it->discountCache;
+    if (cache != NULL 
+        && cache->version.load(boost::memory_order_acquire) == version) {
+      it->discount = cache->getDiscount();
+    } else {
+      it->discount = parameters.Parameters::getDiscount(parent_length, 
+                                                        this_length);
+      if (cache != NULL) {
+        cache->setDiscount(it->discount);
+        cache->version.store(version, boost::memory_order_release);
+      }
+    }
+    it->concentration = concentration;
+    concentration *= it->discount;
+    parent_length = this_length;
+  }
+}
+
+} // namespace
+
+
+SimpleParameters::SimpleParameters() : discounts(), alpha(0), version(1) {
   discounts.push_back(0.5);
 }
 
 /**
  * Get discount parameters for each node in the node list.
  */
-d_vec SimpleParameters::getDiscounts(const WrappedNodeList& path) {
+d_vec SimpleParameters::getDiscounts(const WrappedNodeList& path) const {
   d_vec discount_path;
   int parent_length = -1;
   int max_context_len = discounts.size()-1;
@@ -62,7 +102,7 @@ d_vec SimpleParameters::getDiscounts(const WrappedNodeList& path) {
 
 
 void SimpleParameters::extendDiscounts(const WrappedNodeList& path, 
-                                       d_vec& discount_path) {
+                                       d_vec& discount_path) const {
   int max_context_len = discounts.size()-1;
   WrappedNodeList::const_iterator it = path.begin();
   for (int i = 0; i < (int)discount_path.size() - 1; ++i) {
@@ -96,7 +136,7 @@ void SimpleParameters::extendDiscounts(const WrappedNodeList& path,
 
 
 d_vec SimpleParameters::getConcentrations(const WrappedNodeList& path, 
-                                          const d_vec& discounts) {
+                                          const d_vec& discounts) const {
   d_vec concentration_path;
   double current = alpha;
   for (d_vec::const_iterator it = discounts.begin();
@@ -110,7 +150,7 @@ d_vec SimpleParameters::getConcentrations(const WrappedNodeList& path,
 
 void SimpleParameters::extendConcentrations(const WrappedNodeList& path,
                                             const d_vec& discounts,
-                                            d_vec& concentration_path) {
+                                            d_vec& concentration_path) const {
   double current = concentration_path.back();
   for (int i = concentration_path.size(); i < (int)discounts.size(); i++) {
     current *= discounts[i];
@@ -120,7 +160,7 @@ void SimpleParameters::extendConcentrations(const WrappedNodeList& path,
 
 
 double SimpleParameters::getDiscount(int parent_length, 
-                                     int this_length) {
+                                     int this_length) const {
   tracer << "SimpleParameters::getDiscount(" << parent_length << ", " 
          << this_length << ")" << std::endl;
   int max_context_len = discounts.size()-1;
@@ -147,12 +187,12 @@ double SimpleParameters::getDiscount(int parent_length,
 
 double SimpleParameters::getConcentration(double discount,
                                            l_type parentLength,
-                                           l_type thisLength) {
+                                           l_type thisLength) const {
   return this->alpha * discount;
 }
 
 
-double SimpleParameters::getDiscount(int level) {
+double SimpleParameters::getDiscount(int level) const {
   if (level < (int)discounts.size()) {
     return discounts[level];
   } else {
@@ -177,13 +217,30 @@ void SimpleParameters::stepParameterGradient(double stepSize) {
 }
 
 
+/**
+ * Same values as getDiscounts and getConcentrations, without the vectors.
+ */
+void SimpleParameters::setPathParameters(WrappedNodeList& path) const {
+  setCachedPathParameters(*this, this->alpha, path);
+}
+
+
+void SimpleParameters::accumulatePathGradient(
+    const IAddRemoveRestaurant& restaurant,
+    const WrappedNodeList& path,
+    double baseProb,
+    e_type obs) {
+  // DO NOTHING FOR NOW
+}
+
+
 
 /////// GradientParameters //////////////////////////
 
 /**
  * Get discount parameters for each node in the node list.
  */
-d_vec GradientParameters::getDiscounts(const WrappedNodeList& path) {
+d_vec GradientParameters::getDiscounts(const WrappedNodeList& path) const {
   d_vec discount_path;
   int parent_length = -1;
   int max_context_len = sigmoid_discounts.size()-1;
@@ -214,7 +271,7 @@ d_vec GradientParameters::getDiscounts(const WrappedNodeList& path) {
 
 
 void GradientParameters::extendDiscounts(const WrappedNodeList& path, 
-                                       d_vec& discount_path) {
+                                       d_vec& discount_path) const {
   int max_context_len = sigmoid_discounts.size()-1;
   WrappedNodeList::const_iterator it = path.begin();
   for (int i = 0; i < (int)discount_path.size() - 1; ++i) {
@@ -248,7 +305,7 @@ void GradientParameters::extendDiscounts(const WrappedNodeList& path,
 
 
 d_vec GradientParameters::getConcentrations(const WrappedNodeList& path, 
-                                          const d_vec& discounts) {
+                                          const d_vec& discounts) const {
   d_vec concentration_path;
   double current = exp(log_alpha);
   for (d_vec::const_iterator it = discounts.begin();
@@ -262,7 +319,7 @@ d_vec GradientParameters::getConcentrations(const WrappedNodeList& path,
 
 void GradientParameters::extendConcentrations(const WrappedNodeList& path,
                                             const d_vec& discounts,
-                                            d_vec& concentration_path) {
+                                            d_vec& concentration_path) const {
   double current = concentration_path.back();
   for (int i = concentration_path.size(); i < (int)discounts.size(); i++) {
     current *= discounts[i];
@@ -271,8 +328,16 @@ void GradientParameters::extendConcentrations(const WrappedNodeList& path,
 }
 
 
+/**
+ * Same values as getDiscounts and getConcentrations, without the vectors.
+ */
+void GradientParameters::setPathParameters(WrappedNodeList& path) const {
+  setCachedPathParameters(*this, exp(this->log_alpha), path);
+}
+
+
 double GradientParameters::getDiscount(int parent_length, 
-                                     int this_length) {
+                                     int this_length) const {
   tracer << "GradientParameters::getDiscount(" << parent_length << ", " 
          << this_length << ")" << std::endl;
   int max_context_len = sigmoid_discounts.size()-1;
@@ -299,12 +364,12 @@ double GradientParameters::getDiscount(int parent_length,
 
 double GradientParameters::getConcentration(double discount,
                                            l_type parentLength,
-                                           l_type thisLength) {
+                                           l_type thisLength) const {
   return exp(this->log_alpha) * discount;
 }
 
 
-double GradientParameters::getDiscount(int level) {
+double GradientParameters::getDiscount(int level) const {
   if (level < (int)sigmoid_discounts.size()) {
     return sigmoid(sigmoid_discounts[level]);
   } else {
@@ -464,6 +529,7 @@ void GradientParameters::stepParameterGradient(double stepSize) {
 
   this->log_alpha += stepSize * this->log_alpha_gradient;
   this->log_alpha_gradient = 0.0;
+  nextVersion(this->version);
 
 }
 
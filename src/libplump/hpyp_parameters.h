@@ -31,6 +31,15 @@
 
 namespace gatsby { namespace libplump {
 
+/**
+ * Advance a parameter version (see IParameters::getVersion), skipping 0.
+ */
+inline void nextVersion(unsigned int& version) {
+  if (++version == 0) {
+    version = 1;
+  }
+}
+
 
 /**
  * Compute the gradient of the PYP predictive probability
@@ -91,31 +100,33 @@ class SimpleParameters : public IParameters {
     
     SimpleParameters();
 
-    SimpleParameters(d_vec s) : discounts(s), alpha(0) {}
+    SimpleParameters(d_vec s) : discounts(s), alpha(0), version(1) {}
 
-    SimpleParameters(d_vec s, double alpha) : discounts(s), alpha(alpha)  {}
+    SimpleParameters(d_vec s, double alpha) 
+        : discounts(s), alpha(alpha), version(1)  {}
 
     /**
      * Get discount parameters for each node in the node list.
      */
-    d_vec getDiscounts(const WrappedNodeList& path);
+    d_vec getDiscounts(const WrappedNodeList& path) const;
 
-    void extendDiscounts(const WrappedNodeList& path, d_vec& discount_path);
+    void extendDiscounts(const WrappedNodeList& path,
+                         d_vec& discount_path) const;
 
     d_vec getConcentrations(const WrappedNodeList& path, 
-                            const d_vec& discounts);
+                            const d_vec& discounts) const;
     
     void extendConcentrations(const WrappedNodeList& path, 
                               const d_vec& discounts, 
-                              d_vec& concentration_path);
+                              d_vec& concentration_path) const;
 
-    double getDiscount(l_type parent_length, l_type this_length);
+    double getDiscount(l_type parent_length, l_type this_length) const;
     
     double getConcentration(double discount,
                             l_type parentLength,
-                            l_type thisLength);
+                            l_type thisLength) const;
 
-    double getDiscount(l_type level);
+    double getDiscount(l_type level) const;
     
     void accumulateParameterGradient(
       const IAddRemoveRestaurant& restaurant,
@@ -126,11 +137,45 @@ class SimpleParameters : public IParameters {
       e_type obs);
     
     void stepParameterGradient(double stepSize);
-  
+
+    void setPathParameters(WrappedNodeList& path) const;
+
+    void accumulatePathGradient(const IAddRemoveRestaurant& restaurant,
+                                const WrappedNodeList& path,
+                                double baseProb,
+                                e_type obs);
+
+    unsigned int getVersion() const {
+      return this->version;
+    }
+
+    const d_vec& getLevelDiscounts() const {
+      return this->discounts;
+    }
+
+    double getAlpha() const {
+      return this->alpha;
+    }
+
+    /**
+     * Set the per-level discounts; discounts cached in the nodes are 
+     * recomputed.
+     */
+    void setDiscounts(const d_vec& discounts) {
+      this->discounts = discounts;
+      nextVersion(this->version);
+    }
+
+    void setAlpha(double alpha) {
+      this->alpha = alpha;
+      nextVersion(this->version);
+    }
+
+  private:
     d_vec discounts;
     double alpha;
+    unsigned int version;
 
-  private:
     DISALLOW_COPY_AND_ASSIGN(SimpleParameters);
 };
 
@@ -146,7 +191,7 @@ class GradientParameters : public IParameters {
     
     GradientParameters() : sigmoid_discounts(), 
         log_alpha(-std::numeric_limits<double>::infinity()),
-        sigmoid_discount_gradient(), log_alpha_gradient(0) {
+        sigmoid_discount_gradient(), log_alpha_gradient(0), version(1) {
       sigmoid_discounts.push_back(logit(0.5));
       sigmoid_discount_gradient.push_back(0);
     }
@@ -154,7 +199,7 @@ class GradientParameters : public IParameters {
     GradientParameters(d_vec s) : sigmoid_discounts(s.size()),
                                   log_alpha(-std::numeric_limits<double>::infinity()),
                                   sigmoid_discount_gradient(s.size(),0.0),
-                                  log_alpha_gradient(0.0) {
+                                  log_alpha_gradient(0.0), version(1) {
       this->setDiscounts(s);
     }
 
@@ -162,31 +207,32 @@ class GradientParameters : public IParameters {
         sigmoid_discounts(s.size()), 
         log_alpha(log(alpha)),
         sigmoid_discount_gradient(s.size(),0.0),
-        log_alpha_gradient(0.0) {
+        log_alpha_gradient(0.0), version(1) {
       this->setDiscounts(s);
     }
 
     /**
      * Get discount parameters for each node in the node list.
      */
-    d_vec getDiscounts(const WrappedNodeList& path);
+    d_vec getDiscounts(const WrappedNodeList& path) const;
 
-    void extendDiscounts(const WrappedNodeList& path, d_vec& discount_path);
+    void extendDiscounts(const WrappedNodeList& path,
+                         d_vec& discount_path) const;
 
     d_vec getConcentrations(const WrappedNodeList& path, 
-                            const d_vec& discounts);
+                            const d_vec& discounts) const;
     
     void extendConcentrations(const WrappedNodeList& path, 
                               const d_vec& discounts, 
-                              d_vec& concentration_path);
+                              d_vec& concentration_path) const;
 
-    double getDiscount(l_type parent_length, l_type this_length);
+    double getDiscount(l_type parent_length, l_type this_length) const;
     
     double getConcentration(double discount,
                             l_type parentLength,
-                            l_type thisLength);
+                            l_type thisLength) const;
 
-    double getDiscount(l_type level);
+    double getDiscount(l_type level) const;
     
     void accumulateParameterGradient(
       const IAddRemoveRestaurant& restaurant,
@@ -198,6 +244,12 @@ class GradientParameters : public IParameters {
     
     void stepParameterGradient(double stepSize);
 
+    void setPathParameters(WrappedNodeList& path) const;
+
+    unsigned int getVersion() const {
+      return this->version;
+    }
+
     std::pair<d_vec, double> approximateParameterGradient(
         const IAddRemoveRestaurant& restaurant,
         const WrappedNodeList& path, 
@@ -219,6 +271,7 @@ class GradientParameters : public IParameters {
     double log_alpha;
     d_vec sigmoid_discount_gradient;
     double log_alpha_gradient;
+    unsigned int version;
     static const int mini_batch_size = 100;
     static constexpr double default_step_size = 1e-5;
 
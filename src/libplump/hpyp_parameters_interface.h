@@ -36,25 +36,26 @@ class IParameters {
     /**
      * Get discount parameters for each node in the node list.
      */
-    virtual d_vec getDiscounts(const WrappedNodeList& path) = 0; 
+    virtual d_vec getDiscounts(const WrappedNodeList& path) const = 0; 
     
     virtual void extendDiscounts(const WrappedNodeList& path, 
-                                 d_vec& discount_path) = 0;
+                                 d_vec& discount_path) const = 0;
 
     virtual d_vec getConcentrations(const WrappedNodeList& path, 
-                                    const d_vec& discounts) = 0;
+                                    const d_vec& discounts) const = 0;
 
     virtual void extendConcentrations(const WrappedNodeList& path, 
                                       const d_vec& discounts, 
-                                      d_vec& concentration_path) = 0;
+                                      d_vec& concentration_path) const = 0;
 
-    virtual double getDiscount(l_type parent_length, l_type this_length) = 0;
+    virtual double getDiscount(l_type parent_length,
+                               l_type this_length) const = 0;
 
     virtual double getConcentration(double discount,
                                     l_type parentLength,
-                                    l_type thisLength) = 0;
+                                    l_type thisLength) const = 0;
 
-    virtual double getDiscount(l_type level) = 0;
+    virtual double getDiscount(l_type level) const = 0;
 
     virtual void accumulateParameterGradient(
       const IAddRemoveRestaurant& restaurant,
@@ -65,6 +66,54 @@ class IParameters {
       e_type obs) = 0;
 
     virtual void stepParameterGradient(double stepSize) = 0;
+
+    /**
+     * Version of the parameter values, which has to change whenever 
+     * getDiscount may return different values, so that discounts cached in
+     * the nodes (see DiscountCache) are recomputed. The default of 0 means
+     * that cached discounts are not used.
+     */
+    virtual unsigned int getVersion() const {
+      return 0;
+    }
+
+    /**
+     * Store the discount and concentration parameters of each node in the
+     * path in the node itself. The default implementation uses 
+     * getDiscounts and getConcentrations; implementations should override
+     * it to avoid the temporary vectors, and may use and fill the discount
+     * caches of the nodes.
+     */
+    virtual void setPathParameters(WrappedNodeList& path) const {
+      d_vec discounts = this->getDiscounts(path);
+      d_vec concentrations = this->getConcentrations(path, discounts);
+      for (size_t j = 0; j < path.size(); ++j) {
+        path[j].discount = discounts[j];
+        path[j].concentration = concentrations[j];
+      }
+    }
+
+    /**
+     * Same as accumulateParameterGradient, but takes the parameters and 
+     * probabilities from a path filled in by HPYPModel, where baseProb is 
+     * the probability under the base distribution. The default 
+     * implementation copies them into vectors.
+     */
+    virtual void accumulatePathGradient(
+      const IAddRemoveRestaurant& restaurant,
+      const WrappedNodeList& path,
+      double baseProb,
+      e_type obs) {
+      d_vec prob_path(1, baseProb), discount_path, concentration_path;
+      for (WrappedNodeList::const_iterator it = path.begin(); 
+           it != path.end(); ++it) {
+        prob_path.push_back(it->probability);
+        discount_path.push_back(it->discount);
+        concentration_path.push_back(it->concentration);
+      }
+      this->accumulateParameterGradient(restaurant, path, prob_path, 
+          discount_path, concentration_path, obs);
+    }
 };
 
 }} // namespace gatsby::libplump
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HPYP_PATH_OPERATIONS_H_
+#define HPYP_PATH_OPERATIONS_H_
+
+#include <typeinfo>
+
+#include "libplump/config.h"
+#include "libplump/context_tree.h"
+#include "libplump/hpyp_restaurant_interface.h"
+#include "libplump/hpyp_restaurants.h"
+#include "libplump/hpyp_parameters_interface.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * The loops over the nodes of a path that HPYPModel runs for every
+ * observation it predicts or adds.
+ *
+ * By default, HPYPModel calls the restaurant and the parameters through
+ * their interfaces, i.e. makes a virtual call per node. Given an
+ * IPathOperations (see HPYPModel::setPathOperations), it makes one virtual
+ * call per path instead.
+ */
+class IPathOperations {
+  public:
+    virtual ~IPathOperations() {}
+
+    /**
+     * Same as IParameters::setPathParameters.
+     */
+    virtual void setPathParameters(WrappedNodeList& path) const = 0;
+
+    /**
+     * Store the probability of obs at each node of path, whose parameters
+     * have been set, starting with baseProb at the root; returns the
+     * probability at the last node.
+     */
+    virtual double computeProbabilityPath(WrappedNodeList& path,
+                                          e_type obs,
+                                          double baseProb) const = 0;
+
+    /**
+     * Add a customer of type obs to the last node of a path filled in by
+     * computeProbabilityPath, and to its ancestors as long as a new table
+     * is opened; the changed nodes are marked as modified in contextTree.
+     * The restaurants on the path must not have been changed since 
+     * computeProbabilityPath, which may leave the position of obs in each
+     * of them in the nodes (WrappedNode::slot) for this to reuse.
+     */
+    virtual void updatePath(const WrappedNodeList& path,
+                            e_type obs,
+                            double baseProb,
+                            ContextTree& contextTree) const = 0;
+};
+
+
+/**
+ * computeProbability and addCustomer of exactly class Restaurant, as called
+ * by PathOperations on the way down and up a path. slot carries what the
+ * restaurant found out about the position of type on the way down to the
+ * way up; restaurants that cannot make use of it leave it alone.
+ */
+template <class Restaurant>
+inline double computePathProbability(const Restaurant& restaurant,
+                                     void* payload,
+                                     e_type type,
+                                     double parentProbability,
+                                     double discount,
+                                     double concentration,
+                                     int& slot) {
+  return restaurant.Restaurant::computeProbability(
+      payload, type, parentProbability, discount, concentration);
+}
+
+template <class Restaurant>
+inline double addPathCustomer(const Restaurant& restaurant,
+                              void* payload,
+                              e_type type,
+                              int slot,
+                              double parentProbability,
+                              double discount,
+                              double concentration) {
+  return restaurant.Restaurant::addCustomer(
+      payload, type, parentProbability, discount, concentration);
+}
+
+// the compact restaurant finds the index of type in its table map once
+inline double computePathProbability(
+    const StirlingCompactRestaurant& restaurant, void* payload, e_type type,
+    double parentProbability, double discount, double concentration,
+    int& slot) {
+  return restaurant.computeProbabilityAndSlot(
+      payload, type, parentProbability, discount, concentration, slot);
+}
+
+inline double addPathCustomer(
+    const StirlingCompactRestaurant& restaurant, void* payload, e_type type,
+    int slot, double parentProbability, double discount, 
+    double concentration) {
+  return restaurant.addCustomerAtSlot(
+      payload, type, slot, parentProbability, discount, concentration);
+}
+
+
+/**
+ * IPathOperations for a restaurant of class Restaurant and parameters of
+ * class Parameters: the per-node methods are called non-virtually, so that
+ * the compiler can inline them into the loops.
+ *
+ * Calls are bound to the methods of exactly these classes, so objects of
+ * derived classes must not be passed; use makePathOperations, which checks
+ * this.
+ */
+template <class Restaurant, class Parameters>
+class PathOperations : public IPathOperations {
+  public:
+    PathOperations(const Restaurant& restaurant, const Parameters& parameters)
+        : restaurant(restaurant), parameters(parameters) {}
+
+    void setPathParameters(WrappedNodeList& path) const {
+      this->parameters.Parameters::setPathParameters(path);
+    }
+
+    double computeProbabilityPath(WrappedNodeList& path,
+                                  e_type obs,
+                                  double baseProb) const {
+      double prob = baseProb;
+      for (WrappedNodeList::iterator it = path.begin(); it != path.end();
+           ++it) {
+        prob = computePathProbability(this->restaurant, it->payload, obs,
+                                      prob, it->discount, it->concentration,
+                                      it->slot);
+        it->probability = prob;
+      }
+      return prob;
+    }
+
+    void updatePath(const WrappedNodeList& path,
+                    e_type obs,
+                    double baseProb,
+                    ContextTree& contextTree) const {
+      double newTable = 1;
+      for (int j = path.size() - 1; j >= 0; --j) {
+        const WrappedNode& node = path[j];
+        double parentProbability = (j == 0) ? baseProb
+                                            : path[j - 1].probability;
+        newTable = addPathCustomer(this->restaurant, node.payload, obs,
+                                   node.slot, parentProbability, 
+                                   node.discount, node.concentration);
+        contextTree.markModified(node);
+        if (newTable == 0) {
+          break;
+        }
+      }
+    }
+
+  private:
+    const Restaurant& restaurant;
+    const Parameters& parameters;
+};
+
+
+/**
+ * Return a new PathOperations<Restaurant, Parameters> for restaurant and
+ * parameters if they are exactly of these classes, and NULL otherwise (in
+ * particular for derived classes, which may override the per-node
+ * methods). The caller owns the result.
+ */
+template <class Restaurant, class Parameters>
+IPathOperations* makePathOperations(const IAddRemoveRestaurant& restaurant,
+                                    const IParameters& parameters) {
+  if (typeid(restaurant) != typeid(Restaurant)
+      || typeid(parameters) != typeid(Parameters)) {
+    return NULL;
+  }
+  return new PathOperations<Restaurant, Parameters>(
+      static_cast<const Restaurant&>(restaurant),
+      static_cast<const Parameters&>(parameters));
+}
+
+}} // namespace gatsby::libplump
+
+#endif /* HPYP_PATH_OPERATIONS_H_ */
@@ -41,6 +41,22 @@ class IHPYPBaseRestaurant {
                                       double parentProbability,
                                       double discount, 
                                       double concentration) const = 0;
+
+    /**
+     * Turn the predictive distribution of the parent restaurant, given as a
+     * dense array over all numTypes types, into the predictive distribution
+     * of this restaurant in place.
+     *
+     * The result is the same as calling computeProbability for every type,
+     * but types without customers in this restaurant only get a common
+     * scale factor applied, so the cost is one dense pass plus one sparse
+     * pass over the types present in the restaurant.
+     */
+    virtual void updatePredictiveDistribution(void* payloadPtr,
+                                              double discount,
+                                              double concentration,
+                                              double* distribution,
+                                              int numTypes) const = 0;
     virtual TypeVector getTypeVector(void* payloadPtr) const = 0;
     virtual const IPayloadFactory& getFactory() const = 0;
     virtual void updateAfterSplit(void* longerPayload, 
@@ -50,6 +66,15 @@ class IHPYPBaseRestaurant {
                                   bool parentOnly = false) const = 0;
     virtual std::string toString(void* payloadPtr) const = 0;
     virtual bool checkConsistency(void* payloadPtr) const = 0;
+
+    /**
+     * Whether the predictive probabilities only depend on the counts 
+     * reported by getC and getT (through computeHPYPPredictive), so that
+     * a Snapshot of these counts predicts exactly like the restaurant.
+     */
+    virtual bool predictsFromCounts() const {
+      return false;
+    }
 };
 
 
@@ -63,6 +88,16 @@ class IAddRestaurant : public IHPYPBaseRestaurant {
                              double concentration,
                              void*  additionalData = NULL,
                              double count = 1) const = 0;
+
+    /**
+     * Whether the seating arrangement only depends on the customers, not on
+     * the order in which they arrive or on the probabilities, discounts and
+     * concentrations passed to addCustomer (as for Kneser-Ney). Models 
+     * using such a restaurant can be trained by HPYPModel::bulkTrain.
+     */
+    virtual bool isDeterministic() const {
+      return false;
+    }
 };
 
 
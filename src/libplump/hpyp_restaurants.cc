@@ -94,6 +94,42 @@ double SimpleFullRestaurant::computeProbability(void*  payloadPtr,
 }
 
 
+namespace {
+
+/**
+ * Per-type counts of a SimpleFullRestaurant for
+ * updateHPYPPredictiveDistribution.
+ */
+template <typename TableMap>
+struct SimpleFullCounts {
+  typedef int Count;
+  typedef typename TableMap::const_iterator Iterator;
+
+  e_type type(Iterator it) const { return it->first; }
+  int cw(Iterator it) const { return it->second.first; }
+  int tw(Iterator it, double) const { return it->second.second.size(); }
+};
+
+} // namespace
+
+
+void SimpleFullRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  updateHPYPPredictiveDistribution(payload.tableMap.begin(),
+                                   payload.tableMap.end(),
+                                   SimpleFullCounts<Payload::TableMap>(),
+                                   payload.sumCustomers, // c
+                                   payload.sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
+}
+
+
 IHPYPBaseRestaurant::TypeVector SimpleFullRestaurant::getTypeVector(
     void* payloadPtr) const {
   Payload& payload = *((Payload*)payloadPtr);
@@ -446,6 +482,42 @@ double HistogramRestaurant::computeProbability(void*  payloadPtr,
 }
 
 
+namespace {
+
+/**
+ * Per-type counts of a HistogramRestaurant for
+ * updateHPYPPredictiveDistribution.
+ */
+template <typename TableMap>
+struct HistogramCounts {
+  typedef int Count;
+  typedef typename TableMap::const_iterator Iterator;
+
+  e_type type(Iterator it) const { return it->first; }
+  int cw(Iterator it) const { return it->second.cw; }
+  int tw(Iterator it, double) const { return it->second.tw; }
+};
+
+} // namespace
+
+
+void HistogramRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  updateHPYPPredictiveDistribution(payload.tableMap.begin(),
+                                   payload.tableMap.end(),
+                                   HistogramCounts<Payload::TableMap>(),
+                                   payload.sumCustomers, // c
+                                   payload.sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
+}
+
+
 IHPYPBaseRestaurant::TypeVector HistogramRestaurant::getTypeVector(
     void* payloadPtr) const {
   Payload& payload = *((Payload*)payloadPtr);
@@ -841,9 +913,9 @@ void* HistogramRestaurant::PayloadFactory::load(InArchive& ia) const {
 
 l_type BaseCompactRestaurant::getC(void* payloadPtr, e_type type) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    return (*it).second.first; // cw
+  Payload::TableMap::size_type i = payload.tableMap.find(type);
+  if (i != payload.tableMap.size()) {
+    return payload.tableMap.cw(i);
   } else {
     return 0;
   }
@@ -857,9 +929,9 @@ l_type BaseCompactRestaurant::getC(void* payloadPtr) const {
 
 l_type BaseCompactRestaurant::getT(void* payloadPtr, e_type type) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    return (*it).second.second; // tw
+  Payload::TableMap::size_type i = payload.tableMap.find(type);
+  if (i != payload.tableMap.size()) {
+    return payload.tableMap.tw(i);
   } else {
     return 0;
   }
@@ -867,18 +939,20 @@ l_type BaseCompactRestaurant::getT(void* payloadPtr, e_type type) const {
 
 void BaseCompactRestaurant::setT(void* payloadPtr, e_type type, l_type tw) const {
   Payload& payload = *((Payload*)payloadPtr);
-  payload.sumTables -= payload.tableMap[type].second;
+  int& arrangementTw = payload.tableMap.tw(payload.tableMap.insert(type));
+  payload.sumTables -= arrangementTw;
   payload.sumTables += tw;
-  payload.tableMap[type].second = tw;
+  arrangementTw = tw;
   assert(tw > 0);
   assert(payload.sumTables > 0);
 }
 
 void BaseCompactRestaurant::setC(void* payloadPtr, e_type type, l_type cw) const {
   Payload& payload = *((Payload*)payloadPtr);
-  payload.sumCustomers -= payload.tableMap[type].first;
+  int& arrangementCw = payload.tableMap.cw(payload.tableMap.insert(type));
+  payload.sumCustomers -= arrangementCw;
   payload.sumCustomers += cw;
-  payload.tableMap[type].first = cw;
+  arrangementCw = cw;
   assert(cw > 0);
   assert(payload.sumCustomers > 0);
 }
@@ -889,26 +963,47 @@ l_type BaseCompactRestaurant::getT(void* payloadPtr) const {
 }
 
 
-double BaseCompactRestaurant::computeProbability(void*  payloadPtr,
-                                                 e_type type, 
-                                                 double parentProbability,
-                                                 double discount, 
-                                                 double concentration) const {
-  Payload& payload = *((Payload*)payloadPtr);
-  int cw = 0;
-  int tw = 0;
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second.first;
-    tw = (*it).second.second;
-  }
-  return computeHPYPPredictive(cw, // cw
-                               tw, // tw
-                               payload.sumCustomers, // c
-                               payload.sumTables, // t
-                               parentProbability,
-                               discount,
-                               concentration);
+namespace {
+
+/**
+ * Per-type counts of a compact restaurant for
+ * updateHPYPPredictiveDistribution; the types are enumerated by their
+ * index in the table map.
+ */
+template <typename TableMap>
+class CompactCounts {
+  public:
+    typedef int Count;
+    typedef typename TableMap::size_type Iterator;
+
+    explicit CompactCounts(const TableMap& tableMap) : tableMap(tableMap) {}
+
+    e_type type(Iterator i) const { return this->tableMap.type(i); }
+    int cw(Iterator i) const { return this->tableMap.cw(i); }
+    int tw(Iterator i, double) const { return this->tableMap.tw(i); }
+
+  private:
+    const TableMap& tableMap;
+};
+
+} // namespace
+
+
+void BaseCompactRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  const Payload::TableMap& tableMap = payload.tableMap;
+  updateHPYPPredictiveDistribution(Payload::TableMap::size_type(0),
+                                   tableMap.size(),
+                                   CompactCounts<Payload::TableMap>(tableMap),
+                                   payload.sumCustomers, // c
+                                   payload.sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
 }
 
 
@@ -917,9 +1012,8 @@ IHPYPBaseRestaurant::TypeVector BaseCompactRestaurant::getTypeVector(
   Payload& payload = *((Payload*)payloadPtr);
   IHPYPBaseRestaurant::TypeVector typeVector;
   typeVector.reserve(payload.tableMap.size());
-  for (Payload::TableMap::iterator it = payload.tableMap.begin();
-       it != payload.tableMap.end(); ++it) {
-    typeVector.push_back((*it).first); 
+  for (Payload::TableMap::size_type i = 0; i < payload.tableMap.size(); ++i) {
+    typeVector.push_back(payload.tableMap.type(i)); 
   }
   return typeVector;
 }
@@ -950,24 +1044,24 @@ void BaseCompactRestaurant::updateAfterSplit(void* longerPayloadPtr,
   assert(newParent.sumTables == 0);
   assert(newParent.tableMap.size() == 0);
 
-  for(Payload::TableMap::iterator it = payload.tableMap.begin();
-      it != payload.tableMap.end(); ++it) {
-    e_type type = (*it).first;
-    Payload::Arrangement& arrangement = payload.tableMap[type];
-    Payload::Arrangement& parentArrangement = newParent.tableMap[type];
+  for (Payload::TableMap::size_type i = 0; i < payload.tableMap.size(); ++i) {
+    e_type type = payload.tableMap.type(i);
+    int& cw = payload.tableMap.cw(i);
+    int& tw = payload.tableMap.tw(i);
+    Payload::TableMap::size_type j = newParent.tableMap.insert(type);
+    int& parentCw = newParent.tableMap.cw(j);
+    int& parentTw = newParent.tableMap.tw(j);
   
-    if (arrangement.first == 1) { // just one customer -- can't split
+    if (cw == 1) { // just one customer -- can't split
       // seat customer at his own table in parent
       ++newParent.sumCustomers; // c
       ++newParent.sumTables; // t
-      parentArrangement.first = 1; // cw
-      parentArrangement.second = 1; // tw
+      parentCw = 1; // cw
+      parentTw = 1; // tw
     } else {
       // in order to split the restaurant we will re-instantiate a full 
       // seating arrangement
-      std::vector<int> cwk = sample_crp_ct(discountBeforeSplit, 
-                                           arrangement.first,
-                                           arrangement.second);
+      std::vector<int> cwk = sample_crp_ct(discountBeforeSplit, cw, tw);
       
       int totalTables = 0;
       for (int k = 0; k < (int)cwk.size(); ++k) { // for each table
@@ -977,18 +1071,18 @@ void BaseCompactRestaurant::updateAfterSplit(void* longerPayloadPtr,
       }
 
       // should have at least as many tables after split
-      assert(totalTables >= arrangement.second);
+      assert(totalTables >= tw);
       
       // parent has totalTables customers around tw tables
-      parentArrangement.first = totalTables;
-      parentArrangement.second = arrangement.second;
-      newParent.sumCustomers += parentArrangement.first;
-      newParent.sumTables    += parentArrangement.second;
+      parentCw = totalTables;
+      parentTw = tw;
+      newParent.sumCustomers += parentCw;
+      newParent.sumTables    += parentTw;
       
       if (!parentOnly) {
         // bottom has unchanged # of customers at totalTables tables
-        payload.sumTables -= arrangement.second;
-        arrangement.second = totalTables;
+        payload.sumTables -= tw;
+        tw = totalTables;
         payload.sumTables += totalTables;
       }
     }
@@ -996,57 +1090,14 @@ void BaseCompactRestaurant::updateAfterSplit(void* longerPayloadPtr,
 }
   
 
-double BaseCompactRestaurant::addCustomer(void*  payloadPtr, 
-                                        e_type type, 
-                                        double parentProbability, 
-                                        double discount, 
-                                        double concentration, 
-                                        void*  additionalData,
-                                        double count) const {
-  assert(count == 1.0);
-
-  tracer << "BaseCompactRestaurant::addCustomer(" << type << "," 
-         << parentProbability << "," << discount << "," << concentration 
-         << ", " << additionalData
-         << ")" << std::endl;
-
-  Payload& payload = *((Payload*)payloadPtr);
-  Payload::Arrangement& arrangement = payload.tableMap[type];
-
-  // add customer, incC returns incremented count
-  l_type cw = arrangement.first;
-  arrangement.first += 1; // inc(cw)
-  payload.sumCustomers += 1; // inc(c)
-
-  if (cw == 0) {
-    // first customer always creates a table
-    arrangement.second += 1; // inc(tw)
-    payload.sumTables += 1; // inc(t)
-    return 1;
-  } else {
-    double incTProb =   (concentration + discount*payload.sumTables)
-      * parentProbability;
-    incTProb = incTProb/(incTProb + cw - arrangement.second * discount);
-    if (coin(incTProb)) {
-      arrangement.second += 1;
-      payload.sumTables += 1;
-      return 1;
-    } else {
-      return 0;
-    }
-  }
-}
-
-
 std::string BaseCompactRestaurant::toString(void* payloadPtr) const {
   Payload& payload = *((Payload*)payloadPtr);
   std::ostringstream out;
 
   out << "[";
-  for(Payload::TableMap::iterator it = payload.tableMap.begin();
-      it != payload.tableMap.end(); ++it) {
-    out << (*it).first << ":(" << (*it).second.first 
-        << "/" << (*it).second.second << "), ";
+  for (Payload::TableMap::size_type i = 0; i < payload.tableMap.size(); ++i) {
+    out << payload.tableMap.type(i) << ":(" << payload.tableMap.cw(i) 
+        << "/" << payload.tableMap.tw(i) << "), ";
   }
   out << "]";
   return out.str();
@@ -1060,11 +1111,11 @@ bool BaseCompactRestaurant::checkConsistency(void* payloadPtr) const {
   int sumCustomers = 0;
   int sumTables = 0;
 
-  for (Payload::TableMap::iterator it = payload.tableMap.begin();
-       it != payload.tableMap.end(); ++it) {
-    sumCustomers += (*it).second.first;
-    sumTables    += (*it).second.second;
-    consistent = consistent && ((*it).second.first >= (*it).second.second);
+  for (Payload::TableMap::size_type i = 0; i < payload.tableMap.size(); ++i) {
+    sumCustomers += payload.tableMap.cw(i);
+    sumTables    += payload.tableMap.tw(i);
+    consistent = consistent && (payload.tableMap.cw(i) 
+                                >= payload.tableMap.tw(i));
   }
 
   consistent =    (sumCustomers == payload.sumCustomers) 
@@ -1103,7 +1154,7 @@ void BaseCompactRestaurant::PayloadFactory::save(
 
 
 void* BaseCompactRestaurant::PayloadFactory::load(InArchive& ia) const {
-  Payload* p = new Payload();
+  Payload* p = (Payload*)this->make();
   ia >> *p;
   return p;
 }
@@ -1116,7 +1167,7 @@ double ReinstantiatingCompactRestaurant::removeCustomer(
     void* additionalData,
     double count) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::Arrangement& arrangement = payload.tableMap[type];
+  Payload::TableMap::size_type i = payload.tableMap.insert(type);
 
   bool removedTable;
   if (additionalData != NULL) {
@@ -1128,10 +1179,10 @@ double ReinstantiatingCompactRestaurant::removeCustomer(
     std::cerr << "Additional data MUST be provided for now!" << std::endl;
     exit(1);
   }
-  arrangement.first -= 1;
+  payload.tableMap.cw(i) -= 1;
   payload.sumCustomers -= 1;
   if (removedTable) {
-    arrangement.second -= 1;
+    payload.tableMap.tw(i) -= 1;
     payload.sumTables -= 1;
   }
 
@@ -1157,8 +1208,8 @@ double ReinstantiatingCompactRestaurant::addCustomer(
   if (additionalData != NULL) {
     // need to stay in sync with full restaurant
     Payload& payload = *((Payload*)payloadPtr);
-    Payload::Arrangement& arrangement = payload.tableMap[type];
-    arrangement.first += 1; // inc(cw)
+    Payload::TableMap::size_type i = payload.tableMap.insert(type);
+    payload.tableMap.cw(i) += 1; // inc(cw)
     payload.sumCustomers += 1; // inc(c)
     if (this->fullRestaurant.addCustomer(additionalData,
                                          type,
@@ -1166,7 +1217,7 @@ double ReinstantiatingCompactRestaurant::addCustomer(
                                          discount, 
                                          concentration, 
                                          NULL)) {
-      arrangement.second += 1; // inc(tw)
+      payload.tableMap.tw(i) += 1; // inc(tw)
       payload.sumTables += 1; // inc(t)
       return 1;
     } else {
@@ -1194,24 +1245,26 @@ double StirlingCompactRestaurant::removeCustomer(void* payloadPtr,
                                                void* additionalData, 
                                                double count) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::Arrangement& arrangement = payload.tableMap[type];
+  Payload::TableMap::size_type i = payload.tableMap.insert(type);
+  int& cw = payload.tableMap.cw(i);
+  int& tw = payload.tableMap.tw(i);
  
   boost::scoped_ptr<stirling_generator_full_log> additionalDataDeleter;
   if (additionalData == NULL) {
     // this will delete the additionalData at the end of the function
     additionalDataDeleter.reset(new stirling_generator_full_log(
-        discount, arrangement.first, arrangement.second));
+        discount, cw, tw));
     additionalData = additionalDataDeleter.get();
   }
 
   double decTProb = ((stirling_generator_full_log*)additionalData)->ratio(
-      arrangement.first, arrangement.second);
+      cw, tw);
 
-  arrangement.first -= 1;
+  cw -= 1;
   payload.sumCustomers -= 1;
 
-  if (arrangement.first == 0 || coin(decTProb)) {
-    arrangement.second -= 1;
+  if (cw == 0 || coin(decTProb)) {
+    tw -= 1;
     payload.sumTables -= 1;
     return 1;
   } else {
@@ -1269,32 +1322,41 @@ l_type KneserNeyRestaurant::getT(void* payloadPtr) const {
 }
 
 
-double KneserNeyRestaurant::computeProbability(void*  payloadPtr,
-                                               e_type type, 
-                                               double parentProbability,
-                                               double discount, 
-                                               double concentration) const {
-  Payload& payload = *((Payload*)payloadPtr);
-  
-  if (payload.sumCustomers == 0) {
-    return parentProbability;
-  }
-
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  int cw = 0;
-  int tw = 0;
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second;
-    tw = 1;
-  }
+namespace {
 
-  return computeHPYPPredictive(cw, // cw
-                               tw, // tw
-                               payload.sumCustomers, // c
-                               payload.tableMap.size(), // t
-                               parentProbability,
-                               discount,
-                               concentration);
+/**
+ * Per-type counts of a KneserNeyRestaurant for
+ * updateHPYPPredictiveDistribution.
+ */
+template <typename TableMap>
+struct KneserNeyCounts {
+  typedef int Count;
+  typedef typename TableMap::const_iterator Iterator;
+
+  e_type type(Iterator it) const { return it->first; }
+  int cw(Iterator it) const { return it->second; }
+  int tw(Iterator it, double) const { return 1; } // one table per type
+};
+
+} // namespace
+
+
+void KneserNeyRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  // one table per type
+  l_type sumTables = payload.tableMap.size();
+  updateHPYPPredictiveDistribution(payload.tableMap.begin(),
+                                   payload.tableMap.end(),
+                                   KneserNeyCounts<Payload::TableMap>(),
+                                   payload.sumCustomers, // c
+                                   sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
 }
 
 
@@ -1344,27 +1406,6 @@ void KneserNeyRestaurant::updateAfterSplit(void* longerPayloadPtr,
 }
   
 
-double KneserNeyRestaurant::addCustomer(void*  payloadPtr, 
-                                        e_type type, 
-                                        double parentProbability, 
-                                        double discount, 
-                                        double concentration, 
-                                        void*  additionalData,
-                                        double count) const {
-  assert(count == 1.0);
-  tracer << "KneserNeyRestaurant::addCustomer(" << type << "," 
-         << parentProbability << "," << discount << "," << concentration 
-         << ", " << additionalData
-         << ")" << std::endl;
-
-  Payload& payload = *((Payload*)payloadPtr);
-  int& cw = payload.tableMap[type];
-  cw += 1;
-  payload.sumCustomers += 1;
-  return (cw == 1)?1.0:0; // true if we created a new table
-}
-
-
 double KneserNeyRestaurant::removeCustomer(
     void* payloadPtr, e_type type, double discount,
     void* additionalData, 
@@ -1471,10 +1512,10 @@ double ExpectedTablesCompactRestaurant::computeProbability(void*  payloadPtr,
   }
   int cw = 0;
   int tw = 0;
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second.first;
-    tw = (*it).second.second;
+  Payload::TableMap::size_type i = payload.tableMap.find(type);
+  if (i != payload.tableMap.size()) {
+    cw = payload.tableMap.cw(i);
+    tw = payload.tableMap.tw(i);
   }
   double expectedNumberOfTables = pypExpectedNumberOfTables(concentration, discount, payload.sumTables);
   //std::cout << "t: " << payload.sumTables 
@@ -1496,6 +1537,66 @@ double ExpectedTablesCompactRestaurant::computeProbability(void*  payloadPtr,
 }
 
 
+namespace {
+
+/**
+ * Per-type counts of an ExpectedTablesCompactRestaurant for
+ * updateHPYPPredictiveDistribution: the tables of each type with customers
+ * are approximated by its parent probability times the expected number of
+ * tables.
+ */
+template <typename TableMap>
+class ExpectedTablesCounts {
+  public:
+    typedef double Count;
+    typedef typename TableMap::size_type Iterator;
+
+    ExpectedTablesCounts(const TableMap& tableMap,
+                         double expectedNumberOfTables)
+        : tableMap(tableMap), expectedNumberOfTables(expectedNumberOfTables) {}
+
+    e_type type(Iterator i) const { return this->tableMap.type(i); }
+    double cw(Iterator i) const { return this->tableMap.cw(i); }
+
+    double tw(Iterator i, double parentProbability) const {
+      if (this->tableMap.cw(i) == 0) {
+        return 0.0;
+      }
+      return this->expectedNumberOfTables * parentProbability;
+    }
+
+  private:
+    const TableMap& tableMap;
+    double expectedNumberOfTables;
+};
+
+} // namespace
+
+
+void ExpectedTablesCompactRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  if (payload.sumCustomers == 0) {
+    return;
+  }
+  double expectedNumberOfTables = pypExpectedNumberOfTables(concentration, discount, payload.sumTables);
+  const Payload::TableMap& tableMap = payload.tableMap;
+  updateHPYPPredictiveDistribution(
+      Payload::TableMap::size_type(0),
+      tableMap.size(),
+      ExpectedTablesCounts<Payload::TableMap>(tableMap,
+                                              expectedNumberOfTables),
+      payload.sumCustomers, // c
+      expectedNumberOfTables, // t
+      discount, concentration,
+      distribution, numTypes);
+}
+
+
 double PowerLawRestaurant::computeProbability(void*  payloadPtr,
                                                e_type type, 
                                                double parentProbability,
@@ -1529,6 +1630,58 @@ double PowerLawRestaurant::computeProbability(void*  payloadPtr,
                                      concentration);
 }
 
+
+namespace {
+
+/**
+ * Per-type counts of a PowerLawRestaurant for
+ * updateHPYPPredictiveDistribution: cw customers sit at cw^power tables.
+ */
+template <typename TableMap>
+class PowerLawCounts {
+  public:
+    typedef double Count;
+    typedef typename TableMap::const_iterator Iterator;
+
+    explicit PowerLawCounts(double power) : power(power) {}
+
+    e_type type(Iterator it) const { return it->first; }
+    double cw(Iterator it) const { return it->second; }
+    double tw(Iterator it, double) const {
+      return pow(it->second, this->power);
+    }
+
+  private:
+    double power;
+};
+
+} // namespace
+
+
+void PowerLawRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  if (payload.sumCustomers == 0) {
+    return;
+  }
+  const double POWER = 0.5;
+  double t = 0;
+  for (Payload::TableMap::const_iterator it = payload.tableMap.begin(); it != payload.tableMap.end(); ++it) {
+    t += pow((*it).second, POWER);
+  }
+  updateHPYPPredictiveDistribution(payload.tableMap.begin(),
+                                   payload.tableMap.end(),
+                                   PowerLawCounts<Payload::TableMap>(POWER),
+                                   payload.sumCustomers, // c
+                                   t,
+                                   discount, concentration,
+                                   distribution, numTypes);
+}
+
 double FractionalRestaurant::addCustomer(void*  payloadPtr, 
                                        e_type type, 
                                        double parentProbability, 
@@ -1624,6 +1777,43 @@ double FractionalRestaurant::computeProbability(void*  payloadPtr,
 }
 
 
+namespace {
+
+/**
+ * Per-type counts of the restaurants with fractional (cw, tw) pairs,
+ * FractionalRestaurant and LocallyOptimalRestaurant, for
+ * updateHPYPPredictiveDistribution.
+ */
+template <typename TableMap>
+struct FractionalCounts {
+  typedef double Count;
+  typedef typename TableMap::const_iterator Iterator;
+
+  e_type type(Iterator it) const { return it->first; }
+  double cw(Iterator it) const { return it->second.first; }
+  double tw(Iterator it, double) const { return it->second.second; }
+};
+
+} // namespace
+
+
+void FractionalRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  updateHPYPPredictiveDistribution(payload.tableMap.begin(),
+                                   payload.tableMap.end(),
+                                   FractionalCounts<Payload::TableMap>(),
+                                   payload.sumCustomers, // c
+                                   payload.sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
+}
+
+
 void FractionalRestaurant::updateAfterSplit(void* longerPayloadPtr, 
                                            void* shorterPayloadPtr, 
                                            double discountBeforeSplit, 
@@ -1758,6 +1948,23 @@ double LocallyOptimalRestaurant::computeProbability(void*  payloadPtr,
 }
 
 
+void LocallyOptimalRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const Payload& payload = *((const Payload*)payloadPtr);
+  updateHPYPPredictiveDistribution(payload.tableMap.begin(),
+                                   payload.tableMap.end(),
+                                   FractionalCounts<Payload::TableMap>(),
+                                   payload.sumCustomers, // c
+                                   payload.sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
+}
+
+
 void LocallyOptimalRestaurant::updateAfterSplit(void* longerPayloadPtr, 
                                            void* shorterPayloadPtr, 
                                            double discountBeforeSplit, 
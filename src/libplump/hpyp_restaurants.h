@@ -18,8 +18,13 @@
 #define HPYP_RESTAURANTS_H
 
 
+#include <cassert>
+
 #include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/random.h"
 #include "libplump/pool.h"
+#include "libplump/compact_arrangements.h"
 #include "libplump/node_manager.h" // for IPayloadFactory
 #include "libplump/serialization.h"
 #include "libplump/stirling.h"
@@ -55,6 +60,10 @@ class SimpleFullRestaurant : public IAddRemoveRestaurant {
     l_type getC(void* payloadPtr) const;
     l_type getT(void* payloadPtr, e_type type) const;
     l_type getT(void* payloadPtr) const;
+
+    bool predictsFromCounts() const {
+      return true;
+    }
     
     double computeProbability(void*  payloadPtr,
                               e_type type, 
@@ -62,6 +71,12 @@ class SimpleFullRestaurant : public IAddRemoveRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
     TypeVector getTypeVector(void* payloadPtr) const;
     
     const IPayloadFactory& getFactory() const;
@@ -130,6 +145,10 @@ class SimpleFullRestaurant : public IAddRemoveRestaurant {
       void recycle(void* payloadPtr) const {
         delete (Payload*)payloadPtr;
       }
+
+      void reset(void* payloadPtr) const {
+        *(Payload*)payloadPtr = Payload();
+      }
     
       void save(void* payloadPtr, OutArchive& oa) const;
       void* load(InArchive& ia) const;
@@ -156,6 +175,10 @@ class HistogramRestaurant : public IAddRemoveRestaurant {
     l_type getC(void* payloadPtr) const;
     l_type getT(void* payloadPtr, e_type type) const;
     l_type getT(void* payloadPtr) const;
+
+    bool predictsFromCounts() const {
+      return true;
+    }
     
     double computeProbability(void*  payloadPtr,
                               e_type type, 
@@ -163,6 +186,12 @@ class HistogramRestaurant : public IAddRemoveRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
     TypeVector getTypeVector(void* payloadPtr) const;
     
     const IPayloadFactory& getFactory() const;
@@ -242,6 +271,10 @@ class HistogramRestaurant : public IAddRemoveRestaurant {
       void recycle(void* payloadPtr) const {
         delete (Payload*)payloadPtr;
       }
+
+      void reset(void* payloadPtr) const {
+        *(Payload*)payloadPtr = Payload();
+      }
       
       void save(void* payloadPtr, OutArchive& oa) const;
       void* load(InArchive& ia) const;
@@ -266,7 +299,12 @@ class HistogramRestaurant : public IAddRemoveRestaurant {
  */
 class BaseCompactRestaurant : public IAddRemoveRestaurant {
   public:
-    BaseCompactRestaurant() : payloadFactory() {}
+    /**
+     * If arena is not NULL, payloads and their table maps are allocated
+     * from it.
+     */
+    explicit BaseCompactRestaurant(Arena* arena = NULL) 
+        : payloadFactory(arena) {}
 
     virtual ~BaseCompactRestaurant() {}
 
@@ -274,6 +312,11 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
     l_type getC(void* payloadPtr) const;
     l_type getT(void* payloadPtr, e_type type) const;
     l_type getT(void* payloadPtr) const;
+
+    bool predictsFromCounts() const {
+      return true;
+    }
+
     void setC(void* payloadPtr, e_type type, l_type cw) const;
     void setT(void* payloadPtr, e_type type, l_type tw) const;
     
@@ -283,6 +326,12 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
     TypeVector getTypeVector(void* payloadPtr) const;
     
     const IPayloadFactory& getFactory() const;
@@ -300,6 +349,30 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
                      double concentration,
                      void*  additionalData = NULL,
                      double count = 1) const;
+
+    /**
+     * Same as computeProbability, but also sets slot to the index of type
+     * in the table map of the payload (see CompactArrangements::lowerBound),
+     * so that addCustomerAtSlot does not have to look type up again.
+     */
+    double computeProbabilityAndSlot(void* payloadPtr,
+                                     e_type type,
+                                     double parentProbability,
+                                     double discount,
+                                     double concentration,
+                                     int& slot) const;
+
+    /**
+     * Same as addCustomer with a count of 1, where slot has been set by
+     * computeProbabilityAndSlot for the same payload and type, and the 
+     * payload has not been changed since.
+     */
+    double addCustomerAtSlot(void* payloadPtr,
+                             e_type type,
+                             int slot,
+                             double parentProbability,
+                             double discount,
+                             double concentration) const;
     
     std::string toString(void* payloadPtr) const;
     
@@ -309,11 +382,12 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
     
     class Payload : public PoolObject<Payload> {
       public:
-        // per type: cw and tw
-        typedef std::pair<int, int> Arrangement;
-        typedef MiniMap<e_type, Arrangement> TableMap;
+        // per type: cw and tw; up to 4 types are stored in the payload 
+        // itself, which covers most restaurants
+        typedef CompactArrangements<4, ArenaAllocator> TableMap;
 
-        Payload() : tableMap(), sumCustomers(0), sumTables(0) {}
+        explicit Payload(Arena* arena = NULL) 
+            : tableMap(ArenaAllocator(arena)), sumCustomers(0), sumTables(0) {}
 
         TableMap tableMap;
         l_type sumCustomers;
@@ -325,16 +399,38 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
     
     class PayloadFactory : public IPayloadFactory {
       public:
+        explicit PayloadFactory(Arena* arena) : arena(arena) {}
+
         void* make() const {
+          if (this->arena != NULL) {
+            return ::new (this->arena->allocate(sizeof(Payload))) 
+                Payload(this->arena);
+          }
           return new Payload();
         };
         
         void recycle(void* payloadPtr) const {
-          delete (Payload*)payloadPtr;
+          if (this->arena != NULL) {
+            ((Payload*)payloadPtr)->~Payload();
+            this->arena->deallocate(payloadPtr, sizeof(Payload));
+          } else {
+            delete (Payload*)payloadPtr;
+          }
+        }
+
+        Arena* getArena() const {
+          return this->arena;
+        }
+
+        void reset(void* payloadPtr) const {
+          *(Payload*)payloadPtr = Payload();
         }
       
         void save(void* payloadPtr, OutArchive& oa) const;
         void* load(InArchive& ia) const;
+
+      private:
+        Arena* arena;
     };
 
     const PayloadFactory payloadFactory;
@@ -344,8 +440,8 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
 
 class ReinstantiatingCompactRestaurant : public BaseCompactRestaurant {
   public:
-    ReinstantiatingCompactRestaurant() 
-        : BaseCompactRestaurant(), fullRestaurant() {}
+    explicit ReinstantiatingCompactRestaurant(Arena* arena = NULL) 
+        : BaseCompactRestaurant(arena), fullRestaurant() {}
     
     double addCustomer(void*  payloadPtr, 
                      e_type type, 
@@ -375,8 +471,8 @@ class ReinstantiatingCompactRestaurant : public BaseCompactRestaurant {
 
 class StirlingCompactRestaurant : public BaseCompactRestaurant {
   public:
-    StirlingCompactRestaurant() 
-        : BaseCompactRestaurant() {}
+    explicit StirlingCompactRestaurant(Arena* arena = NULL) 
+        : BaseCompactRestaurant(arena) {}
 
     double removeCustomer(void* payloadPtr, 
                         e_type type,
@@ -395,8 +491,13 @@ class StirlingCompactRestaurant : public BaseCompactRestaurant {
 
 class ExpectedTablesCompactRestaurant : public StirlingCompactRestaurant {
   public:
-    ExpectedTablesCompactRestaurant() 
-        : StirlingCompactRestaurant() {}
+    explicit ExpectedTablesCompactRestaurant(Arena* arena = NULL) 
+        : StirlingCompactRestaurant(arena) {}
+
+    // predictions do not only depend on the integer counts
+    bool predictsFromCounts() const {
+      return false;
+    }
    
     double computeProbability(void*  payloadPtr,
                               e_type type, 
@@ -404,6 +505,12 @@ class ExpectedTablesCompactRestaurant : public StirlingCompactRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
 };
 
 
@@ -420,6 +527,10 @@ class KneserNeyRestaurant : public IAddRemoveRestaurant {
     l_type getC(void* payloadPtr) const;
     l_type getT(void* payloadPtr, e_type type) const;
     l_type getT(void* payloadPtr) const;
+
+    bool predictsFromCounts() const {
+      return true;
+    }
     
     double computeProbability(void*  payloadPtr,
                               e_type type, 
@@ -427,6 +538,12 @@ class KneserNeyRestaurant : public IAddRemoveRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
     TypeVector getTypeVector(void* payloadPtr) const;
     
     const IPayloadFactory& getFactory() const;
@@ -445,6 +562,11 @@ class KneserNeyRestaurant : public IAddRemoveRestaurant {
                      void* additionalData = NULL,
                      double count = 1) const;
 
+    // a type has exactly one table if it has any customers
+    bool isDeterministic() const {
+      return true;
+    }
+
     double removeCustomer(void* payloadPtr, 
                         e_type type,
                         double discount,
@@ -486,6 +608,10 @@ class KneserNeyRestaurant : public IAddRemoveRestaurant {
       void recycle(void* payloadPtr) const {
         delete (Payload*)payloadPtr;
       }
+
+      void reset(void* payloadPtr) const {
+        *(Payload*)payloadPtr = Payload();
+      }
     
       void save(void* payloadPtr, OutArchive& oa) const;
       void* load(InArchive& ia) const;
@@ -500,12 +626,23 @@ class PowerLawRestaurant : public KneserNeyRestaurant {
     PowerLawRestaurant() : KneserNeyRestaurant() {}
 
     ~PowerLawRestaurant() {}
+
+    // predictions do not only depend on the integer counts
+    bool predictsFromCounts() const {
+      return false;
+    }
     
     double computeProbability(void*  payloadPtr,
                               e_type type, 
                               double parentProbability,
                               double discount, 
                               double concentration) const;
+    
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
 
 };
 
@@ -515,6 +652,11 @@ class FractionalRestaurant : public StirlingCompactRestaurant {
     FractionalRestaurant() : StirlingCompactRestaurant(), payloadFactory() {}
 
     virtual ~FractionalRestaurant() {}
+
+    // predictions do not only depend on the integer counts
+    bool predictsFromCounts() const {
+      return false;
+    }
     
     double computeProbability(void*  payloadPtr,
                               e_type type, 
@@ -522,6 +664,12 @@ class FractionalRestaurant : public StirlingCompactRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
     
     double addCustomer(void*  payloadPtr, 
                      e_type type, 
@@ -574,6 +722,10 @@ class FractionalRestaurant : public StirlingCompactRestaurant {
       void recycle(void* payloadPtr) const {
         delete (Payload*)payloadPtr;
       }
+
+      void reset(void* payloadPtr) const {
+        *(Payload*)payloadPtr = Payload();
+      }
     
       void save(void* payloadPtr, OutArchive& oa) const;
       void* load(InArchive& ia) const;
@@ -588,6 +740,11 @@ class LocallyOptimalRestaurant : public StirlingCompactRestaurant {
     LocallyOptimalRestaurant() : StirlingCompactRestaurant(), payloadFactory() {}
 
     virtual ~LocallyOptimalRestaurant() {}
+
+    // predictions do not only depend on the integer counts
+    bool predictsFromCounts() const {
+      return false;
+    }
     
     double computeProbability(void*  payloadPtr,
                               e_type type, 
@@ -595,6 +752,12 @@ class LocallyOptimalRestaurant : public StirlingCompactRestaurant {
                               double discount, 
                               double concentration) const;
     
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+    
     
     double addCustomer(void*  payloadPtr, 
                      e_type type, 
@@ -647,6 +810,10 @@ class LocallyOptimalRestaurant : public StirlingCompactRestaurant {
       void recycle(void* payloadPtr) const {
         delete (Payload*)payloadPtr;
       }
+
+      void reset(void* payloadPtr) const {
+        *(Payload*)payloadPtr = Payload();
+      }
     
       void save(void* payloadPtr, OutArchive& oa) const;
       void* load(InArchive& ia) const;
@@ -683,6 +850,211 @@ inline double computeHPYPPredictiveDouble(
   }
 }
 
+/**
+ * Dense part of updatePredictiveDistribution: the probabilities of the types
+ * in [from, to), none of which has customers in the restaurant, become
+ * (numerator * p) / denominator. The expression is evaluated in exactly the
+ * same order as in computeHPYPPredictive so that both give identical results.
+ */
+inline void scaleHPYPPredictiveRange(double* distribution, int from, int to,
+                                     double numerator, double denominator) {
+  for (int i = from; i < to; ++i) {
+    distribution[i] = (numerator * distribution[i]) / denominator;
+  }
+}
+
+/**
+ * computeHPYPPredictive for restaurants with integer counts and
+ * computeHPYPPredictiveDouble for all others, selected by the count type
+ * in updateHPYPPredictiveDistribution.
+ */
+inline double computeHPYPPredictiveCounts(
+    int cw, int tw, int c, int t,
+    double parentProbability, double discount, double concentration) {
+  return computeHPYPPredictive(cw, tw, c, t,
+                               parentProbability, discount, concentration);
+}
+
+inline double computeHPYPPredictiveCounts(
+    double cw, double tw, double c, double t,
+    double parentProbability, double discount, double concentration) {
+  return computeHPYPPredictiveDouble(cw, tw, c, t,
+                                     parentProbability, discount,
+                                     concentration);
+}
+
+/**
+ * The loop shared by the updatePredictiveDistribution implementations:
+ * turn the parent distribution into the predictive distribution of a
+ * restaurant with c customers at t tables.
+ *
+ * [begin, end) enumerates the types with customers in increasing order, and
+ * counts gives their counts through
+ *
+ *   e_type type(Iterator it), Count cw(Iterator it) and
+ *   Count tw(Iterator it, double parentProbability),
+ *
+ * where Counts::Count is int for integer seating arrangements and double
+ * otherwise. The types in between are scaled by scaleHPYPPredictiveRange,
+ * so each type gets exactly the value computeProbability would return.
+ */
+template <typename Iterator, typename Counts>
+inline void updateHPYPPredictiveDistribution(
+    Iterator begin, Iterator end, const Counts& counts,
+    typename Counts::Count c, typename Counts::Count t,
+    double discount, double concentration,
+    double* distribution, int numTypes) {
+  if (c == 0) {
+    return;
+  }
+  double numerator = concentration + discount*t;
+  double denominator = c + concentration;
+  int from = 0;
+  for (Iterator it = begin; it != end; ++it) {
+    e_type type = counts.type(it);
+    assert(type >= from && type < numTypes);
+    scaleHPYPPredictiveRange(distribution, from, type, numerator, denominator);
+    distribution[type] = computeHPYPPredictiveCounts(
+        counts.cw(it), // cw
+        counts.tw(it, distribution[type]), // tw
+        c, t, distribution[type], discount, concentration);
+    from = type + 1;
+  }
+  scaleHPYPPredictiveRange(distribution, from, numTypes, numerator, denominator);
+}
+
+
+// computeProbability and addCustomer of the compact and Kneser-Ney 
+// restaurants are called for every node on every path; they are defined 
+// here so that PathOperations (see hpyp_path_operations.h) can inline them
+
+inline double BaseCompactRestaurant::computeProbability(
+    void* payloadPtr, e_type type, double parentProbability,
+    double discount, double concentration) const {
+  int slot;
+  return this->computeProbabilityAndSlot(payloadPtr, type, parentProbability,
+                                         discount, concentration, slot);
+}
+
+
+inline double BaseCompactRestaurant::computeProbabilityAndSlot(
+    void* payloadPtr, e_type type, double parentProbability,
+    double discount, double concentration, int& slot) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  int cw = 0;
+  int tw = 0;
+  Payload::TableMap::size_type i = payload.tableMap.lowerBound(type);
+  if (i != payload.tableMap.size() && payload.tableMap.type(i) == type) {
+    cw = payload.tableMap.cw(i);
+    tw = payload.tableMap.tw(i);
+  }
+  slot = i;
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               payload.sumCustomers, // c
+                               payload.sumTables, // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
+inline double BaseCompactRestaurant::addCustomer(
+    void* payloadPtr, e_type type, double parentProbability,
+    double discount, double concentration, void* additionalData,
+    double count) const {
+  assert(count == 1.0);
+
+  tracer << "BaseCompactRestaurant::addCustomer(" << type << "," 
+         << parentProbability << "," << discount << "," << concentration 
+         << ", " << additionalData
+         << ")" << std::endl;
+
+  Payload& payload = *((Payload*)payloadPtr);
+  return this->addCustomerAtSlot(payloadPtr, type, 
+                                 payload.tableMap.lowerBound(type),
+                                 parentProbability, discount, concentration);
+}
+
+
+inline double BaseCompactRestaurant::addCustomerAtSlot(
+    void* payloadPtr, e_type type, int slot, double parentProbability,
+    double discount, double concentration) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  Payload::TableMap::size_type i = payload.tableMap.insertAt(slot, type);
+  int& arrangementCw = payload.tableMap.cw(i);
+  int& arrangementTw = payload.tableMap.tw(i);
+
+  // add customer, incC returns incremented count
+  l_type cw = arrangementCw;
+  arrangementCw += 1; // inc(cw)
+  payload.sumCustomers += 1; // inc(c)
+
+  if (cw == 0) {
+    // first customer always creates a table
+    arrangementTw += 1; // inc(tw)
+    payload.sumTables += 1; // inc(t)
+    return 1;
+  } else {
+    double incTProb =   (concentration + discount*payload.sumTables)
+      * parentProbability;
+    incTProb = incTProb/(incTProb + cw - arrangementTw * discount);
+    if (coin(incTProb)) {
+      arrangementTw += 1;
+      payload.sumTables += 1;
+      return 1;
+    } else {
+      return 0;
+    }
+  }
+}
+
+
+inline double KneserNeyRestaurant::computeProbability(
+    void* payloadPtr, e_type type, double parentProbability,
+    double discount, double concentration) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  
+  if (payload.sumCustomers == 0) {
+    return parentProbability;
+  }
+
+  Payload::TableMap::iterator it = payload.tableMap.find(type);
+  int cw = 0;
+  int tw = 0;
+  if (it != payload.tableMap.end()) {
+    cw = (*it).second;
+    tw = 1;
+  }
+
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               payload.sumCustomers, // c
+                               payload.tableMap.size(), // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
+inline double KneserNeyRestaurant::addCustomer(
+    void* payloadPtr, e_type type, double parentProbability,
+    double discount, double concentration, void* additionalData,
+    double count) const {
+  assert(count == 1.0);
+  tracer << "KneserNeyRestaurant::addCustomer(" << type << "," 
+         << parentProbability << "," << discount << "," << concentration 
+         << ", " << additionalData
+         << ")" << std::endl;
+
+  Payload& payload = *((Payload*)payloadPtr);
+  int& cw = payload.tableMap[type];
+  cw += 1;
+  payload.sumCustomers += 1;
+  return (cw == 1)?1.0:0; // true if we created a new table
+}
+
+
 inline double pypExpectedNumberOfTables(double alpha, double d, double n) {
   if (d != 0) {
     return std::exp(logKramp(alpha + d, 1, n) - std::log(d) - logKramp(alpha + 1, 1, n - 1)) - alpha/d;
@@ -18,14 +18,20 @@
 #define LIBPLUMP_H_
 
 #include "libplump/config.h"
+#include "libplump/symbol_sequence.h"
 #include "libplump/utils.h"
+#include "libplump/arena.h"
 #include "libplump/random.h"
 #include "libplump/node_manager.h"
+#include "libplump/flat_node_manager.h"
+#include "libplump/tracking_node_manager.h"
 #include "libplump/context_tree.h"
 #include "libplump/hpyp_restaurants.h"
 #include "libplump/switching_restaurant.h"
 #include "libplump/hpyp_parameters.h"
+#include "libplump/hpyp_path_operations.h"
 #include "libplump/hpyp_model.h"
 #include "libplump/serialization.h"
+#include "libplump/snapshot.h"
 
 #endif
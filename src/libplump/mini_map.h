@@ -18,15 +18,22 @@
 #define MINI_MAP_H_
 
 #include <algorithm>
+#include <cassert>
 #include <ostream>
 #include <sstream>
 #include <iterator>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
-#include <boost/scoped_array.hpp>
+#include <stdint.h>
+#include <boost/functional/hash.hpp>
 #include <boost/serialization/access.hpp>
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include "libplump/arena.h"
 
 namespace gatsby { namespace libplump {
 
@@ -36,16 +43,30 @@ namespace gatsby { namespace libplump {
  *
  * The benefits of this type of container over the usual 
  * red-black tree implementation of e.g. std::map are that:
- *   - small constant overhead (2 pointers to the arrays and one integer
- *     storing the current number of elements in the container.
+ *   - small constant overhead (1 pointer to the arrays, the number of 
+ *     elements and the capacity, and the allocator).
  * 
- * Like for std::map, lookup is logarithmic, but insertion is linear.
+ * Insertion is linear in the number of elements. Lookups adapt to the 
+ * number of elements: maps with up to LINEAR_SEARCH_MAX elements are 
+ * scanned linearly, larger ones are searched by bisection, and once the 
+ * capacity reaches HASH_MIN_CAPACITY the block also holds an open-addressing
+ * hash table mapping keys to their offsets, so that lookups in maps with 
+ * many elements (e.g. the children of the root of a word-level context 
+ * tree) take a constant number of cache misses. Iteration is always in key
+ * order.
+ *
+ * Both arrays are kept in a single block (the values following the keys),
+ * which is obtained from an Allocator (HeapAllocator or ArenaAllocator). 
+ * The allocator is copied into copies of the map. An empty map does not 
+ * allocate a block until the first element is inserted, and capacity can
+ * be reserved up front when the number of elements is known.
  *
  * Only a subset of the operations required by the STL associative container
  * concept are supported, but the ones that are supported should behave in the
  * required way.
  */
-template<class Key, class T, typename size_type = unsigned int>
+template<class Key, class T, typename size_type = unsigned int,
+         class Allocator = HeapAllocator>
 class MiniMap {
   public:
     typedef Key key_type;
@@ -57,56 +78,91 @@ class MiniMap {
     // alias const_iterator for compatability with STL map
     typedef const_iterator iterator;
 
-    MiniMap() : keys(new Key[1]), values(new T[1]), _size(0) {}
+    // maps with up to this many elements are searched linearly
+    static const size_type LINEAR_SEARCH_MAX = 8;
+
+    // maps with at least this capacity are searched using a hash index;
+    // the maps in between are small enough for bisection to stay within a 
+    // few cache lines, and do not pay for the index
+    static const size_type HASH_MIN_CAPACITY = 64;
+
+    explicit MiniMap(const Allocator& allocator = Allocator()) 
+        : keys(NULL), _size(0), _capacity(0), allocator(allocator) {}
 
-    MiniMap(const MiniMap& other) : 
-        keys(new Key[other.capacity()]),
-        values(new T[other.capacity()]) {
-          std::copy(other.keys.get(), 
-                    other.keys.get() + other._size, 
-                    this->keys.get());
-          std::copy(other.values.get(), 
-                    other.values.get() + other._size,
-                    this->values.get());
-          this->_size = other._size;
+    MiniMap(const MiniMap& other) 
+        : keys(NULL), _size(0), _capacity(0), allocator(other.allocator) {
+      this->copyFrom(other);
     }
 
+    /**
+     * Copy the elements of other; the map keeps its own allocator.
+     */
     MiniMap& operator=(const MiniMap& other) {
       if (this != &other) {
-        size_type cap = other.capacity();
-
-        Key* newKeys = 0;
-        T* newValues = 0;
-
-        try {
-          newKeys = new Key[cap];
-          newValues = new T[cap];
-
-          std::copy(other.keys.get(), other.keys.get() + other._size, newKeys);
-          std::copy(other.values.get(), 
-                    other.values.get() + other._size,
-                    newValues);
+        this->clear();
+        this->copyFrom(other);
+      }
+      return *this;
+    }
 
-        } 
-        catch (...) {
-          delete[] newKeys;
-          delete[] newValues;
-          throw;
-        }
+#if __cplusplus >= 201103L
+    MiniMap(MiniMap&& other) 
+        : keys(other.keys), _size(other._size), _capacity(other._capacity),
+          allocator(other.allocator) {
+      other.keys = NULL;
+      other._size = 0;
+      other._capacity = 0;
+    }
 
-        this->keys.reset(newKeys);
-        this->values.reset(newValues);
-        _size = other._size;
+    /**
+     * Take over the elements, and the allocator, of other.
+     */
+    MiniMap& operator=(MiniMap&& other) {
+      if (this != &other) {
+        this->clear();
+        this->swap(other);
       }
       return *this;
     }
+#endif
 
-    ~MiniMap() {}
+    ~MiniMap() {
+      this->freeArrays(this->keys, this->_capacity);
+    }
 
+    /**
+     * Remove all elements and free the arrays.
+     */
     void clear() {
-      this->keys.reset(new Key[1]);
-      this->values.reset(new T[1]);
+      this->freeArrays(this->keys, this->_capacity);
+      this->keys = NULL;
       this->_size = 0;
+      this->_capacity = 0;
+    }
+
+    /**
+     * Exchange the elements, and the allocators, of the two maps.
+     */
+    void swap(MiniMap& other) {
+      std::swap(this->keys, other.keys);
+      std::swap(this->_size, other._size);
+      std::swap(this->_capacity, other._capacity);
+      std::swap(this->allocator, other.allocator);
+    }
+
+    /**
+     * Make sure that the map can hold at least capacity elements without
+     * reallocating its arrays.
+     */
+    void reserve(size_type capacity) {
+      if (capacity > this->_capacity) {
+        this->reallocate(capacity, this->_size);
+        this->rebuildIndex();
+      }
+    }
+
+    const Allocator& get_allocator() const {
+      return this->allocator;
     }
 
 
@@ -126,10 +182,24 @@ class MiniMap {
       return _size;
     }
 
+    /**
+     * Number of elements the allocated arrays can hold.
+     */
+    size_type capacity() const {
+      return _capacity;
+    }
+
+    /**
+     * Number of bytes allocated for the elements and the hash index.
+     */
+    size_t memoryUsage() const {
+      return (this->keys == NULL) ? 0 : blockSize(this->_capacity);
+    }
+
     const_iterator find(const Key& key) const {
-      Key* pos = std::lower_bound(keys.get(),&keys[_size],key);
-      if (pos != &keys[_size] && *pos == key) {
-        return const_iterator(keys.get(),values.get(),pos);
+      size_type offset = this->locate(key);
+      if (offset != _size) {
+        return const_iterator(keys,valueArray(),keys + offset);
       } else {
         return this->end();
       }
@@ -137,44 +207,64 @@ class MiniMap {
 
 
     T& operator[](const Key& key) {
-      Key* pos = std::lower_bound(keys.get(),&keys[_size],key);
-      size_type offset = pos - keys.get();
-      if (pos != &keys[_size] && *pos == key) {
-        return values[offset];
+      size_type offset = this->locate(key);
+      if (offset != _size) {
+        return valueArray()[offset];
       } else {
+        offset = std::lower_bound(keys, keys + _size, key) - keys;
         return insert(offset, key, T());
       }
     }
 
+    /**
+     * Remove the element with the given key, if there is one; returns the 
+     * number of elements removed. The capacity is left unchanged.
+     */
+    size_type erase(const Key& key) {
+      size_type offset = this->locate(key);
+      if (offset == _size) {
+        return 0;
+      }
+      T* values = this->valueArray();
+      std::copy(keys + offset + 1, keys + _size, keys + offset);
+      std::copy(values + offset + 1, values + _size, values + offset);
+      _size--;
+      keys[_size] = Key();
+      values[_size] = T();
+      // entries cannot be removed from an open-addressing table one by one
+      this->rebuildIndex();
+      return 1;
+    }
+
     const_iterator insert(const_iterator position, const value_type& x) {
-      if (*(position.pos) == x.first) {
-        this->values[position.pos - position.keys] = x.second;
+      if (position.pos != keys + _size && *(position.pos) == x.first) {
+        this->valueArray()[position.pos - position.keys] = x.second;
         return position; // iterator unchanged
       } else {
         Key* pos;
-        if (x.first > *(position.pos)) {
-          pos = std::lower_bound(position.pos,&keys[_size],x.first);
+        if (position.pos != keys + _size && x.first > *(position.pos)) {
+          pos = std::lower_bound(position.pos, keys + _size, x.first);
         } else {
-          pos = std::lower_bound(keys.get(),&keys[_size],x.first);
+          pos = std::lower_bound(keys, keys + _size, x.first);
         }
-        int offset = pos - keys.get();
-        if (pos != &keys[_size] && *pos == x.first) {
-          values[offset] = x.second;
+        size_type offset = pos - keys;
+        if (pos != keys + _size && *pos == x.first) {
+          valueArray()[offset] = x.second;
         } else {
           insert(offset, x.first, x.second);
         }
-        return const_iterator(keys.get(), values.get(), keys.get() + offset); 
+        return const_iterator(keys, valueArray(), keys + offset); 
       }
     }
 
 
     const_iterator begin() const {
-      return const_iterator(keys.get(),values.get(),keys.get());
+      return const_iterator(keys,valueArray(),keys);
     }
 
 
     const_iterator end() const {
-      return const_iterator(keys.get(),values.get(),&keys[_size]);
+      return const_iterator(keys,valueArray(),keys + _size);
     }
 
 
@@ -229,57 +319,245 @@ class MiniMap {
     };
   
   private:
-    boost::scoped_array<Key> keys;
-    boost::scoped_array<T> values;
+    // start of the block holding the keys and values; NULL if the 
+    // capacity is 0
+    Key* keys;
     size_type _size;
+    size_type _capacity;
+    Allocator allocator;
 
-    T& insert(size_type offset, const Key& key, const T& value) {
-      ensure_capacity();
-      for(size_type i=_size;i>offset;i--) {
-        keys[i] = keys[i-1];
-        values[i] = values[i-1];
+    /**
+     * Offset in bytes of the values in a block of the given capacity.
+     */
+    static size_t valueOffset(size_type capacity) {
+      size_t alignment = boost::alignment_of<T>::value;
+      return (capacity * sizeof(Key) + alignment - 1) / alignment * alignment;
+    }
+
+    static size_t blockSize(size_type capacity) {
+      return indexOffset(capacity) + indexSlots(capacity) * sizeof(size_type);
+    }
+
+    static T* valuesOf(Key* keys, size_type capacity) {
+      return reinterpret_cast<T*>(reinterpret_cast<char*>(keys) 
+                                  + valueOffset(capacity));
+    }
+
+    T* valueArray() const {
+      return valuesOf(this->keys, this->_capacity);
+    }
+
+    /**
+     * Number of slots of the hash index in a block of the given capacity; 
+     * a power of two that keeps the load factor at most 1/2, or 0 if the
+     * block has no index.
+     */
+    static size_type indexSlots(size_type capacity) {
+      if (capacity < HASH_MIN_CAPACITY) {
+        return 0;
       }
-      keys[offset] = key;
-      values[offset] = value;
-      _size++;
-      return values[offset];
+      return (size_type)1 << (sizeof(unsigned long long) * 8 
+                              - __builtin_clzll(2ULL * capacity - 1));
+    }
+
+    /**
+     * Offset in bytes of the hash index in a block of the given capacity.
+     */
+    static size_t indexOffset(size_type capacity) {
+      size_t alignment = boost::alignment_of<size_type>::value;
+      return (valueOffset(capacity) + capacity * sizeof(T) + alignment - 1) 
+             / alignment * alignment;
+    }
+
+    bool indexed() const {
+      return this->_capacity >= HASH_MIN_CAPACITY;
+    }
+
+    /**
+     * The hash index; each slot holds 0 if it is empty, and one plus the
+     * offset of a key otherwise.
+     */
+    size_type* indexArray() const {
+      return reinterpret_cast<size_type*>(reinterpret_cast<char*>(this->keys)
+                                          + indexOffset(this->_capacity));
+    }
+
+    static size_type hashSlot(const Key& key, size_type mask) {
+      // multiplicative hashing spreads runs of consecutive keys
+      uint32_t h = (uint32_t)boost::hash<Key>()(key) * 2654435769u;
+      return (h ^ (h >> 16)) & mask;
     }
 
     /**
-     * Ensure that the allocated arrays can hold at least one additional
-     * element.
-     *
-     * If the storage arrays need to be resized, the are re-allocating to twice
-     * the size of the old ones.
+     * Offset of the given key, or _size if it is not in the map.
      */
-    void ensure_capacity() {
-      size_type c = capacity();
-      assert(c >= _size); // we should never be over capacity
-      if(c == _size) {
-        size_type new_capacity = c * 2;
-        Key* newKeys = new Key[new_capacity];
-        T* newValues = new T[new_capacity];
-        std::copy(this->keys.get(), this->keys.get() + this->_size, newKeys);
-        std::copy(this->values.get(), 
-                  this->values.get() + this->_size,
-                  newValues);
-        this->keys.reset(newKeys);
-        this->values.reset(newValues);
+    size_type locate(const Key& key) const {
+      if (this->_size <= LINEAR_SEARCH_MAX) {
+        size_type i = 0;
+        while (i < this->_size && keys[i] < key) {
+          ++i;
+        }
+        return (i < this->_size && keys[i] == key) ? i : this->_size;
+      }
+      if (this->indexed()) {
+        const size_type* index = this->indexArray();
+        size_type mask = indexSlots(this->_capacity) - 1;
+        for (size_type slot = hashSlot(key, mask); index[slot] != 0; 
+             slot = (slot + 1) & mask) {
+          if (keys[index[slot] - 1] == key) {
+            return index[slot] - 1;
+          }
+        }
+        return this->_size;
       }
+      Key* pos = std::lower_bound(keys, keys + this->_size, key);
+      return (pos != keys + this->_size && *pos == key) ? pos - keys 
+                                                        : this->_size;
     }
 
-    /** Returns the capacity of this map, i.e. the number of elements that the
-     * currently allocated arrays can hold.
-     *
-     * As we always double the size of the arrays when we resize, the capacity
-     * is equal to the smallest power of 2 that is larger than the number of
-     * elements in the map.
+    /**
+     * Add the key at the given offset to the hash index.
      */
-    size_type capacity() const {
-      size_type powof2 = 1;
-      // Double powof2 until >= val
-      while (powof2 < _size) powof2 <<= 1;
-      return powof2;
+    void addToIndex(size_type offset) {
+      size_type* index = this->indexArray();
+      size_type mask = indexSlots(this->_capacity) - 1;
+      size_type slot = hashSlot(keys[offset], mask);
+      while (index[slot] != 0) {
+        slot = (slot + 1) & mask;
+      }
+      index[slot] = offset + 1;
+    }
+
+    /**
+     * Update the hash index after the elements after offset have been moved
+     * up by one. If only a few elements have moved (e.g. when keys are
+     * mostly inserted in increasing order), their slots are looked up, from
+     * the last one down so that no slot is updated twice; otherwise all
+     * slots are scanned.
+     */
+    void shiftIndex(size_type offset) {
+      size_type* index = this->indexArray();
+      size_type slots = indexSlots(this->_capacity);
+      size_type moved = this->_size - 1 - offset;
+      if (8 * moved < slots) {
+        size_type mask = slots - 1;
+        for (size_type i = this->_size - 1; i > offset; --i) {
+          // the element now at offset i is stored as i - 1, plus one
+          size_type slot = hashSlot(keys[i], mask);
+          while (index[slot] != i) {
+            slot = (slot + 1) & mask;
+          }
+          index[slot] = i + 1;
+        }
+      } else {
+        for (size_type slot = 0; slot < slots; ++slot) {
+          if (index[slot] > offset) {
+            ++index[slot];
+          }
+        }
+      }
+    }
+
+    void rebuildIndex() {
+      if (!this->indexed()) {
+        return;
+      }
+      size_type* index = this->indexArray();
+      std::fill(index, index + indexSlots(this->_capacity), 0);
+      for (size_type i = 0; i < this->_size; ++i) {
+        this->addToIndex(i);
+      }
+    }
+
+    /**
+     * Allocate a block for capacity keys and values, with all elements 
+     * default constructed.
+     */
+    void allocateArrays(size_type capacity, Key*& newKeys, T*& newValues) {
+      char* block = static_cast<char*>(
+          this->allocator.allocate(blockSize(capacity)));
+      newKeys = reinterpret_cast<Key*>(block);
+      newValues = valuesOf(newKeys, capacity);
+      std::uninitialized_fill(newKeys, newKeys + capacity, Key());
+      std::uninitialized_fill(newValues, newValues + capacity, T());
+      size_type* index = reinterpret_cast<size_type*>(block 
+                                                      + indexOffset(capacity));
+      std::fill(index, index + indexSlots(capacity), 0);
+    }
+
+    void freeArrays(Key* oldKeys, size_type capacity) {
+      if (oldKeys == NULL) {
+        return;
+      }
+      T* oldValues = valuesOf(oldKeys, capacity);
+      for (size_type i = 0; i < capacity; ++i) {
+        oldKeys[i].~Key();
+        oldValues[i].~T();
+      }
+      this->allocator.deallocate(oldKeys, blockSize(capacity));
+    }
+
+    /**
+     * Move the elements to arrays of the given capacity, leaving a gap 
+     * for one element at offset gap (no gap if gap == _size). The hash 
+     * index is left empty until rebuildIndex is called.
+     */
+    void reallocate(size_type capacity, size_type gap) {
+      Key* newKeys;
+      T* newValues;
+      this->allocateArrays(capacity, newKeys, newValues);
+      T* values = this->valueArray();
+      size_type shift = (gap < this->_size) ? 1 : 0;
+      std::copy(this->keys, this->keys + gap, newKeys);
+      std::copy(this->keys + gap, this->keys + this->_size, 
+                newKeys + gap + shift);
+      std::copy(values, values + gap, newValues);
+      std::copy(values + gap, values + this->_size, newValues + gap + shift);
+      this->freeArrays(this->keys, this->_capacity);
+      this->keys = newKeys;
+      this->_capacity = capacity;
+    }
+
+    void copyFrom(const MiniMap& other) {
+      if (other._size > 0) {
+        this->reserve(other._size);
+        std::copy(other.keys, other.keys + other._size, this->keys);
+        std::copy(other.valueArray(), other.valueArray() + other._size, 
+                  this->valueArray());
+        this->_size = other._size;
+        this->rebuildIndex();
+      }
+    }
+
+    /**
+     * Insert (key, value) at the given offset; if the arrays are full, they
+     * are moved to arrays of twice the capacity, which leaves a gap at the
+     * offset instead of shifting the elements after it separately.
+     */
+    T& insert(size_type offset, const Key& key, const T& value) {
+      assert(this->_capacity >= this->_size);
+      bool reallocated = (this->_size == this->_capacity);
+      if (reallocated) {
+        size_type newCapacity = (this->_capacity == 0) ? 1 
+                                                       : 2 * this->_capacity;
+        this->reallocate(newCapacity, offset);
+      } else {
+        T* values = this->valueArray();
+        std::copy_backward(keys + offset, keys + _size, keys + _size + 1);
+        std::copy_backward(values + offset, values + _size, 
+                           values + _size + 1);
+      }
+      T* values = this->valueArray();
+      keys[offset] = key;
+      values[offset] = value;
+      _size++;
+      if (reallocated) {
+        this->rebuildIndex();
+      } else if (this->indexed()) {
+        this->shiftIndex(offset);
+        this->addToIndex(offset);
+      }
+      return values[offset];
     }
     
     friend class boost::serialization::access;
@@ -287,10 +565,10 @@ class MiniMap {
     template<class Archive>
     void save(Archive & ar, const unsigned int version) const {
       // copy data into STL vectors to simplify serialization
-      std::vector<Key> keyVec(this->keys.get(),
-                              this->keys.get() + this->_size);
-      std::vector<T> valueVec(this->values.get(),
-                              this->values.get() + this->_size);
+      std::vector<Key> keyVec(this->keys,
+                              this->keys + this->_size);
+      std::vector<T> valueVec(this->valueArray(),
+                              this->valueArray() + this->_size);
       ar << _size;
       ar << keyVec;
       ar << valueVec;
@@ -301,21 +579,25 @@ class MiniMap {
     void load(Archive & ar, const unsigned int version) {
       std::vector<Key> keyVec;
       std::vector<T> valueVec;
-      ar >> this->_size;
+      size_type size;
+      ar >> size;
       ar >> keyVec;
       ar >> valueVec;
-      this->keys.reset(new Key[this->capacity()]);
-      std::copy(keyVec.begin(), keyVec.end(), this->keys.get());
-      this->values.reset(new T[this->capacity()]);
-      std::copy(valueVec.begin(), valueVec.end(), this->values.get());
+      this->clear();
+      this->reserve(size);
+      std::copy(keyVec.begin(), keyVec.end(), this->keys);
+      std::copy(valueVec.begin(), valueVec.end(), this->valueArray());
+      this->_size = size;
+      this->rebuildIndex();
     }
 
     BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
 
-template<class Key, class T>
-std::ostream& operator<<(std::ostream& stream, MiniMap<Key,T> map) {
+template<class Key, class T, typename size_type, class Allocator>
+std::ostream& operator<<(std::ostream& stream, 
+                         MiniMap<Key,T,size_type,Allocator> map) {
   stream << map.toString();
   return stream;
 }
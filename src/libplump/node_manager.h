@@ -30,15 +30,22 @@ namespace gatsby { namespace libplump {
  * A SimpleNodeManager implements the NodeManager functionality by 
  * storing a map from keys to pointers to children in each node. 
  * It manages memory using a Boost pool for efficient creation/deletion of
- * nodes.
+ * nodes, or using an Arena if one is given.
  * It treats all nodes the same (i.e. all have Payloads).
+ *
+ * If the payload factory allocates from the same arena, destroying the root
+ * (e.g. when the ContextTree is destroyed) releases the arena as a whole
+ * instead of destroying the nodes one by one; the arena must then not be 
+ * used by anything other than this node manager and the payload factory.
  */
 class SimpleNodeManager : public INodeManager {
 
   public:
 
-    SimpleNodeManager(const IPayloadFactory& payloadFactory) 
-      :  payloadFactory(payloadFactory), root(createNode(0,0)){} 
+    SimpleNodeManager(const IPayloadFactory& payloadFactory, 
+                      Arena* arena = NULL) 
+      :  payloadFactory(payloadFactory), arena(arena), 
+         root(createNode(0,0)){} 
 
     ~SimpleNodeManager() {
       this->destroyNode(this->root);
@@ -95,11 +102,11 @@ class SimpleNodeManager : public INodeManager {
     }
 
     /**
-     * Remove the child with key key from node's child list.
-     * XXX: Not implemented -- and not needed?
+     * Remove the child with key key from node's child list; the child 
+     * itself is not destroyed.
      */
     void removeChild(NodeId node, e_type key) {
-
+      static_cast<Node*>(node)->children.erase(key);
     }
 
     /**
@@ -135,7 +142,12 @@ class SimpleNodeManager : public INodeManager {
     void destroyNode(NodeId node) {
       if (node != NULL) {
         this->payloadFactory.recycle(static_cast<Node*>(node)->payload);
-        delete static_cast<Node*>(node);
+        if (this->arena != NULL) {
+          static_cast<Node*>(node)->~Node();
+          this->arena->deallocate(node, sizeof(Node));
+        } else {
+          delete static_cast<Node*>(node);
+        }
       }
     }
 
@@ -144,6 +156,13 @@ class SimpleNodeManager : public INodeManager {
      * Destroy the given node and all its children.
      */
     void destroyNodeRecursive(NodeId node) {
+      if (node == this->root && this->arena != NULL 
+          && this->payloadFactory.getArena() == this->arena) {
+        // all nodes and payloads live in the arena
+        this->arena->release();
+        this->root = createNode(0,0);
+        return;
+      }
       if (node != NULL) {
         for (ChildMapIterator it = static_cast<Node*>(node)->children.begin();
              it != static_cast<Node*>(node)->children.end(); ++it) {
@@ -171,6 +190,10 @@ class SimpleNodeManager : public INodeManager {
           : start(start), end(end), payload(payload), children() {}
 
         Node() : start(0), end(0), payload(NULL), children() {}
+
+        explicit Node(Arena* arena) 
+          : start(0), end(0), payload(NULL), 
+            children(ArenaAllocator(arena)) {}
     };
 
 
@@ -181,8 +204,12 @@ class SimpleNodeManager : public INodeManager {
      * call destroyNode or destroyNodeRecursive when done using it.
      */
     Node* createNode(l_type start, l_type end, void* payload = NULL) {
-      //NodeId node(new (node_pool.malloc()) Node());
-      Node* node = new Node();
+      Node* node;
+      if (this->arena != NULL) {
+        node = ::new (this->arena->allocate(sizeof(Node))) Node(this->arena);
+      } else {
+        node = new Node();
+      }
       node->start = start;
       node->end = end;
       if (payload != NULL) {
@@ -195,6 +222,7 @@ class SimpleNodeManager : public INodeManager {
     
 
     const IPayloadFactory& payloadFactory;
+    Arena* arena;
     Node* root;
 
     DISALLOW_COPY_AND_ASSIGN(SimpleNodeManager);
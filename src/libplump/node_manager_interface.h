@@ -17,12 +17,51 @@
 #ifndef NODE_MANAGER_INTERFACE_H_
 #define NODE_MANAGER_INTERFACE_H_
 
+#include <cstring>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "libplump/arena.h"
 #include "libplump/config.h"
 #include "libplump/serialization.h"
 
 
 namespace gatsby { namespace libplump {
 
+/**
+ * The discount of a node as computed by the parameters (see 
+ * IParameters::setPathParameters), stored with the node by node managers
+ * that support it. The discount is valid while version equals the version
+ * of the parameters; version 0 marks an empty cache.
+ *
+ * Concurrent predictions may fill the cache of the same node, so the 
+ * discount is stored atomically (as its bit pattern) and written before
+ * the version; they all write the same value.
+ */
+struct DiscountCache {
+  boost::atomic<boost::uint64_t> discountBits;
+  boost::atomic<unsigned int> version;
+
+  DiscountCache() : discountBits(0), version(0) {}
+
+  double getDiscount() const {
+    boost::uint64_t bits = this->discountBits.load(boost::memory_order_relaxed);
+    double discount;
+    std::memcpy(&discount, &bits, sizeof(discount));
+    return discount;
+  }
+
+  void setDiscount(double discount) {
+    boost::uint64_t bits;
+    std::memcpy(&bits, &discount, sizeof(bits));
+    this->discountBits.store(bits, boost::memory_order_relaxed);
+  }
+
+  void invalidate() {
+    this->version.store(0, boost::memory_order_relaxed);
+  }
+};
+
 /**
  * The node manager should abstract simple operations on nodes 
  * such as finding the children of a node or returning the payload 
@@ -129,6 +168,30 @@ class INodeManager {
      * Destroy the given node and all its children.
      */
     virtual void destroyNodeRecursive(NodeId node) = 0;
+
+    /**
+     * Notify the node manager that the payload of the node with the given 
+     * start and end positions has been changed in place, e.g. by seating
+     * a customer in its restaurant. 
+     *
+     * Node managers that record changes (see TrackingNodeManager) 
+     * override this; by default it does nothing.
+     */
+    virtual void markModified(l_type start, l_type end, void* payload) {}
+
+    /**
+     * Notify the node manager that the payloads of all nodes may have 
+     * been changed, e.g. by a sweep of the Gibbs sampler.
+     */
+    virtual void markAllModified() {}
+
+    /**
+     * Get the discount cache of the given node, or NULL if the node manager
+     * does not cache discounts, which is the default.
+     */
+    virtual DiscountCache* getDiscountCache(NodeId node) const {
+      return NULL;
+    }
 };
 
 
@@ -149,8 +212,23 @@ class IPayloadFactory {
   public:
     virtual void* make() const = 0;
     virtual void recycle(void*) const = 0;
+    /**
+     * Bring a payload back to the state of a freshly made one without
+     * freeing it, so that it can be reused as scratch space.
+     */
+    virtual void reset(void*) const = 0;
     virtual void save(void*, OutArchive&) const = 0;
     virtual void* load(InArchive&) const = 0;
+
+    /**
+     * Return the arena that make() allocates payloads, including all the 
+     * memory they use internally, from; or NULL if payloads are allocated
+     * elsewhere. Payloads in an arena need not be recycled before the 
+     * arena is released.
+     */
+    virtual Arena* getArena() const {
+      return NULL;
+    }
 };
 
 }} // namespace gatsby::libplump
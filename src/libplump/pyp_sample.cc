@@ -33,7 +33,8 @@ namespace gatsby { namespace libplump {
 /**
  * Sample a seating arrangement given the table creation times z.
  */
-std::vector<int> sample_crp_given_z(double d, std::vector<int>& z) {
+std::vector<int> sample_crp_given_z(double d, std::vector<int>& z,
+                                    gsl_rng* rng) {
   int t = z[z.size()-1] + 1;
   std::vector<int> arrangement(t,0);
   std::vector<double> probs(t,0);
@@ -47,7 +48,7 @@ std::vector<int> sample_crp_given_z(double d, std::vector<int>& z) {
         probs[j] = (arrangement[j] - d)/(i - (z[i]+1)*d);
       }
     }
-    ++arrangement[sample_unnormalized_pdf(probs,z[i])];
+    ++arrangement[sample_unnormalized_pdf(probs, z[i], rng)];
   }
 
   assert(sum(arrangement) == z.size() && (int)arrangement.size() == t);
@@ -63,7 +64,7 @@ std::vector<int> sample_crp_given_z(double d, std::vector<int>& z) {
  *
  * Runtime: O(c x t)
  */
-std::vector<int> sample_crp_z_fb(double d, int c, int t) {
+std::vector<int> sample_crp_z_fb(double d, int c, int t, gsl_rng* rng) {
   tracer << "sample_crp_ct_fb(" << d << ", " << c << ", " << t << ")" << std::endl;
   assert(c!=0);
   assert(c>=t);
@@ -101,7 +102,7 @@ std::vector<int> sample_crp_z_fb(double d, int c, int t) {
   for(index i = c - 2; i >= 0; --i) {
     probs[cur] = (i+1-(cur+1)*d) * grid[cur][i];
     probs[cur-1] = grid[cur-1][i];
-    cur = sample_unnormalized_pdf(probs);
+    cur = sample_unnormalized_pdf(probs, 0, rng);
     z[i] = cur;
     if (cur == 0) {
       break;
@@ -120,7 +121,7 @@ std::vector<int> sample_crp_z_fb(double d, int c, int t) {
  * 
  * Runtime: O(c x t)
  */
-std::vector<int> sample_crp_z_bf(double d, int c, int t) {
+std::vector<int> sample_crp_z_bf(double d, int c, int t, gsl_rng* rng) {
   tracer << "sample_crp_ct_bf(" << d << ", " << c << ", " << t << ")" << std::endl;
   assert(c!=0);
   assert(c>=t);
@@ -164,7 +165,7 @@ std::vector<int> sample_crp_z_bf(double d, int c, int t) {
     probs[cur] = (i-(cur+1)*d) * grid[cur][i];
     probs[cur+1] = grid[cur+1][i];
     //std::cout << iterableToString(probs) << std::endl;
-    cur = sample_unnormalized_pdf(probs);
+    cur = sample_unnormalized_pdf(probs, 0, rng);
     z[i] = cur;
     if (cur == t - 1) {
       // all remaining customers must join existing tables
@@ -178,7 +179,7 @@ std::vector<int> sample_crp_z_bf(double d, int c, int t) {
   return z;
 }
 
-std::vector<int> sample_crp_c(double d, double a, int c) {
+std::vector<int> sample_crp_c(double d, double a, int c, gsl_rng* rng) {
   d_vec probs(c,0);
   std::vector<int> arrangement;
   arrangement.push_back(1); // first customer at first table
@@ -187,7 +188,7 @@ std::vector<int> sample_crp_c(double d, double a, int c) {
       probs[j] = arrangement[j] - d;
     }
     probs[arrangement.size()] = a + arrangement.size()*d;
-    int sample = sample_unnormalized_pdf(probs,arrangement.size());
+    int sample = sample_unnormalized_pdf(probs, arrangement.size(), rng);
     if (sample == (int)arrangement.size()) {
       arrangement.push_back(1); // new table
     } else {
@@ -22,27 +22,36 @@
 // only for debugging
 #include <iostream>
 #include "libplump/utils.h"
+#include "libplump/random.h"
 
 namespace gatsby { namespace libplump {
 
 ////////////////////////////////////////////////////////////////////////////////
 //        PYP SAMPLING FUNCTIONS FOR GENERATING SEATING ARRANGEMENTS          //
+//                                                                            //
+// All functions draw from rng, which defaults to the RNG of the calling      //
+// thread (see current_rng()).                                                //
 ////////////////////////////////////////////////////////////////////////////////
 
-std::vector<int> sample_crp_z_fb(double d, int c, int t);
+std::vector<int> sample_crp_z_fb(double d, int c, int t, 
+                                 gsl_rng* rng = current_rng());
 
-std::vector<int> sample_crp_z_bf(double d, int c, int t);
+std::vector<int> sample_crp_z_bf(double d, int c, int t,
+                                 gsl_rng* rng = current_rng());
 
-std::vector<int> sample_crp_given_z(double d, std::vector<int>& z);
+std::vector<int> sample_crp_given_z(double d, std::vector<int>& z,
+                                    gsl_rng* rng = current_rng());
 
-inline std::vector<int> sample_crp_ct_fb(double d, int c, int t) {
-  std::vector<int> z = sample_crp_z_fb(d, c, t);
-  return sample_crp_given_z(d, z);
+inline std::vector<int> sample_crp_ct_fb(double d, int c, int t,
+                                         gsl_rng* rng = current_rng()) {
+  std::vector<int> z = sample_crp_z_fb(d, c, t, rng);
+  return sample_crp_given_z(d, z, rng);
 }
 
-inline std::vector<int> sample_crp_ct_bf(double d, int c, int t) {
-  std::vector<int> z = sample_crp_z_bf(d, c, t);
-  return sample_crp_given_z(d, z);
+inline std::vector<int> sample_crp_ct_bf(double d, int c, int t,
+                                         gsl_rng* rng = current_rng()) {
+  std::vector<int> z = sample_crp_z_bf(d, c, t, rng);
+  return sample_crp_given_z(d, z, rng);
 }
 
 /**
@@ -53,8 +62,9 @@ inline std::vector<int> sample_crp_ct_bf(double d, int c, int t) {
  * 
  * Runtime: O(c x t)
  */
-inline std::vector<int> sample_crp_ct(double d, int c, int t) {
-  return sample_crp_ct_bf(d, c, t);
+inline std::vector<int> sample_crp_ct(double d, int c, int t,
+                                      gsl_rng* rng = current_rng()) {
+  return sample_crp_ct_bf(d, c, t, rng);
 }
 
 /**
@@ -64,7 +74,8 @@ inline std::vector<int> sample_crp_ct(double d, int c, int t) {
  * @returns A vector that contains an element for each table in the arrangement
  *          whose value is the number of customers at that table.
  */
-std::vector<int> sample_crp_c(double d, double a, int c);
+std::vector<int> sample_crp_c(double d, double a, int c,
+                              gsl_rng* rng = current_rng());
 
 }} // namespace gatsby::libplump
 
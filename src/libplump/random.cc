@@ -16,25 +16,264 @@
 
 #include "libplump/random.h"
 
+#include <stdint.h>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/thread/tss.hpp>
 #include <gsl/gsl_rng.h>
 
 namespace gatsby { namespace libplump {
 
 gsl_rng* global_rng = 0;
 
+__thread gsl_rng* thread_rng = 0;
+
 void init_rng() {
        const gsl_rng_type * T;
        gsl_rng_env_setup();
      
        T = gsl_rng_default;
        global_rng = gsl_rng_alloc (T);
+       thread_rng = global_rng;
 }
 
 /**
  * Free the global RNG.
  */
 void free_rng() {
+       if (thread_rng == global_rng) {
+         thread_rng = 0;
+       }
        gsl_rng_free (global_rng);
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+////////////   Philox4x32-10 as a GSL generator type   /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+/**
+ * State of a Philox4x32-10 stream: the counter consists of the position
+ * within the stream (words 0 and 1) and the stream id (words 2 and 3).
+ * out holds the block for the previous counter, of which the words from 
+ * next on have not been returned yet.
+ */
+struct philox_state {
+  uint32_t key[2];
+  uint32_t counter[4];
+  uint32_t out[4];
+  int next;
+};
+
+inline void philox_round(uint32_t* counter, const uint32_t* key) {
+  uint64_t product0 = (uint64_t)0xD2511F53 * counter[0];
+  uint64_t product1 = (uint64_t)0xCD9E8D57 * counter[2];
+  uint32_t hi0 = product0 >> 32, lo0 = (uint32_t)product0;
+  uint32_t hi1 = product1 >> 32, lo1 = (uint32_t)product1;
+  counter[0] = hi1 ^ counter[1] ^ key[0];
+  counter[1] = lo1;
+  counter[2] = hi0 ^ counter[3] ^ key[1];
+  counter[3] = lo0;
+}
+
+void philox_block(const philox_state* state, uint32_t* out) {
+  uint32_t key[2] = {state->key[0], state->key[1]};
+  std::copy(state->counter, state->counter + 4, out);
+  for (int i = 0; i < 10; ++i) {
+    if (i > 0) {
+      key[0] += 0x9E3779B9;
+      key[1] += 0xBB67AE85;
+    }
+    philox_round(out, key);
+  }
+}
+
+void philox_set(void* vstate, unsigned long int seed) {
+  philox_state* state = (philox_state*)vstate;
+  uint64_t seed64 = seed;
+  state->key[0] = (uint32_t)seed64;
+  state->key[1] = (uint32_t)(seed64 >> 32);
+  std::fill(state->counter, state->counter + 4, 0);
+  state->next = 4;
+}
+
+unsigned long int philox_get(void* vstate) {
+  philox_state* state = (philox_state*)vstate;
+  if (state->next == 4) {
+    philox_block(state, state->out);
+    if (++state->counter[0] == 0) {
+      ++state->counter[1];
+    }
+    state->next = 0;
+  }
+  return state->out[state->next++];
+}
+
+double philox_get_double(void* vstate) {
+  return philox_get(vstate) / 4294967296.0;
+}
+
+const gsl_rng_type philox4x32_type = {
+  "philox4x32",       // name
+  0xffffffffUL,       // max
+  0,                  // min
+  sizeof(philox_state),
+  &philox_set,
+  &philox_get,
+  &philox_get_double
+};
+
+uint64_t get_stream_id(const philox_state* state) {
+  return ((uint64_t)state->counter[3] << 32) | state->counter[2];
+}
+
+/**
+ * Map the id of a parent stream and the index of a child stream to the id
+ * of the child stream (using the SplitMix64 finalizer).
+ */
+uint64_t derive_stream_id(uint64_t parent, uint64_t stream) {
+  uint64_t z = parent + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// owns the default RNGs of threads other than the one that called init_rng 
+boost::thread_specific_ptr<RngContext> default_thread_rng_owner;
+boost::atomic<unsigned long> num_default_thread_rngs(0);
+
+} // namespace
+
+const gsl_rng_type* rng_philox4x32 = &philox4x32_type;
+
+
+RngContext::RngContext(unsigned long seed) 
+    : rng(gsl_rng_alloc(rng_philox4x32)) {
+  gsl_rng_set(this->rng, seed);
+}
+
+
+RngContext::RngContext(const RngContext& parent, unsigned long stream)
+    : rng(gsl_rng_alloc(rng_philox4x32)) {
+  const philox_state* parentState = (const philox_state*)parent.rng->state;
+  philox_state* state = (philox_state*)this->rng->state;
+  std::copy(parentState->key, parentState->key + 2, state->key);
+  uint64_t id = derive_stream_id(get_stream_id(parentState), stream);
+  state->counter[0] = 0;
+  state->counter[1] = 0;
+  state->counter[2] = (uint32_t)id;
+  state->counter[3] = (uint32_t)(id >> 32);
+  state->next = 4;
+}
+
+
+RngContext::~RngContext() {
+  gsl_rng_free(this->rng);
+}
+
+
+gsl_rng* default_thread_rng() {
+  if (default_thread_rng_owner.get() == NULL) {
+    static RngContext threadRoot(gsl_rng_default_seed);
+    default_thread_rng_owner.reset(
+        new RngContext(threadRoot, ++num_default_thread_rngs));
+  }
+  return default_thread_rng_owner->get();
+}
+
+
+ThreadRngScope::ThreadRngScope(gsl_rng* rng) : previous(thread_rng) {
+  thread_rng = rng;
+}
+
+
+ThreadRngScope::ThreadRngScope(const RngContext& rng) : previous(thread_rng) {
+  thread_rng = rng.get();
+}
+
+
+ThreadRngScope::~ThreadRngScope() {
+  thread_rng = previous;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+////////////   AliasSampler   //////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+AliasSampler::AliasSampler(const std::vector<double>& pdf) {
+  this->reset(pdf);
+}
+
+
+void AliasSampler::reset(const std::vector<double>& pdf) {
+  assert(pdf.size() > 0);
+  this->reset(&pdf[0], pdf.size());
+}
+
+
+void AliasSampler::reset(const double* pdf, int n) {
+  assert(n > 0);
+  double total = 0;
+  for (int i = 0; i < n; ++i) {
+    assert(pdf[i] >= 0);
+    total += pdf[i];
+  }
+  assert(total > 0);
+
+  // scale so that the average bucket has mass 1 and split the outcomes into
+  // those below and those at or above the average
+  this->probability.resize(n);
+  this->alias.resize(n);
+  this->small.clear();
+  this->large.clear();
+  for (int i = 0; i < n; ++i) {
+    this->probability[i] = pdf[i] * n / total;
+    this->alias[i] = i;
+    if (this->probability[i] < 1) {
+      this->small.push_back(i);
+    } else {
+      this->large.push_back(i);
+    }
+  }
+
+  // fill up each small bucket with mass from a large one
+  while (!this->small.empty() && !this->large.empty()) {
+    int s = this->small.back();
+    int l = this->large.back();
+    this->small.pop_back();
+    this->alias[s] = l;
+    this->probability[l] -= 1 - this->probability[s];
+    if (this->probability[l] < 1) {
+      this->large.pop_back();
+      this->small.push_back(l);
+    }
+  }
+
+  // whatever is left is full up to rounding error
+  for (size_t i = 0; i < this->small.size(); ++i) {
+    this->probability[this->small[i]] = 1;
+  }
+  for (size_t i = 0; i < this->large.size(); ++i) {
+    this->probability[this->large[i]] = 1;
+  }
+}
+
+
+int AliasSampler::sample(gsl_rng* rng) const {
+  assert(!this->probability.empty());
+  int n = this->probability.size();
+  // the integer part of u selects the bucket, the fractional part decides
+  // between the bucket's outcome and its alias
+  double u = gsl_rng_uniform(rng) * n;
+  int bucket = std::min((int)u, n - 1);
+  if (u - bucket < this->probability[bucket]) {
+    return bucket;
+  }
+  return this->alias[bucket];
+}
+
 }}
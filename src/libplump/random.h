@@ -37,7 +37,8 @@ namespace gatsby { namespace libplump {
  * This function has to be called before using any of the sampling functions.
  *
  * The RNG type and seed are determined by the environment variables
- * GSL_RNG_TYPE and GSL_RNG_SEED.
+ * GSL_RNG_TYPE and GSL_RNG_SEED. The global RNG becomes the default RNG of
+ * the calling thread. 
  */
 void init_rng();
 
@@ -46,15 +47,89 @@ void init_rng();
  */
 void free_rng();
 
+/**
+ * A seedable random number stream that can be split into independent 
+ * streams.
+ *
+ * The numbers are generated by the counter-based Philox4x32-10 generator:
+ * the i-th number of a stream is a function of the seed, the stream id and 
+ * i only. Streams derived from the same parent with different ids are 
+ * distinct blocks of the generator's counter space, so a computation that 
+ * assigns streams by task (rather than by thread) is reproducible for a
+ * fixed seed.
+ *
+ * The stream is exposed as a gsl_rng, so it can be used with all GSL
+ * functions and with the sampling functions below.
+ */
+class RngContext {
+  public:
+    /**
+     * Create stream 0 of the given seed.
+     */
+    explicit RngContext(unsigned long seed);
+
+    /**
+     * Create the stream with the given id derived from parent, starting at
+     * the beginning of the stream regardless of how much of parent has been
+     * used.
+     */
+    RngContext(const RngContext& parent, unsigned long stream);
+
+    ~RngContext();
+
+    gsl_rng* get() const {
+      return this->rng;
+    }
+
+  private:
+    // not copyable; use the stream constructor instead
+    RngContext(const RngContext&);
+    RngContext& operator=(const RngContext&);
+
+    gsl_rng* rng;
+};
+
+/**
+ * GSL generator type of the streams of RngContext.
+ */
+extern const gsl_rng_type* rng_philox4x32;
+
+/**
+ * Make the sampling functions called on the current thread draw from rng
+ * for the lifetime of this object. 
+ *
+ * This is used to give each thread of a parallel computation its own 
+ * random number stream.
+ */
+class ThreadRngScope {
+  public:
+    explicit ThreadRngScope(gsl_rng* rng);
+    explicit ThreadRngScope(const RngContext& rng);
+    ~ThreadRngScope();
+  private:
+    gsl_rng* previous;
+};
+
+/**
+ * Returns the RNG the sampling functions use on the current thread if they
+ * are not passed one explicitly: the RNG set by the innermost ThreadRngScope
+ * if there is one, and otherwise the default RNG of the thread.
+ *
+ * The default RNG of the thread that called init_rng is the global RNG;
+ * every other thread gets its own stream (derived from GSL_RNG_SEED) when
+ * it first draws a random number.
+ */
+inline gsl_rng* current_rng();
+
 /**
  * Returns true with probability true_prob.
  */
-bool coin(double true_prob);
+bool coin(double true_prob, gsl_rng* rng = current_rng());
 
 /**
  * Returns a uniform integer between 0 and max-1.
  */
-long int uniform_int(long int max);
+long int uniform_int(long int max, gsl_rng* rng = current_rng());
 
 /**
  * Sample from a discrete distribution on 0,...,MAX with the given PDF.
@@ -65,15 +140,82 @@ long int uniform_int(long int max);
  * element end_pos is 1.
  *  
  * Algorithm:
- *   1) Compute CDF; normalizing constant Z = CDF[end_pos]
+ *   1) Compute normalizing constant Z = CDF[end_pos]
  *   2) Sample z ~ Uniform(0,Z)
- *   3) find the smallest element x of CDF that is larger than i using binary
- *      search
+ *   3) find the smallest x with CDF[x] >= z, accumulating the CDF again 
+ *      rather than storing it, so that no memory is allocated
  *   4) return x
  *
- * Complexity: O(log MAX)
+ * Complexity: O(end_pos)
+ */
+int sample_unnormalized_pdf(const std::vector<double>& pdf, 
+                            int end_pos = 0, 
+                            gsl_rng* rng = current_rng());
+
+#ifndef SWIG
+/**
+ * Sample from the discrete distribution on 0,...,n-1 with the unnormalized
+ * PDF pdf[0],...,pdf[n-1]. 
+ *
+ * Array version of the above for callers that keep the PDF in their own
+ * buffer; equivalent to sample_unnormalized_pdf(pdf, n-1) on a vector.
+ *
+ * Complexity: O(n)
+ */
+int sample_unnormalized_pdf(const double* pdf, int n,
+                            gsl_rng* rng = current_rng());
+#endif
+
+/**
+ * Sampler for repeated draws from the same discrete distribution using 
+ * Walker's alias method (with Vose's construction).
+ *
+ * Construction takes O(n) time; each sample takes O(1) time and a single 
+ * uniform random number. The tables are kept when reset() is called with
+ * a new distribution of at most the same size, so a sampler can be reused
+ * without reallocating.
  */
-int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos = 0);
+class AliasSampler {
+  public:
+    AliasSampler() {}
+
+    /**
+     * Build the tables for the unnormalized PDF pdf.
+     */
+    explicit AliasSampler(const std::vector<double>& pdf);
+
+    /**
+     * Rebuild the tables for the unnormalized PDF pdf.
+     */
+    void reset(const std::vector<double>& pdf);
+
+#ifndef SWIG
+    /**
+     * Rebuild the tables for the unnormalized PDF pdf[0],...,pdf[n-1].
+     */
+    void reset(const double* pdf, int n);
+#endif
+
+    /**
+     * Draw a sample from the distribution.
+     */
+    int sample(gsl_rng* rng = current_rng()) const;
+
+    /**
+     * Number of outcomes of the distribution.
+     */
+    int size() const {
+      return this->probability.size();
+    }
+
+  private:
+    // probability[i] is the probability of returning i (rather than 
+    // alias[i]) when bucket i is chosen
+    std::vector<double> probability;
+    std::vector<int> alias;
+    // scratch space for the construction
+    std::vector<int> small, large;
+};
 
 
 
@@ -84,18 +226,66 @@ int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos = 0);
 
 extern gsl_rng* global_rng;
 
+#ifndef SWIG
+// RNG of the current thread set by ThreadRngScope or current_rng, or NULL
+extern __thread gsl_rng* thread_rng;
+
+/**
+ * Create (on first use) and return the default RNG of a thread other than 
+ * the one that called init_rng.
+ */
+gsl_rng* default_thread_rng();
+
+inline gsl_rng* current_rng() {
+    if (thread_rng == NULL) {
+        thread_rng = default_thread_rng();
+    }
+    return thread_rng;
+}
+#endif
+
 /**
  * Returns true with probability true_prob.
  */
-inline bool coin(double true_prob) {
-    return (true_prob>gsl_rng_uniform(global_rng));
+inline bool coin(double true_prob, gsl_rng* rng) {
+    return (true_prob>gsl_rng_uniform(rng));
 }
 
 /**
  * Returns a uniform integer between 0 and max-1.
  */
-inline long int uniform_int(long int max) {
-    return gsl_rng_uniform_int(global_rng, max);
+inline long int uniform_int(long int max, gsl_rng* rng) {
+    return gsl_rng_uniform_int(rng, max);
+}
+
+inline int sample_unnormalized_pdf(const double* pdf, int n, gsl_rng* rng) {
+    assert(n > 0);
+
+    // normalizing constant Z = CDF[n-1]
+    double total = pdf[0];
+    for (int i = 1; i < n; ++i) {
+        assert(pdf[i] >= 0);
+        total += pdf[i];
+    }
+
+    assert(total > 0);
+
+    // sample z ~ Uniform(0,Z)
+    double z = gsl_rng_uniform_pos(rng)*total;
+
+    assert((z >= 0) && (z <= total));
+
+    // find the smallest x with CDF[x] >= z, recomputing the CDF in the same
+    // order of summation as above
+    double cdf = 0;
+    for (int x = 0; x < n - 1; ++x) {
+        cdf += pdf[x];
+        if (cdf >= z) {
+            assert(pdf[x] > 0);
+            return x;
+        }
+    }
+    return n - 1;
 }
 
 /**
@@ -105,17 +295,12 @@ inline long int uniform_int(long int max) {
  *   pdf[x] / (\sum_{i=0,...,end_pos} pdf[i])
  * i.e. pdf is normalized so that the sum of all elements up to and including
  * element end_pos is 1.
- *  
- * Algorithm:
- *   1) Compute CDF; normalizing constant Z = CDF[end_pos]
- *   2) Sample z ~ Uniform(0,Z)
- *   3) find the smallest element x of CDF that is larger than i using binary
- *      search
- *   4) return x
  *
- * Complexity: O(log MAX)
+ * Complexity: O(end_pos)
  */
-inline int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos) {
+inline int sample_unnormalized_pdf(const std::vector<double>& pdf, 
+                                   int end_pos, 
+                                   gsl_rng* rng) {
     assert(pdf.size() > 0);
     assert(end_pos < pdf.size());
     assert(end_pos >= 0);
@@ -124,30 +309,7 @@ inline int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos) {
     if (end_pos == 0) {
         end_pos = pdf.size()-1;
     }
-    
-    // compute CDF (inplace)
-    for (int i = 0; i < end_pos; ++i) {
-        assert(pdf[i] >= 0);
-        pdf[i+1] += pdf[i];
-    }
-
-    assert(pdf[end_pos] > 0);
-
-    // sample pos ~ Unigorm(0,Z)
-    double z = gsl_rng_uniform_pos(global_rng)*pdf[end_pos];
-
-    assert((z >= 0) && (z <= pdf[end_pos]));
-    
-    // Perform binary search for z using std::lower_bound.
-    // lower_bound(begin, end, x) returns the first element within [begin,end)
-    // that is equal or larger than x.
-    int x = std::lower_bound(pdf.begin(), pdf.begin() + end_pos + 1, z)
-         - pdf.begin();
-
-    assert(x == 0 || pdf[x-1] != pdf[x]);
-    assert(x < pdf.size());
-    return x;
-
+    return sample_unnormalized_pdf(&pdf[0], end_pos + 1, rng);
 }
 
 } } // namespace gatsby::libplump
@@ -16,9 +16,12 @@
 
 #include "libplump/serialization.h"
 
+#include <cassert>
 #include <vector>
 #include <stack>
 #include <map>
+#include <stdexcept>
+#include <boost/unordered_map.hpp>
 
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
@@ -31,25 +34,62 @@
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
 #include <iostream>
 #include <fstream>
 
 
 #include "libplump/node_manager.h"
+#include "libplump/tracking_node_manager.h"
 
 namespace io = boost::iostreams;
 
 namespace gatsby { namespace libplump {
 
-struct ContextTreeEdge {
-  ContextTreeEdge(INodeManager::NodeId id, e_type key, size_t parent) 
-    : id(id), key(key), parent(parent) {}
+/**
+ * Map from the start and end positions of the nodes loaded so far to their
+ * handles, used to find the nodes a delta archive refers to.
+ */
+class NodeIndex {
+  public:
+    typedef TrackingNodeManager::NodeKey Key;
 
-  INodeManager::NodeId id;
-  e_type key;
-  size_t parent;
+    void add(INodeManager::NodeId node, l_type start, l_type end) {
+      this->nodes[Key(start, end)] = node;
+    }
+
+    INodeManager::NodeId find(const Key& key) const {
+      Nodes::const_iterator it = this->nodes.find(key);
+      return (it != this->nodes.end()) ? it->second : NULL;
+    }
+
+    bool empty() const {
+      return this->nodes.empty();
+    }
+
+    void clear() {
+      this->nodes.clear();
+    }
+
+  private:
+    typedef boost::unordered_map<Key, INodeManager::NodeId> Nodes;
+    Nodes nodes;
 };
 
+
+namespace {
+
+/**
+ * Written in place of the number of payloads at the start of legacy 
+ * archives, which can never have this many payloads.
+ */
+const size_t STREAMING_MARKER = (size_t)-1;
+
+/**
+ * Written at the start of delta archives.
+ */
+const size_t DELTA_MARKER = (size_t)-2;
+
 class SerializedNode {
   public:
     SerializedNode() {}
@@ -58,6 +98,8 @@ class SerializedNode {
     l_type start;
     l_type end;
     e_type key;
+    // index of the parent in the vector of all nodes (legacy archives) or 
+    // depth of the node (streamed archives)
     size_t parent;
 
   private: 
@@ -73,39 +115,189 @@ class SerializedNode {
 };
 
 
-std::vector<void*> getSerializedNodeVector(const INodeManager& nm, 
-                                           std::vector<SerializedNode>& nodes){
+struct DFSEntry {
+  DFSEntry(INodeManager::NodeId id, e_type key, size_t depth) 
+    : id(id), key(key), depth(depth) {}
+
+  INodeManager::NodeId id;
+  e_type key;
+  size_t depth;
+};
+
+
+void writeChunk(const IPayloadFactory& factory, 
+                const std::vector<SerializedNode>& nodes,
+                const std::vector<void*>& payloads, 
+                OutArchive& oa) {
+  size_t size = nodes.size();
+  oa << size;
+  for (size_t i = 0; i < size; ++i) {
+    oa << nodes[i];
+    factory.save(payloads[i], oa);
+  }
+}
+
+
+Serializer::Compression detectCompression(std::istream& in) {
+  char magic[3] = {0, 0, 0};
+  in.read(magic, 3);
+  in.clear();
+  in.seekg(0);
+  if (magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h') {
+    return Serializer::BZIP2;
+  }
+  if ((unsigned char)magic[0] == 0x1f && (unsigned char)magic[1] == 0x8b) {
+    return Serializer::GZIP;
+  }
+  return Serializer::NONE;
+}
+
+
+void pushCompressor(io::filtering_streambuf<io::output>& out,
+                    Serializer::Compression compression) {
+  switch (compression) {
+    case Serializer::BZIP2: out.push(io::bzip2_compressor()); break;
+    case Serializer::GZIP: out.push(io::gzip_compressor()); break;
+    case Serializer::NONE: break;
+  }
+}
+
+
+/**
+ * Destroy all nodes below the root and give the root a fresh payload; the
+ * root itself is kept, as a ContextTree over nm holds on to its handle.
+ */
+void clearTree(INodeManager& nm, const IPayloadFactory& factory) {
+  INodeManager::NodeId root = nm.getRoot();
+  std::vector<std::pair<e_type, INodeManager::NodeId> > children;
+  INodeManager::ChildMap& childMap = nm.getChildren(root);
+  for (INodeManager::ChildMapIterator it = childMap.begin(); 
+       it != childMap.end(); ++it) {
+    children.push_back(*it);
+  }
+  for (size_t i = 0; i < children.size(); ++i) {
+    nm.removeChild(root, children[i].first);
+    nm.destroyNodeRecursive(children[i].second);
+  }
+  assert(nm.getRoot() == root && nm.getChildren(root).empty());
+  nm.setPayload(root, factory.make());
+}
+
+
+INodeManager::NodeId findNode(const NodeIndex& index, 
+                              const NodeIndex::Key& key) {
+  INodeManager::NodeId node = index.find(key);
+  if (node == NULL) {
+    throw std::runtime_error(
+        "Delta archive refers to a node that does not exist; "
+        "deltas must be applied to the checkpoint they were saved after");
+  }
+  return node;
+}
+
+} // namespace
+
+
+void Serializer::saveNodesAndPayloadsToArchive(
+    const INodeManager& nm, const IPayloadFactory& factory, OutArchive& oa) {
+  oa << STREAMING_MARKER;
+
+  std::vector<SerializedNode> nodes;
   std::vector<void*> payloads;
-  std::stack<ContextTreeEdge> stack;
-  nodes.push_back(SerializedNode(0,0,0,0));
-  payloads.push_back(nm.getPayload(nm.getRoot()));
-  INodeManager::ChildMap& rootChildren = nm.getChildren(nm.getRoot());
-  for (INodeManager::ChildMapIterator it = rootChildren.begin();
-       it != rootChildren.end();
-       ++it) {
-    stack.push(ContextTreeEdge((*it).second, (*it).first, 0));
-  }
-  while(!stack.empty()) {
-    ContextTreeEdge current = stack.top();
+  nodes.reserve(CHUNK_SIZE);
+  payloads.reserve(CHUNK_SIZE);
+
+  // depth first, so that the parent of each node is on the path from the 
+  // root to the previously written node
+  std::stack<DFSEntry> stack;
+  stack.push(DFSEntry(nm.getRoot(), 0, 0));
+  while (!stack.empty()) {
+    DFSEntry current = stack.top();
     stack.pop();
     nodes.push_back(SerializedNode(nm.getStart(current.id),
                                    nm.getEnd(current.id),
                                    current.key,
-                                   current.parent));
+                                   current.depth));
     payloads.push_back(nm.getPayload(current.id));
-    for (INodeManager::ChildMapIterator it = nm.getChildren(current.id).begin();
-         it != nm.getChildren(current.id).end();
+    if (nodes.size() == CHUNK_SIZE) {
+      writeChunk(factory, nodes, payloads, oa);
+      nodes.clear();
+      payloads.clear();
+    }
+    INodeManager::ChildMap& children = nm.getChildren(current.id);
+    for (INodeManager::ChildMapIterator it = children.begin();
+         it != children.end();
          ++it) {
-      stack.push(ContextTreeEdge( (*it).second, (*it).first, nodes.size()-1));
+      stack.push(DFSEntry((*it).second, (*it).first, current.depth + 1));
     }
   }
-  return payloads;
+  if (!nodes.empty()) {
+    writeChunk(factory, nodes, payloads, oa);
+  }
+  size_t end = 0;
+  oa << end;
 }
 
 
-std::vector<INodeManager::NodeId> insertSerializedNodeVector(
-    INodeManager& nm, std::vector<SerializedNode>& nodes,
-    std::vector<void*> payloads) {
+void Serializer::loadNodesAndPayloadsFromArchive(
+    INodeManager& nm, const IPayloadFactory& factory, InArchive& ia,
+    NodeIndex* index) {
+  size_t marker;
+  ia >> marker;
+  if (marker == DELTA_MARKER) {
+    if (index == NULL) {
+      throw std::runtime_error("Cannot load a delta archive without a base");
+    }
+    applyChangesFromArchive(nm, factory, ia, *index);
+    return;
+  }
+  if (index != NULL && !index->empty()) {
+    // a full archive following the base replaces the whole tree
+    clearTree(nm, factory);
+    index->clear();
+  }
+  if (marker != STREAMING_MARKER) {
+    loadLegacyNodesAndPayloadsFromArchive(nm, factory, ia, marker, index);
+    return;
+  }
+
+  // handles of the nodes on the path to the last node read
+  std::vector<INodeManager::NodeId> path;
+  SerializedNode node;
+  size_t size;
+  ia >> size;
+  while (size != 0) {
+    for (size_t i = 0; i < size; ++i) {
+      ia >> node;
+      void* payload = factory.load(ia);
+      if (node.parent == 0) {
+        path.assign(1, nm.getRoot());
+        nm.setPayload(path[0], payload);
+      } else {
+        assert(node.parent <= path.size());
+        path.resize(node.parent);
+        path.push_back(nm.setChild(path.back(), node.key, node.start, 
+                                   node.end, payload));
+      }
+      if (index != NULL) {
+        index->add(path.back(), node.start, node.end);
+      }
+    }
+    ia >> size;
+  }
+}
+
+
+void Serializer::loadLegacyNodesAndPayloadsFromArchive(
+    INodeManager& nm, const IPayloadFactory& factory, InArchive& ia,
+    size_t numPayloads, NodeIndex* index) {
+  std::vector<void*> payloads(numPayloads, NULL);
+  for (size_t i = 0; i < numPayloads; ++i) {
+    payloads[i] = factory.load(ia);
+  }
+  std::vector<SerializedNode> nodes;
+  ia >> nodes;
+
   std::vector<INodeManager::NodeId> handles(nodes.size(), NULL);
   handles[0] = nm.getRoot();
   nm.setPayload(handles[0], payloads[0]);
@@ -116,63 +308,86 @@ std::vector<INodeManager::NodeId> insertSerializedNodeVector(
                              nodes[i].end, 
                              payloads[i]);
   }
-  return handles;
-}
-
-
-std::vector<void*> Serializer::saveNodesToArchive(
-    const INodeManager& nm, OutArchive& oa) {
-
-  // serialize to file
-  std::vector<SerializedNode> nodes;
-  std::vector<void*> payloads = getSerializedNodeVector(nm, nodes);
-  oa << nodes;
-  return payloads;
+  if (index != NULL) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      index->add(handles[i], nodes[i].start, nodes[i].end);
+    }
+  }
 }
 
-void Serializer::saveNodesAndPayloadsToArchive(
-    const INodeManager& nm, const IPayloadFactory& factory, OutArchive& oa) {
-  std::vector<SerializedNode> nodes;
-  std::vector<void*> payloads = getSerializedNodeVector(nm, nodes);
-  savePayloadsToArchive(factory, payloads, oa);
-  oa << nodes;
-}
 
-void Serializer::loadNodesAndPayloadsFromArchive(
-    INodeManager& nm, const IPayloadFactory& factory, InArchive& ia) {
-  std::vector<void*> payloads = loadPayloadsFromArchive(factory, ia);
-  std::vector<SerializedNode> nodes;
-  ia >> nodes;
-  insertSerializedNodeVector(nm, nodes, payloads);
-}
+void Serializer::saveChangesToArchive(const TrackingNodeManager& nm,
+                                      const IPayloadFactory& factory,
+                                      OutArchive& oa) {
+  if (nm.isAllModified()) {
+    saveNodesAndPayloadsToArchive(nm, factory, oa);
+    return;
+  }
+  oa << DELTA_MARKER;
+
+  typedef TrackingNodeManager::StructureChange StructureChange;
+  const std::vector<StructureChange>& changes = nm.getStructureChanges();
+  size_t numChanges = changes.size();
+  oa << numChanges;
+  for (size_t i = 0; i < numChanges; ++i) {
+    int type = changes[i].type;
+    oa << type;
+    oa << changes[i].parent.first << changes[i].parent.second;
+    oa << changes[i].key;
+    oa << changes[i].node.first << changes[i].node.second;
+    oa << changes[i].newKey;
+  }
 
-void Serializer::loadNodesFromArchive(INodeManager& nm,
-                                      std::vector<void*> payloads,
-                                      InArchive& ia) {
-  std::vector<SerializedNode> nodes;
-  ia >> nodes;
-  insertSerializedNodeVector(nm, nodes, payloads);
+  const TrackingNodeManager::ModifiedMap& modified = nm.getModified();
+  size_t numModified = modified.size();
+  oa << numModified;
+  for (TrackingNodeManager::ModifiedMap::const_iterator it = modified.begin();
+       it != modified.end(); ++it) {
+    oa << it->first.first << it->first.second;
+    factory.save(it->second, oa);
+  }
 }
 
 
-std::vector<void*> Serializer::loadPayloadsFromArchive(
-    const IPayloadFactory& factory, InArchive& ia) {
-  size_t numPayloads; 
-  ia >> numPayloads;
-  std::vector<void*> payloads(numPayloads, NULL);
-  for (size_t i = 0; i < numPayloads; ++i) {
-    payloads[i] = factory.load(ia);
+void Serializer::applyChangesFromArchive(INodeManager& nm,
+                                         const IPayloadFactory& factory,
+                                         InArchive& ia,
+                                         NodeIndex& index) {
+  typedef TrackingNodeManager::StructureChange StructureChange;
+  // replay the structural changes in order, so that every node a change
+  // refers to exists when it is applied
+  size_t numChanges;
+  ia >> numChanges;
+  for (size_t i = 0; i < numChanges; ++i) {
+    int type;
+    NodeIndex::Key parent, node;
+    e_type key, newKey;
+    ia >> type;
+    ia >> parent.first >> parent.second;
+    ia >> key;
+    ia >> node.first >> node.second;
+    ia >> newKey;
+    if (index.find(node) != NULL) {
+      continue; // already applied by an earlier delta
+    }
+    INodeManager::NodeId parentId = findNode(index, parent);
+    INodeManager::NodeId nodeId;
+    if (type == StructureChange::SET_CHILD) {
+      nodeId = nm.setChild(parentId, key, node.first, node.second);
+    } else {
+      nodeId = nm.insertBetween(parentId, key, node.first, node.second, 
+                                newKey);
+    }
+    index.add(nodeId, node.first, node.second);
   }
-  return payloads;
-}
 
-void Serializer::savePayloadsToArchive(
-    const IPayloadFactory& factory, std::vector<void*> voidPayloads, 
-    OutArchive& oa) {
-  size_t size = voidPayloads.size();
-  oa << size;
-  for (size_t i = 0; i < voidPayloads.size(); ++i) {
-    factory.save(voidPayloads[i], oa);
+  size_t numModified;
+  ia >> numModified;
+  for (size_t i = 0; i < numModified; ++i) {
+    NodeIndex::Key node;
+    ia >> node.first >> node.second;
+    void* payload = factory.load(ia);
+    nm.setPayload(findNode(index, node), payload);
   }
 }
 
@@ -182,7 +397,7 @@ void Serializer::saveNodesAndPayloads(const INodeManager& nodeManager,
   std::ofstream archiveFileStream(this->filename.c_str(),
                                   std::ios::out | std::ios::binary);
   io::filtering_streambuf<io::output> out;
-  out.push(io::bzip2_compressor());
+  pushCompressor(out, this->compression);
   out.push(archiveFileStream);
   std::ostream nodeStream(&out);
 
@@ -191,13 +406,32 @@ void Serializer::saveNodesAndPayloads(const INodeManager& nodeManager,
 }
 
 
-void Serializer::loadNodesAndPayloads(INodeManager& nodeManager,
-                                      const IPayloadFactory& factory) {
-  
-  std::ifstream archiveFileStream(this->filename.c_str(),
+void Serializer::saveChanges(const TrackingNodeManager& nodeManager,
+                             const IPayloadFactory& factory) {
+  std::ofstream archiveFileStream(this->filename.c_str(),
+                                  std::ios::out | std::ios::binary);
+  io::filtering_streambuf<io::output> out;
+  pushCompressor(out, this->compression);
+  out.push(archiveFileStream);
+  std::ostream nodeStream(&out);
+
+  OutArchive nodeArchive(nodeStream);
+  Serializer::saveChangesToArchive(nodeManager, factory, nodeArchive);
+}
+
+
+void Serializer::loadFile(const std::string& filename,
+                          INodeManager& nodeManager,
+                          const IPayloadFactory& factory,
+                          NodeIndex* index) {
+  std::ifstream archiveFileStream(filename.c_str(),
                                   std::ios::in | std::ios::binary);
   io::filtering_streambuf<io::input> in;
-  in.push(io::bzip2_decompressor());
+  switch (detectCompression(archiveFileStream)) {
+    case BZIP2: in.push(io::bzip2_decompressor()); break;
+    case GZIP: in.push(io::gzip_decompressor()); break;
+    case NONE: break;
+  }
   in.push(archiveFileStream);
   std::istream nodeStream(&in);
   
@@ -205,7 +439,25 @@ void Serializer::loadNodesAndPayloads(INodeManager& nodeManager,
 
   Serializer::loadNodesAndPayloadsFromArchive(nodeManager,
                                               factory,
-                                              nodeArchive);
+                                              nodeArchive,
+                                              index);
+}
+
+
+void Serializer::loadNodesAndPayloads(INodeManager& nodeManager,
+                                      const IPayloadFactory& factory) {
+  Serializer::loadFile(this->filename, nodeManager, factory, NULL);
+}
+
+
+void Serializer::loadNodesAndPayloads(
+    INodeManager& nodeManager, const IPayloadFactory& factory,
+    const std::vector<std::string>& deltaFilenames) {
+  NodeIndex index;
+  Serializer::loadFile(this->filename, nodeManager, factory, &index);
+  for (size_t i = 0; i < deltaFilenames.size(); ++i) {
+    Serializer::loadFile(deltaFilenames[i], nodeManager, factory, &index);
+  }
 }
 
 }}
@@ -17,6 +17,9 @@
 #ifndef SERIALIZATION_H_
 #define SERIALIZATION_H_
 
+#include <string>
+#include <vector>
+
 #include "libplump/config.h"
 
 namespace boost { namespace archive {
@@ -32,12 +35,38 @@ typedef boost::archive::binary_oarchive OutArchive;
 
 class INodeManager;
 class IPayloadFactory;
+class TrackingNodeManager;
+class NodeIndex;
 
 
+/**
+ * Saves and loads the nodes of a context tree together with their payloads.
+ *
+ * Nodes are written in depth first order in chunks of CHUNK_SIZE nodes, 
+ * each node followed by its payload, so that saving and loading only need
+ * memory for one chunk and the current path in the tree, independent of
+ * the size of the tree. Archives written by earlier versions (all payloads
+ * followed by a vector of all nodes) can still be loaded.
+ *
+ * The archive is compressed with the given boost::iostreams filter; the
+ * compression used is detected automatically when loading.
+ *
+ * A delta archive written by saveChanges only contains the nodes created 
+ * and the payloads changed since the changes recorded by a 
+ * TrackingNodeManager were last cleared. It is applied by loading the base
+ * archive together with all deltas written after it, in order.
+ */
 class Serializer {
   public:
-    Serializer(std::string filename) 
-        : filename(filename) {}
+    enum Compression {NONE, BZIP2, GZIP};
+
+    /**
+     * Number of nodes written per chunk.
+     */
+    static const size_t CHUNK_SIZE = 4096;
+
+    Serializer(std::string filename, Compression compression = BZIP2) 
+        : filename(filename), compression(compression) {}
 
     
     void saveNodesAndPayloads(const INodeManager& nm,
@@ -46,31 +75,51 @@ class Serializer {
     void loadNodesAndPayloads(INodeManager& nm,
                               const IPayloadFactory& factory);
 
+    /**
+     * Save the changes recorded by nm as a delta archive, or the whole
+     * tree if all nodes have been marked as modified. The recorded changes
+     * are not cleared.
+     */
+    void saveChanges(const TrackingNodeManager& nm,
+                     const IPayloadFactory& factory);
+
+    /**
+     * Load the base archive and then apply the given delta archives in 
+     * order. A delta may also be a full archive (written by saveChanges
+     * after markAllModified), which replaces the tree loaded so far.
+     */
+    void loadNodesAndPayloads(INodeManager& nm,
+                              const IPayloadFactory& factory,
+                              const std::vector<std::string>& deltaFilenames);
+
   private:
     static void loadNodesAndPayloadsFromArchive(INodeManager& nm,
                                                 const IPayloadFactory& factory,
-                                                InArchive& ia);
+                                                InArchive& ia,
+                                                NodeIndex* index);
 
-    static std::vector<void*> saveNodesToArchive(const INodeManager& nodeManager,
-                                                 OutArchive& oa);
+    static void loadLegacyNodesAndPayloadsFromArchive(
+        INodeManager& nm, const IPayloadFactory& factory, InArchive& ia,
+        size_t numPayloads, NodeIndex* index);
 
-    static void loadNodesFromArchive(INodeManager& nodeManager,
-                                     std::vector<void*> payloads,
-                                     InArchive& ia);
+    static void applyChangesFromArchive(INodeManager& nm,
+                                        const IPayloadFactory& factory,
+                                        InArchive& ia,
+                                        NodeIndex& index);
 
-    static std::vector<void*> loadPayloadsFromArchive(
-        const IPayloadFactory& factory, InArchive& ia);
+    static void saveChangesToArchive(const TrackingNodeManager& nm,
+                                     const IPayloadFactory& factory,
+                                     OutArchive& oa);
 
+    static void loadFile(const std::string& filename, INodeManager& nm,
+                         const IPayloadFactory& factory, NodeIndex* index);
 
-    static void savePayloadsToArchive(const IPayloadFactory& factory, 
-                                      std::vector<void*> voidPayloads,
-                                      OutArchive& oa);
-    
     static void saveNodesAndPayloadsToArchive(
         const INodeManager& nm, const IPayloadFactory& factory,
         OutArchive& oa);
 
     std::string filename;
+    Compression compression;
 };
 
 }} // namespace gatsby::libplump
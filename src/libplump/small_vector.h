@@ -0,0 +1,201 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SMALL_VECTOR_H_
+#define SMALL_VECTOR_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Vector that stores up to N elements inside the object itself and moves
+ * them to a heap block (grown by doubling) only when more are added.
+ *
+ * The elements are contiguous, so iterators are plain pointers. clear() and
+ * pop_back() keep the capacity, so that a vector that is reused across
+ * calls stops allocating once it has reached the largest size needed.
+ *
+ * Elements are never destroyed, so T has to be trivially destructible.
+ */
+template<class T, unsigned int N>
+class SmallVector {
+  public:
+    typedef T value_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    SmallVector() : data(this->localData()), _size(0), _capacity(N) {}
+
+    SmallVector(const SmallVector& other)
+        : data(this->localData()), _size(0), _capacity(N) {
+      this->assign(other.begin(), other.end());
+    }
+
+    SmallVector& operator=(const SmallVector& other) {
+      if (this != &other) {
+        this->assign(other.begin(), other.end());
+      }
+      return *this;
+    }
+
+    ~SmallVector() {
+      this->release();
+    }
+
+    iterator begin() { return this->data; }
+    const_iterator begin() const { return this->data; }
+    iterator end() { return this->data + this->_size; }
+    const_iterator end() const { return this->data + this->_size; }
+
+    reverse_iterator rbegin() { return reverse_iterator(this->end()); }
+    const_reverse_iterator rbegin() const {
+      return const_reverse_iterator(this->end());
+    }
+    reverse_iterator rend() { return reverse_iterator(this->begin()); }
+    const_reverse_iterator rend() const {
+      return const_reverse_iterator(this->begin());
+    }
+
+    size_type size() const { return this->_size; }
+    bool empty() const { return this->_size == 0; }
+    size_type capacity() const { return this->_capacity; }
+
+    reference operator[](size_type i) {
+      assert(i < this->_size);
+      return this->data[i];
+    }
+
+    const_reference operator[](size_type i) const {
+      assert(i < this->_size);
+      return this->data[i];
+    }
+
+    reference front() { return (*this)[0]; }
+    const_reference front() const { return (*this)[0]; }
+    reference back() { return (*this)[this->_size - 1]; }
+    const_reference back() const { return (*this)[this->_size - 1]; }
+
+    void push_back(const T& value) {
+      if (this->_size == this->_capacity) {
+        // value may be an element of this vector
+        T copy(value);
+        this->reserve(2 * this->_capacity);
+        new (this->data + this->_size) T(copy);
+      } else {
+        new (this->data + this->_size) T(value);
+      }
+      ++this->_size;
+    }
+
+    void pop_back() {
+      assert(this->_size > 0);
+      --this->_size;
+    }
+
+    void clear() {
+      this->_size = 0;
+    }
+
+    /**
+     * Resize to n elements; new elements are copies of value.
+     */
+    void resize(size_type n, const T& value = T()) {
+      this->reserve(n);
+      std::uninitialized_fill(this->data + this->_size, this->data + n,
+                              value);
+      this->_size = n;
+    }
+
+    /**
+     * Make room for at least n elements; never shrinks.
+     */
+    void reserve(size_type n) {
+      if (n <= this->_capacity) {
+        return;
+      }
+      T* block = static_cast<T*>(::operator new(n * sizeof(T)));
+      std::uninitialized_copy(this->data, this->data + this->_size, block);
+      this->release();
+      this->data = block;
+      this->_capacity = n;
+    }
+
+    /**
+     * Replace the contents with the elements in [first, last), which must
+     * not be part of this vector.
+     */
+    template<class ForwardIterator>
+    void assign(ForwardIterator first, ForwardIterator last) {
+      size_type n = std::distance(first, last);
+      this->_size = 0;
+      this->reserve(n);
+      std::uninitialized_copy(first, last, this->data);
+      this->_size = n;
+    }
+
+    void swap(SmallVector& other) {
+      if (!this->isLocal() && !other.isLocal()) {
+        std::swap(this->data, other.data);
+        std::swap(this->_size, other._size);
+        std::swap(this->_capacity, other._capacity);
+      } else {
+        SmallVector tmp(*this);
+        *this = other;
+        other = tmp;
+      }
+    }
+
+  private:
+    typedef typename boost::aligned_storage<
+        N * sizeof(T), boost::alignment_of<T>::value>::type Storage;
+
+    T* data;
+    size_type _size;
+    size_type _capacity;
+    Storage local;
+
+    T* localData() {
+      return reinterpret_cast<T*>(&this->local);
+    }
+
+    bool isLocal() const {
+      return this->data == reinterpret_cast<const T*>(&this->local);
+    }
+
+    void release() {
+      if (!this->isLocal()) {
+        ::operator delete(this->data);
+      }
+    }
+};
+
+}} // namespace gatsby::libplump
+
+#endif /* SMALL_VECTOR_H_ */
@@ -0,0 +1,523 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <stack>
+#include <stdexcept>
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "libplump/hpyp_restaurants.h" // for computeHPYPPredictive
+
+namespace gatsby { namespace libplump {
+
+namespace io = boost::iostreams;
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'P', 'L', 'U', 'M', 'P', 'S', 'N', 'P'};
+
+uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+size_t countNodes(const INodeManager& nm) {
+  size_t numNodes = 0;
+  std::stack<INodeManager::NodeId> stack;
+  stack.push(nm.getRoot());
+  while (!stack.empty()) {
+    INodeManager::NodeId node = stack.top();
+    stack.pop();
+    ++numNodes;
+    INodeManager::ChildMap& children = nm.getChildren(node);
+    for (INodeManager::ChildMapIterator it = children.begin();
+         it != children.end(); ++it) {
+      stack.push((*it).second);
+    }
+  }
+  return numNodes;
+}
+
+template<typename T>
+void writeArray(std::ofstream& out, uint64_t offset, const std::vector<T>& a) {
+  out.seekp(offset);
+  out.write((const char*)&a[0], a.size() * sizeof(T));
+}
+
+/**
+ * Append the counts of the restaurant in payload to out; returns the 
+ * number of bytes written.
+ */
+size_t writeCounts(std::ofstream& out, 
+                   const IHPYPBaseRestaurant& restaurant, 
+                   void* payload) {
+  std::vector<int32_t> types, customers, tables;
+  int32_t header[3] = {0, 0, 0};
+  if (payload != NULL) {
+    IHPYPBaseRestaurant::TypeVector present = 
+        restaurant.getTypeVector(payload);
+    std::sort(present.begin(), present.end());
+    for (size_t i = 0; i < present.size(); ++i) {
+      l_type cw = restaurant.getC(payload, present[i]);
+      if (cw > 0) {
+        types.push_back(present[i]);
+        customers.push_back(cw);
+        tables.push_back(restaurant.getT(payload, present[i]));
+      }
+    }
+    header[0] = restaurant.getC(payload);
+    header[1] = restaurant.getT(payload);
+    header[2] = types.size();
+  }
+  out.write((const char*)header, sizeof(header));
+  if (!types.empty()) {
+    out.write((const char*)&types[0], types.size() * sizeof(int32_t));
+    out.write((const char*)&customers[0], customers.size() * sizeof(int32_t));
+    out.write((const char*)&tables[0], tables.size() * sizeof(int32_t));
+  }
+  return PackedCounts::bytes(types.size());
+}
+
+void checkRange(uint64_t offset, uint64_t size, uint64_t fileSize) {
+  if (offset > fileSize || size > fileSize - offset) {
+    throw std::runtime_error("snapshot file is truncated");
+  }
+}
+
+} // namespace
+
+
+int PackedCounts::find(e_type type) const {
+  const int32_t* begin = this->types();
+  const int32_t* end = begin + numTypes;
+  const int32_t* pos = std::lower_bound(begin, end, type);
+  if (pos != end && *pos == type) {
+    return pos - begin;
+  }
+  return -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////   SNAPSHOT   /////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+Snapshot::Snapshot(const std::string& fileName) 
+    : mapping(new io::mapped_file_source(fileName)) {
+  const char* data = this->mapping->data();
+  uint64_t fileSize = this->mapping->size();
+  if (fileSize < sizeof(SnapshotHeader)) {
+    throw std::runtime_error("not a snapshot file");
+  }
+  this->header = (const SnapshotHeader*)data;
+  if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+    throw std::runtime_error("not a snapshot file");
+  }
+  if (header->version != VERSION || 
+      header->headerSize != sizeof(SnapshotHeader)) {
+    throw std::runtime_error("unsupported snapshot version");
+  }
+  if (header->byteOrder != BYTE_ORDER_MARK) {
+    throw std::runtime_error("snapshot was written with a different byte order");
+  }
+  uint64_t n = header->numNodes;
+  if (n == 0 || n > UINT32_MAX) {
+    throw std::runtime_error("invalid number of nodes in snapshot");
+  }
+  checkRange(header->startOffset, n * sizeof(int32_t), fileSize);
+  checkRange(header->endOffset, n * sizeof(int32_t), fileSize);
+  checkRange(header->firstChildOffset, (n + 1) * sizeof(uint32_t), fileSize);
+  checkRange(header->keyOffset, n * sizeof(int32_t), fileSize);
+  checkRange(header->payloadOffset, n * sizeof(uint64_t), fileSize);
+  checkRange(header->payloadsOffset, header->payloadsSize, fileSize);
+
+  this->starts = (const int32_t*)(data + header->startOffset);
+  this->ends = (const int32_t*)(data + header->endOffset);
+  this->firstChildren = (const uint32_t*)(data + header->firstChildOffset);
+  this->keys = (const int32_t*)(data + header->keyOffset);
+  this->payloadOffsets = (const uint64_t*)(data + header->payloadOffset);
+  this->payloads = data + header->payloadsOffset;
+
+  // the children of each node follow it, so that the tree has no cycles
+  if (this->firstChildren[0] != 1 || this->firstChildren[n] != n) {
+    throw std::runtime_error("invalid child index in snapshot");
+  }
+  for (uint64_t i = 0; i < n; ++i) {
+    if (this->firstChildren[i] <= i 
+        || this->firstChildren[i] > this->firstChildren[i + 1]) {
+      throw std::runtime_error("invalid child index in snapshot");
+    }
+  }
+  for (uint64_t i = 0; i < n; ++i) {
+    uint64_t offset = this->payloadOffsets[i];
+    if (offset % sizeof(int32_t) != 0 || offset > header->payloadsSize
+        || header->payloadsSize - offset < sizeof(PackedCounts)) {
+      throw std::runtime_error("invalid payload offset in snapshot");
+    }
+  }
+}
+
+
+Snapshot::~Snapshot() {}
+
+
+void Snapshot::save(const std::string& fileName, 
+                    const INodeManager& nm,
+                    const IHPYPBaseRestaurant& restaurant) {
+  if (!restaurant.predictsFromCounts()) {
+    throw std::runtime_error(
+        "snapshots only support restaurants that predict from their counts");
+  }
+  const std::string tempName = fileName + ".tmp";
+  try {
+    writeSnapshot(tempName, nm, restaurant);
+    boost::filesystem::rename(tempName, fileName);
+  } catch (...) {
+    boost::system::error_code ignored;
+    boost::filesystem::remove(tempName, ignored);
+    throw;
+  }
+}
+
+
+void Snapshot::writeSnapshot(const std::string& fileName, 
+                             const INodeManager& nm,
+                             const IHPYPBaseRestaurant& restaurant) {
+  const size_t numNodes = countNodes(nm);
+  assert(numNodes <= UINT32_MAX);
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = VERSION;
+  header.headerSize = sizeof(SnapshotHeader);
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.numNodes = numNodes;
+  header.startOffset = align8(sizeof(SnapshotHeader));
+  header.endOffset = align8(header.startOffset + numNodes * sizeof(int32_t));
+  header.firstChildOffset = 
+      align8(header.endOffset + numNodes * sizeof(int32_t));
+  header.keyOffset = 
+      align8(header.firstChildOffset + (numNodes + 1) * sizeof(uint32_t));
+  header.payloadOffset = align8(header.keyOffset + numNodes * sizeof(int32_t));
+  header.payloadsOffset = 
+      align8(header.payloadOffset + numNodes * sizeof(uint64_t));
+
+  std::vector<int32_t> starts(numNodes), ends(numNodes), keys(numNodes, 0);
+  std::vector<uint32_t> firstChildren(numNodes + 1);
+  std::vector<uint64_t> payloadOffsets(numNodes);
+
+  std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+  if (!out) {
+    throw std::runtime_error("could not open " + fileName + " for writing");
+  }
+  out.seekp(header.payloadsOffset);
+
+  // breadth first: nodes are dequeued in the order of their indices
+  std::deque<INodeManager::NodeId> queue;
+  std::vector<std::pair<e_type, INodeManager::NodeId> > children;
+  queue.push_back(nm.getRoot());
+  size_t next = 1;
+  uint64_t payloadsSize = 0;
+  for (size_t i = 0; i < numNodes; ++i) {
+    INodeManager::NodeId node = queue.front();
+    queue.pop_front();
+    starts[i] = nm.getStart(node);
+    ends[i] = nm.getEnd(node);
+    payloadOffsets[i] = payloadsSize;
+    payloadsSize += writeCounts(out, restaurant, nm.getPayload(node));
+
+    INodeManager::ChildMap& childMap = nm.getChildren(node);
+    children.clear();
+    for (INodeManager::ChildMapIterator it = childMap.begin();
+         it != childMap.end(); ++it) {
+      children.push_back(*it);
+    }
+    std::sort(children.begin(), children.end());
+    firstChildren[i] = next;
+    for (size_t c = 0; c < children.size(); ++c) {
+      keys[next++] = children[c].first;
+      queue.push_back(children[c].second);
+    }
+  }
+  assert(next == numNodes && queue.empty());
+  firstChildren[numNodes] = next;
+  header.payloadsSize = payloadsSize;
+
+  writeArray(out, header.startOffset, starts);
+  writeArray(out, header.endOffset, ends);
+  writeArray(out, header.firstChildOffset, firstChildren);
+  writeArray(out, header.keyOffset, keys);
+  writeArray(out, header.payloadOffset, payloadOffsets);
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  out.close();
+  if (!out) {
+    throw std::runtime_error("could not write snapshot to " + fileName);
+  }
+}
+
+
+size_t Snapshot::getChild(size_t node, e_type key) const {
+  const int32_t* begin = this->keys + this->firstChildren[node];
+  const int32_t* end = this->keys + this->firstChildren[node + 1];
+  const int32_t* pos = std::lower_bound(begin, end, key);
+  if (pos != end && *pos == key) {
+    return pos - this->keys;
+  }
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////   SNAPSHOT NODE MANAGER   ////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+INodeManager::NodeId SnapshotNodeManager::setChild(
+    NodeId node, e_type key, l_type start, l_type end, void* payload) {
+  assert(!"SnapshotNodeManager is read-only");
+  return NULL;
+}
+
+
+INodeManager::NodeId SnapshotNodeManager::insertBetween(
+    NodeId parent, e_type oldKey, l_type newStart, l_type newEnd, 
+    e_type newKey) {
+  assert(!"SnapshotNodeManager is read-only");
+  return NULL;
+}
+
+
+void SnapshotNodeManager::removeChild(NodeId node, e_type key) {
+  assert(!"SnapshotNodeManager is read-only");
+}
+
+
+void SnapshotNodeManager::setPayload(NodeId node, void* payload) {
+  assert(!"SnapshotNodeManager is read-only");
+}
+
+
+void SnapshotNodeManager::destroyNode(NodeId node) {
+  assert(!"SnapshotNodeManager is read-only");
+}
+
+
+INodeManager::ChildMap& SnapshotNodeManager::getChildren(NodeId node) const {
+  size_t i = index(node);
+  std::map<size_t, ChildMap>::iterator it = this->childMaps.find(i);
+  if (it == this->childMaps.end()) {
+    it = this->childMaps.insert(std::make_pair(i, ChildMap())).first;
+    it->second.reserve(this->snapshot.endChild(i) 
+                       - this->snapshot.firstChild(i));
+    for (size_t c = this->snapshot.firstChild(i); 
+         c < this->snapshot.endChild(i); ++c) {
+      it->second[this->snapshot.getKey(c)] = handle(c);
+    }
+  }
+  return it->second;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////   SNAPSHOT RESTAURANT   //////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+l_type SnapshotRestaurant::getC(void* payloadPtr, e_type type) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  int pos = counts.find(type);
+  return (pos < 0) ? 0 : counts.customers()[pos];
+}
+
+
+l_type SnapshotRestaurant::getC(void* payloadPtr) const {
+  return ((const PackedCounts*)payloadPtr)->sumCustomers;
+}
+
+
+l_type SnapshotRestaurant::getT(void* payloadPtr, e_type type) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  int pos = counts.find(type);
+  return (pos < 0) ? 0 : counts.tables()[pos];
+}
+
+
+l_type SnapshotRestaurant::getT(void* payloadPtr) const {
+  return ((const PackedCounts*)payloadPtr)->sumTables;
+}
+
+
+double SnapshotRestaurant::computeProbability(void* payloadPtr,
+                                              e_type type, 
+                                              double parentProbability,
+                                              double discount, 
+                                              double concentration) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  int cw = 0;
+  int tw = 0;
+  int pos = counts.find(type);
+  if (pos >= 0) {
+    cw = counts.customers()[pos];
+    tw = counts.tables()[pos];
+  }
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               counts.sumCustomers, // c
+                               counts.sumTables, // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
+namespace {
+
+/**
+ * Per-type counts of a snapshot restaurant for
+ * updateHPYPPredictiveDistribution; the types are enumerated by their
+ * index in the arrays.
+ */
+class SnapshotCounts {
+  public:
+    typedef int Count;
+    typedef int Iterator;
+
+    explicit SnapshotCounts(const PackedCounts& counts) : counts(counts) {}
+
+    e_type type(int i) const { return this->counts.types()[i]; }
+    int cw(int i) const { return this->counts.customers()[i]; }
+    int tw(int i, double) const { return this->counts.tables()[i]; }
+
+  private:
+    const PackedCounts& counts;
+};
+
+} // namespace
+
+
+void SnapshotRestaurant::updatePredictiveDistribution(
+    void* payloadPtr,
+    double discount,
+    double concentration,
+    double* distribution,
+    int numTypes) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  updateHPYPPredictiveDistribution(0, counts.numTypes,
+                                   SnapshotCounts(counts),
+                                   counts.sumCustomers, // c
+                                   counts.sumTables, // t
+                                   discount, concentration,
+                                   distribution, numTypes);
+}
+
+
+IHPYPBaseRestaurant::TypeVector SnapshotRestaurant::getTypeVector(
+    void* payloadPtr) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  return TypeVector(counts.types(), counts.types() + counts.numTypes);
+}
+
+
+void SnapshotRestaurant::updateAfterSplit(void* longerPayloadPtr, 
+                                          void* shorterPayloadPtr, 
+                                          double discountBeforeSplit, 
+                                          double discountAfterSplit, 
+                                          bool parentOnly) const {
+  assert(!"SnapshotRestaurant is read-only");
+}
+
+
+double SnapshotRestaurant::addCustomer(void* payloadPtr, 
+                                       e_type type, 
+                                       double parentProbability, 
+                                       double discount, 
+                                       double concentration,
+                                       void* additionalData,
+                                       double count) const {
+  assert(!"SnapshotRestaurant is read-only");
+  return 0;
+}
+
+
+double SnapshotRestaurant::removeCustomer(void* payloadPtr, 
+                                          e_type type,
+                                          double discount,
+                                          void* additionalData, 
+                                          double count) const {
+  assert(!"SnapshotRestaurant is read-only");
+  return 0;
+}
+
+
+std::string SnapshotRestaurant::toString(void* payloadPtr) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  std::ostringstream out;
+
+  out << "[";
+  for (int i = 0; i < counts.numTypes; ++i) {
+    out << counts.types()[i] << ":(" << counts.customers()[i] 
+        << "/" << counts.tables()[i] << "), ";
+  }
+  out << "]";
+  return out.str();
+}
+
+
+bool SnapshotRestaurant::checkConsistency(void* payloadPtr) const {
+  const PackedCounts& counts = *((const PackedCounts*)payloadPtr);
+  bool consistent = true;
+  int sumCustomers = 0;
+  for (int i = 0; i < counts.numTypes; ++i) {
+    sumCustomers += counts.customers()[i];
+    consistent = consistent && counts.tables()[i] <= counts.customers()[i];
+    consistent = consistent && (i == 0 || counts.types()[i-1] < counts.types()[i]);
+  }
+  return consistent && sumCustomers == counts.sumCustomers;
+}
+
+
+void* SnapshotRestaurant::PayloadFactory::make() const {
+  PackedCounts* counts = new PackedCounts();
+  counts->sumCustomers = 0;
+  counts->sumTables = 0;
+  counts->numTypes = 0;
+  return counts;
+}
+
+
+void SnapshotRestaurant::PayloadFactory::recycle(void* payloadPtr) const {
+  delete (PackedCounts*)payloadPtr;
+}
+
+
+void SnapshotRestaurant::PayloadFactory::save(void* payloadPtr, 
+                                              OutArchive& oa) const {
+  assert(!"snapshot payloads can not be serialized");
+}
+
+
+void* SnapshotRestaurant::PayloadFactory::load(InArchive& ia) const {
+  assert(!"snapshot payloads can not be serialized");
+  return NULL;
+}
+
+}} // namespace gatsby::libplump
@@ -0,0 +1,361 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/node_manager_interface.h"
+#include "libplump/hpyp_restaurant_interface.h"
+
+namespace boost { namespace iostreams {
+class mapped_file_source;
+}}
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Header of a snapshot file. 
+ *
+ * A snapshot is a flat, position independent image of a context tree and
+ * the customer counts of its restaurants. All offsets are in bytes from the
+ * start of the file and 8 byte aligned. Values are stored in the byte 
+ * order of the host that wrote the snapshot, which is recorded in byteOrder;
+ * snapshots written on a host of different byte order are rejected.
+ *
+ * Nodes are numbered in breadth first order with the root as node 0 and
+ * the children of each node in increasing key order, so that the children 
+ * of node i are the nodes firstChild[i], ..., firstChild[i+1]-1. The 
+ * arrays are
+ *
+ *   int32_t  start[numNodes], end[numNodes]
+ *   uint32_t firstChild[numNodes + 1]
+ *   int32_t  key[numNodes]           (edge label of each node; key[0] unused)
+ *   uint64_t payload[numNodes]       (offset of the counts relative to 
+ *                                     payloadsOffset)
+ *
+ * followed by the PackedCounts of all nodes.
+ */
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t byteOrder; // Snapshot::BYTE_ORDER_MARK in the writer's byte order
+  uint32_t reserved;
+  uint64_t numNodes;
+  uint64_t startOffset;
+  uint64_t endOffset;
+  uint64_t firstChildOffset;
+  uint64_t keyOffset;
+  uint64_t payloadOffset;
+  uint64_t payloadsOffset;
+  uint64_t payloadsSize;
+};
+
+
+/**
+ * Customer and table counts of one restaurant in a snapshot. 
+ *
+ * The header is followed by the arrays types[numTypes], 
+ * customers[numTypes] and tables[numTypes], sorted by type.
+ */
+struct PackedCounts {
+  int32_t sumCustomers;
+  int32_t sumTables;
+  int32_t numTypes;
+
+  const int32_t* types() const {
+    return (const int32_t*)(this + 1);
+  }
+
+  const int32_t* customers() const {
+    return this->types() + numTypes;
+  }
+
+  const int32_t* tables() const {
+    return this->types() + 2 * numTypes;
+  }
+
+  /**
+   * Position of type in types(), or -1 if there are no customers of it.
+   */
+  int find(e_type type) const;
+
+  static size_t bytes(int numTypes) {
+    return sizeof(PackedCounts) + 3 * sizeof(int32_t) * numTypes;
+  }
+};
+
+
+/**
+ * A read-only, memory-mapped model snapshot. 
+ *
+ * Loading a snapshot only maps the file; nodes and counts are used in place
+ * through SnapshotNodeManager and SnapshotRestaurant, so a process can 
+ * start predicting immediately and shares the pages of the file with all 
+ * other processes using the same snapshot.
+ *
+ * A snapshot stores the counts c_s, t_s of each type (and c, t) as
+ * reported by the restaurant that built the model; predictions from it are 
+ * exact for restaurants whose predictive probabilities only depend on 
+ * these counts (KneserNey, SimpleFull, Histogram and the compact 
+ * restaurants, see IHPYPBaseRestaurant::predictsFromCounts); save rejects
+ * all others. The underlying sequence is not stored and has to be
+ * provided separately, as for Serializer.
+ */
+class Snapshot {
+  public:
+    static const uint32_t VERSION = 2;
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    /**
+     * Map the snapshot in fileName; throws std::runtime_error if it is not
+     * a valid snapshot, was written on a host of different byte order, or
+     * its tree arrays or payload offsets are inconsistent. The counts 
+     * themselves are only read when used.
+     */
+    explicit Snapshot(const std::string& fileName);
+
+    ~Snapshot();
+
+    /**
+     * Write a snapshot of the tree in nm with the counts of restaurant; 
+     * throws std::runtime_error if the restaurant does not predict from
+     * its counts (see IHPYPBaseRestaurant::predictsFromCounts) or the file
+     * cannot be written. The snapshot is written to a temporary file that 
+     * is renamed to fileName when complete, so a failed save leaves no 
+     * partial snapshot behind.
+     */
+    static void save(const std::string& fileName, 
+                     const INodeManager& nm,
+                     const IHPYPBaseRestaurant& restaurant);
+
+    size_t numNodes() const {
+      return this->header->numNodes;
+    }
+
+    l_type getStart(size_t node) const {
+      return this->starts[node];
+    }
+
+    l_type getEnd(size_t node) const {
+      return this->ends[node];
+    }
+
+    size_t firstChild(size_t node) const {
+      return this->firstChildren[node];
+    }
+
+    size_t endChild(size_t node) const {
+      return this->firstChildren[node + 1];
+    }
+
+    e_type getKey(size_t node) const {
+      return this->keys[node];
+    }
+
+    /**
+     * Return the index of the child of node with the given key, or 0 
+     * (the root, which is nobody's child) if there is none.
+     */
+    size_t getChild(size_t node, e_type key) const;
+
+    const PackedCounts* getCounts(size_t node) const {
+      return (const PackedCounts*)(this->payloads + this->payloadOffsets[node]);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Snapshot);
+
+    /**
+     * Write the snapshot for save to fileName.
+     */
+    static void writeSnapshot(const std::string& fileName, 
+                              const INodeManager& nm,
+                              const IHPYPBaseRestaurant& restaurant);
+
+    boost::shared_ptr<boost::iostreams::mapped_file_source> mapping;
+    const SnapshotHeader* header;
+    const int32_t* starts;
+    const int32_t* ends;
+    const uint32_t* firstChildren;
+    const int32_t* keys;
+    const uint64_t* payloadOffsets;
+    const char* payloads;
+};
+
+
+/**
+ * Read-only INodeManager over a Snapshot.
+ *
+ * NodeIds are node indices plus one; payloads point to the PackedCounts of
+ * the node and can be used with SnapshotRestaurant. All modifying 
+ * operations are errors, except destroyNodeRecursive, which does nothing.
+ * The child maps returned by getChildren are built on first use, which is
+ * not thread-safe; lookups through getChild are.
+ */
+class SnapshotNodeManager : public INodeManager {
+  public:
+    explicit SnapshotNodeManager(const Snapshot& snapshot) 
+        : snapshot(snapshot) {}
+
+    NodeId getRoot() const {
+      return handle(0);
+    }
+
+    NodeId getChild(NodeId node, e_type key) const {
+      size_t child = this->snapshot.getChild(index(node), key);
+      return (child == 0) ? NULL : handle(child);
+    }
+
+    NodeId setChild(NodeId node, e_type key, l_type start, l_type end,
+                    void* payload = NULL);
+
+    NodeId insertBetween(NodeId parent, e_type oldKey, l_type newStart,
+                         l_type newEnd, e_type newKey);
+
+    void removeChild(NodeId node, e_type key);
+
+    void* getPayload(NodeId node) const {
+      return (void*)this->snapshot.getCounts(index(node));
+    }
+
+    void setPayload(NodeId node, void* payload);
+
+    l_type getStart(NodeId node) const {
+      return this->snapshot.getStart(index(node));
+    }
+
+    l_type getEnd(NodeId node) const {
+      return this->snapshot.getEnd(index(node));
+    }
+
+    ChildMap& getChildren(NodeId node) const;
+
+    void destroyNode(NodeId node);
+
+    void destroyNodeRecursive(NodeId node) {}
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(SnapshotNodeManager);
+
+    static size_t index(NodeId node) {
+      return (size_t)(uintptr_t)node - 1;
+    }
+
+    static NodeId handle(size_t i) {
+      return (NodeId)(uintptr_t)(i + 1);
+    }
+
+    const Snapshot& snapshot;
+    mutable std::map<size_t, ChildMap> childMaps;
+};
+
+
+/**
+ * Read-only restaurant whose payloads are the PackedCounts of a Snapshot.
+ *
+ * Supports everything needed for prediction without fragmentation; adding
+ * or removing customers and splitting restaurants are errors. 
+ */
+class SnapshotRestaurant : public IAddRemoveRestaurant {
+  public:
+    SnapshotRestaurant() : payloadFactory() {}
+
+    l_type getC(void* payloadPtr, e_type type) const;
+    l_type getC(void* payloadPtr) const;
+    l_type getT(void* payloadPtr, e_type type) const;
+    l_type getT(void* payloadPtr) const;
+
+    bool predictsFromCounts() const {
+      return true;
+    }
+
+    double computeProbability(void* payloadPtr,
+                              e_type type, 
+                              double parentProbability,
+                              double discount, 
+                              double concentration) const;
+
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+
+    TypeVector getTypeVector(void* payloadPtr) const;
+
+    const IPayloadFactory& getFactory() const {
+      return this->payloadFactory;
+    }
+
+    void updateAfterSplit(void* longerPayloadPtr, 
+                          void* shorterPayloadPtr, 
+                          double discountBeforeSplit, 
+                          double discountAfterSplit, 
+                          bool parentOnly = false) const;
+
+    double addCustomer(void* payloadPtr, 
+                       e_type type, 
+                       double parentProbability, 
+                       double discount, 
+                       double concentration,
+                       void* additionalData = NULL,
+                       double count = 1) const;
+
+    double removeCustomer(void* payloadPtr, 
+                          e_type type,
+                          double discount,
+                          void* additionalData, 
+                          double count = 1) const;
+
+    void* createAdditionalData(void* payloadPtr, 
+                               double discount, 
+                               double concentration) const {
+      return NULL;
+    }
+
+    void freeAdditionalData(void* additionalData) const {}
+
+    std::string toString(void* payloadPtr) const;
+
+    bool checkConsistency(void* payloadPtr) const;
+
+  private:
+    /**
+     * Makes empty restaurants, e.g. for scratch space.
+     */
+    class PayloadFactory : public IPayloadFactory {
+      public:
+        void* make() const;
+        void recycle(void* payloadPtr) const;
+        void reset(void* payloadPtr) const {}
+        void save(void* payloadPtr, OutArchive& oa) const;
+        void* load(InArchive& ia) const;
+    };
+
+    PayloadFactory payloadFactory;
+};
+
+}} // namespace gatsby::libplump
+
+#endif /* SNAPSHOT_H_ */
@@ -20,6 +20,7 @@
  *
  */
 #include "libplump/stirling.h"
+#include <algorithm>
 #include <cmath>
 #include <sstream>
 #include <gsl/gsl_sf_gamma.h>
@@ -287,17 +288,121 @@ std::string stirling_generator_fast_log::statsToString() {
 }
 
 
-////////////////////////// stirling_generator_full_log ////////////////////////
-stirling_generator_full_log::stirling_generator_full_log(double d, int c, int t) : d(d) {
-    // generate the smallest possible table for a start
-    // TODO: do something more clever
-   table = log_gen_stirling_table(d,2);
-   c_max = 2;
-   num_construct++;
+////////////////////////// StirlingTableCache //////////////////////////////
+const size_t StirlingTableCache::DEFAULT_MEMORY_BUDGET;
+
+StirlingTableCache& StirlingTableCache::instance() {
+    static StirlingTableCache cache;
+    return cache;
+}
+
+StirlingTableCache::StirlingTableCache(size_t memoryBudget) 
+    : mutex(), entries(), lru(), memoryBudget(memoryBudget), bytes(0),
+      hits(0), misses(0), extensions(0), evictions(0), c_max(0) {}
+
+StirlingTableCache::TablePtr StirlingTableCache::getTable(double d, int c) {
+    boost::mutex::scoped_lock lock(this->mutex);
+    EntryMap::iterator it = this->entries.find(d);
+    if (it != this->entries.end()) {
+        Entry& entry = it->second;
+        this->lru.splice(this->lru.begin(), this->lru, entry.lruPosition);
+        if (c <= entry.table->c_max) {
+            ++this->hits;
+            return entry.table;
+        }
+        ++this->extensions;
+        int new_c = std::max(c, entry.table->c_max + entry.table->c_max / 2);
+        Table* table = new Table(*entry.table);
+        log_gen_stirling_table_extend(d, new_c, table->table);
+        table->c_max = new_c;
+        entry.table.reset(table);
+        this->bytes -= entry.bytes;
+        entry.bytes = tableBytes(table->table);
+        this->bytes += entry.bytes;
+        this->c_max = std::max(this->c_max, new_c);
+        this->evict(d);
+        return entry.table;
+    }
+
+    ++this->misses;
+    // generate the smallest possible table and extend it, as the
+    // generators always did
+    int new_c = std::max(c, 2);
+    Table* table = new Table(d, 2, log_gen_stirling_table(d, 2));
+    if (new_c > 2) {
+        log_gen_stirling_table_extend(d, new_c, table->table);
+        table->c_max = new_c;
+    }
+    Entry& entry = this->entries[d];
+    entry.table.reset(table);
+    entry.bytes = tableBytes(table->table);
+    entry.lruPosition = this->lru.insert(this->lru.begin(), d);
+    this->bytes += entry.bytes;
+    this->c_max = std::max(this->c_max, new_c);
+    this->evict(d);
+    return entry.table;
+}
+
+void StirlingTableCache::setMemoryBudget(size_t bytes) {
+    boost::mutex::scoped_lock lock(this->mutex);
+    this->memoryBudget = bytes;
+    this->evict(NAN);
+}
+
+size_t StirlingTableCache::getMemoryBudget() const {
+    boost::mutex::scoped_lock lock(this->mutex);
+    return this->memoryBudget;
+}
+
+void StirlingTableCache::clear() {
+    boost::mutex::scoped_lock lock(this->mutex);
+    this->entries.clear();
+    this->lru.clear();
+    this->bytes = 0;
+}
+
+std::string StirlingTableCache::statsToString() const {
+    boost::mutex::scoped_lock lock(this->mutex);
+    std::ostringstream out;
+    out << "tables: " << this->entries.size() 
+        << ", bytes: " << this->bytes 
+        << ", hits: " << this->hits
+        << ", misses: " << this->misses 
+        << ", extended: " << this->extensions
+        << ", evicted: " << this->evictions
+        << ", c_max: " << this->c_max;
+    return out.str();
 }
 
+size_t StirlingTableCache::tableBytes(const d_vec_vec& table) {
+    size_t bytes = sizeof(Table) + table.capacity() * sizeof(d_vec);
+    for (size_t i = 0; i < table.size(); ++i) {
+        bytes += table[i].capacity() * sizeof(double);
+    }
+    return bytes;
+}
+
+void StirlingTableCache::evict(double keep) {
+    std::list<double>::iterator it = this->lru.end();
+    while (this->bytes > this->memoryBudget && it != this->lru.begin()) {
+        --it;
+        if (*it == keep) {
+            continue;
+        }
+        EntryMap::iterator entry = this->entries.find(*it);
+        this->bytes -= entry->second.bytes;
+        this->entries.erase(entry);
+        it = this->lru.erase(it);
+        ++this->evictions;
+    }
+}
+
+
+////////////////////////// stirling_generator_full_log ////////////////////////
+stirling_generator_full_log::stirling_generator_full_log(double d, int c, int t)
+    : table(), d(d) {}
+
 double stirling_generator_full_log::ratio(int c, int t) {
-    num_ratio_calls++;
     if (t==1) {
         return 0;
     }
@@ -307,46 +412,22 @@ double stirling_generator_full_log::ratio(int c, int t) {
         return NAN;
     if(c==t)
         return 1;
-    if (c>c_max) {
-        num_extends++;
-        log_gen_stirling_table_extend(d,c,table);
-        c_max = c;
-        if (c_max > global_c_max) {
-            global_c_max = c_max;
-        }
-    }
+    this->requireC(c);
     if (c==0 || t==0) {
         std::cout << "Error: calling ratio(0,0)" << std::endl;
     }
-    //for (int i=0; i<table.size();i++) {
-    //    std::cout << iterableToString(table[i]) << std::endl;
-    //}
-    return exp(log_get_stirling_from_table(table, c-1, t-1) - log_get_stirling_from_table(table, c, t));
+    return exp(log_get_stirling_from_table(table->table, c-1, t-1) 
+               - log_get_stirling_from_table(table->table, c, t));
 }
 
 
 double stirling_generator_full_log::getLog(int c, int t) {
-    if (c>c_max) {
-        num_extends++;
-        log_gen_stirling_table_extend(d,c,table);
-        c_max = c;
-        if (c_max > global_c_max) {
-            global_c_max = c_max;
-        }
-    }
-    return log_get_stirling_from_table(table, c, t);
+    this->requireC(c);
+    return log_get_stirling_from_table(table->table, c, t);
 }
 
 std::string stirling_generator_full_log::statsToString() {
-    std::ostringstream out;
-    out << "Constructed: " << num_construct << ", extended: " << num_extends << ", calls: " << num_ratio_calls << ", c_max " << global_c_max;
-    return out.str();
+    return StirlingTableCache::instance().statsToString();
 }
 
-
-int stirling_generator_full_log::global_c_max = 0;
-int stirling_generator_full_log::num_ratio_calls = 0;
-int stirling_generator_full_log::num_extends = 0;
-int stirling_generator_full_log::num_construct = 0;
-
 }} // namespace gatsby::libplump
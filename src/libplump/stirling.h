@@ -24,11 +24,17 @@
 #define STIRLING_H_
 #include <cmath>
 #include <vector>
+#include <list>
+#include <map>
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <gsl/gsl_sf_gamma.h>
 
+#include "libplump/utils.h"
+
 
 namespace gatsby { namespace libplump {
 
@@ -93,7 +99,90 @@ d_vec_vec log_gen_stirling_table(double d, int c);
 void log_gen_stirling_table_extend(double d, int c, d_vec_vec& table);
 
 
-double log_get_stirling_from_table(d_vec_vec& table, int c, int t);
+double log_get_stirling_from_table(const d_vec_vec& table, int c, int t);
+
+
+/**
+ * Process-wide cache of the tables computed by log_gen_stirling_table, 
+ * keyed by discount and shared by all stirling_generator_full_log objects.
+ *
+ * Tables are never modified once they are in the cache: when a larger c is
+ * needed, a copy of the table is extended (to at least 1.5 times its 
+ * previous c, so that the copying is amortized) and replaces it. Holders of
+ * the old table keep it alive and can keep reading it without locking; only
+ * getTable takes the mutex. Extending a table yields exactly the entries
+ * computing it at once would, so the results do not depend on the cache.
+ *
+ * When the tables take more than the memory budget, the least recently
+ * requested ones are dropped from the cache.
+ */
+class StirlingTableCache {
+  public:
+    struct Table {
+      Table(double d, int c_max, const d_vec_vec& table)
+          : d(d), c_max(c_max), table(table) {}
+
+      double d;
+      int c_max;
+      d_vec_vec table;
+    };
+
+    typedef boost::shared_ptr<const Table> TablePtr;
+
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 << 20;
+
+    /**
+     * The cache used by stirling_generator_full_log.
+     */
+    static StirlingTableCache& instance();
+
+    explicit StirlingTableCache(size_t memoryBudget = DEFAULT_MEMORY_BUDGET);
+
+    /**
+     * Return a table for discount d that holds all entries with up to
+     * c customers.
+     */
+    TablePtr getTable(double d, int c);
+
+    void setMemoryBudget(size_t bytes);
+
+    size_t getMemoryBudget() const;
+
+    /**
+     * Drop all tables (tables still in use stay valid).
+     */
+    void clear();
+
+    std::string statsToString() const;
+
+  private:
+    struct Entry {
+      TablePtr table;
+      size_t bytes;
+      std::list<double>::iterator lruPosition;
+    };
+
+    typedef std::map<double, Entry> EntryMap;
+
+    static size_t tableBytes(const d_vec_vec& table);
+
+    /**
+     * Drop least recently used tables other than the one for keep until the
+     * budget is met. The mutex must be held.
+     */
+    void evict(double keep);
+
+    mutable boost::mutex mutex;
+    EntryMap entries;
+    // discounts of the entries, most recently requested first
+    std::list<double> lru;
+    size_t memoryBudget;
+    size_t bytes;
+    unsigned long hits, misses, extensions, evictions;
+    int c_max;
+
+    DISALLOW_COPY_AND_ASSIGN(StirlingTableCache);
+};
 
 
 class stirling_generator_recompute_log {
@@ -135,6 +224,8 @@ class stirling_generator_fast_log {
  * 
  * One of these objects should be constructed for each restaurant, 
  * providing the current number of tables, and the total number of customers.
+ * The tables are obtained from StirlingTableCache::instance() on first use,
+ * so restaurants with the same discount share them.
  */
 class stirling_generator_full_log {
   public:
@@ -144,18 +235,26 @@ class stirling_generator_full_log {
     
     double getLog(int c, int t);
 
+    /**
+     * Statistics of the shared table cache.
+     */
     static std::string statsToString();
 
   private:
-
-    static int global_c_max, num_ratio_calls, num_extends, num_construct;
-
-    d_vec_vec table;
-    int c_max;
+    /**
+     * Make sure the table holds the entries for c customers.
+     */
+    void requireC(int c) {
+      if (this->table.get() == NULL || c > this->table->c_max) {
+        this->table = StirlingTableCache::instance().getTable(this->d, c);
+      }
+    }
+
+    StirlingTableCache::TablePtr table;
     double d;
 };
 
-inline double log_get_stirling_from_table(d_vec_vec& table, int c, int t) {
+inline double log_get_stirling_from_table(const d_vec_vec& table, int c, int t) {
   // c and t must be non-negative
   assert(c >= 0 && t>= 0);
 
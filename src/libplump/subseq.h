@@ -21,6 +21,7 @@
 #include <vector>
 #include <sstream>
 #include "config.h"
+#include "symbol_sequence.h"
 
 namespace gatsby { namespace libplump {
 
@@ -70,12 +71,7 @@ public:
     l_type suffixUntil(seq_type* seq, SubSeq& s, l_type start) {
     	l_type l = (length() < s.length()) ? length() : s.length();
     	//int l = this.length(); // assume this seq is always shorter
-    	l_type i = start;
-    	for (; i<l; i++) {
-    		if (getRelativeReversed(seq,i) != s.getRelativeReversed(seq,i))
-    			break;
-    	}
-    	return i;
+    	return seq->commonSuffixLength(end, s.end, start, l);
     }
 
     static std::string toString(l_type start, l_type end, const seq_type& seq) {
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/suffix_array.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace gatsby { namespace libplump {
+
+namespace {
+
+/**
+ * Set bucket to the start (or, if ends is set, one past the end) of the
+ * bucket of each symbol in the suffix array.
+ */
+void getBuckets(const l_type* s, l_type n, l_type alphabetSize, bool ends,
+                std::vector<l_type>& bucket) {
+  bucket.assign(alphabetSize, 0);
+  for (l_type i = 0; i < n; ++i) {
+    ++bucket[s[i]];
+  }
+  l_type sum = 0;
+  for (l_type c = 0; c < alphabetSize; ++c) {
+    sum += bucket[c];
+    bucket[c] = ends ? sum : sum - bucket[c];
+  }
+}
+
+
+// a suffix is of type S if it is smaller than the next one, and of type L
+// otherwise; an LMS suffix is an S suffix following an L suffix
+inline bool isLMS(const std::vector<bool>& typeS, l_type i) {
+  return i > 0 && typeS[i] && !typeS[i - 1];
+}
+
+
+/**
+ * Sort the L suffixes and then the S suffixes from the LMS suffixes placed
+ * in sa.
+ */
+void induce(const l_type* s, l_type* sa, l_type n, l_type alphabetSize,
+            const std::vector<bool>& typeS, std::vector<l_type>& bucket) {
+  getBuckets(s, n, alphabetSize, false, bucket);
+  for (l_type i = 0; i < n; ++i) {
+    l_type j = sa[i] - 1;
+    if (sa[i] > 0 && !typeS[j]) {
+      sa[bucket[s[j]]++] = j;
+    }
+  }
+  getBuckets(s, n, alphabetSize, true, bucket);
+  for (l_type i = n - 1; i >= 0; --i) {
+    l_type j = sa[i] - 1;
+    if (sa[i] > 0 && typeS[j]) {
+      sa[--bucket[s[j]]] = j;
+    }
+  }
+}
+
+
+/**
+ * SA-IS on s[0..n), whose last symbol is a unique sentinel 0. The reduced
+ * problem is solved recursively in sa itself.
+ */
+void sais(const l_type* s, l_type* sa, l_type n, l_type alphabetSize) {
+  std::vector<bool> typeS(n);
+  typeS[n - 1] = true;
+  for (l_type i = n - 2; i >= 0; --i) {
+    typeS[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && typeS[i + 1]);
+  }
+
+  // sort the LMS substrings by placing the LMS suffixes at the ends of
+  // their buckets and inducing
+  std::vector<l_type> bucket;
+  getBuckets(s, n, alphabetSize, true, bucket);
+  std::fill(sa, sa + n, -1);
+  for (l_type i = 1; i < n; ++i) {
+    if (isLMS(typeS, i)) {
+      sa[--bucket[s[i]]] = i;
+    }
+  }
+  induce(s, sa, n, alphabetSize, typeS, bucket);
+
+  // move the sorted LMS substrings to the front of sa and name them; no two
+  // LMS positions are adjacent, so the names fit into sa[n1 + i / 2]
+  l_type n1 = 0;
+  for (l_type i = 0; i < n; ++i) {
+    if (isLMS(typeS, sa[i])) {
+      sa[n1++] = sa[i];
+    }
+  }
+  std::fill(sa + n1, sa + n, -1);
+  l_type name = 0;
+  l_type previous = -1;
+  for (l_type i = 0; i < n1; ++i) {
+    const l_type pos = sa[i];
+    bool differs = (previous == -1);
+    for (l_type d = 0; !differs; ++d) {
+      if (s[pos + d] != s[previous + d]
+          || typeS[pos + d] != typeS[previous + d]) {
+        differs = true;
+      } else if (d > 0 && (isLMS(typeS, pos + d)
+                           || isLMS(typeS, previous + d))) {
+        break;
+      }
+    }
+    if (differs) {
+      ++name;
+      previous = pos;
+    }
+    sa[n1 + pos / 2] = name - 1;
+  }
+  for (l_type i = n - 1, j = n - 1; i >= n1; --i) {
+    if (sa[i] >= 0) {
+      sa[j--] = sa[i];
+    }
+  }
+
+  // sort the LMS suffixes: the names of the LMS substrings, in text order,
+  // form the reduced string s1, whose suffix array goes to sa[0..n1)
+  l_type* s1 = sa + n - n1;
+  if (name < n1) {
+    sais(s1, sa, n1, name);
+  } else {
+    for (l_type i = 0; i < n1; ++i) {
+      sa[s1[i]] = i;
+    }
+  }
+
+  // sort all suffixes by inducing from the sorted LMS suffixes
+  for (l_type i = 1, j = 0; i < n; ++i) {
+    if (isLMS(typeS, i)) {
+      s1[j++] = i;
+    }
+  }
+  for (l_type i = 0; i < n1; ++i) {
+    sa[i] = s1[sa[i]];
+  }
+  std::fill(sa + n1, sa + n, -1);
+  getBuckets(s, n, alphabetSize, true, bucket);
+  for (l_type i = n1 - 1; i >= 0; --i) {
+    const l_type j = sa[i];
+    sa[i] = -1;
+    sa[--bucket[s[j]]] = j;
+  }
+  induce(s, sa, n, alphabetSize, typeS, bucket);
+}
+
+} // namespace
+
+
+void buildSuffixArray(const std::vector<l_type>& text, l_type alphabetSize,
+                      std::vector<l_type>& sa) {
+  const l_type n = text.size();
+  assert(n > 0 && text[n - 1] == 0);
+  sa.resize(n);
+  if (n == 1) {
+    sa[0] = 0;
+    return;
+  }
+  sais(&text[0], &sa[0], n, alphabetSize);
+}
+
+
+void buildLcpArray(const std::vector<l_type>& text,
+                   const std::vector<l_type>& sa,
+                   std::vector<l_type>& lcp) {
+  const l_type n = text.size();
+  // the rank of each suffix is only needed until lcp is filled in
+  std::vector<l_type> rank(n);
+  for (l_type k = 0; k < n; ++k) {
+    rank[sa[k]] = k;
+  }
+  lcp.assign(n, 0);
+  // the common prefix of a suffix with its predecessor in sa is at most one
+  // shorter than that of the previous suffix in text order
+  l_type h = 0;
+  for (l_type i = 0; i < n; ++i) {
+    if (rank[i] == 0) {
+      h = 0;
+      continue;
+    }
+    const l_type j = sa[rank[i] - 1];
+    while (i + h < n && j + h < n && text[i + h] == text[j + h]) {
+      ++h;
+    }
+    lcp[rank[i]] = h;
+    if (h > 0) {
+      --h;
+    }
+  }
+}
+
+}} // namespace gatsby::libplump
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SUFFIX_ARRAY_H_
+#define SUFFIX_ARRAY_H_
+
+#include <vector>
+#include "libplump/config.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Compute the suffix array of text: sa[k] is the start position of the
+ * k-th smallest suffix of text.
+ *
+ * The symbols of text have to be in [0, alphabetSize), and text has to end
+ * with a sentinel: its last symbol is 0, which occurs nowhere else. Hence
+ * sa[0] is the position of the sentinel, and a suffix that is a proper
+ * prefix of another suffix (up to the sentinel) is the smaller one.
+ *
+ * Uses induced sorting (SA-IS by Nong, Zhang and Chan), which takes linear
+ * time and, apart from text and sa, one bit per symbol and the buckets.
+ */
+void buildSuffixArray(const std::vector<l_type>& text, l_type alphabetSize,
+                      std::vector<l_type>& sa);
+
+/**
+ * Compute the LCP array for the suffix array sa of text (ending with a
+ * sentinel, as above): lcp[k] is the length of the longest common prefix
+ * of the suffixes at sa[k - 1] and sa[k], and lcp[0] is 0.
+ *
+ * Takes linear time (Kasai et al.).
+ */
+void buildLcpArray(const std::vector<l_type>& text,
+                   const std::vector<l_type>& sa,
+                   std::vector<l_type>& lcp);
+
+}} // namespace gatsby::libplump
+
+#endif /* SUFFIX_ARRAY_H_ */
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/suffix_compare.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIBPLUMP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace gatsby { namespace libplump {
+
+namespace {
+
+template<typename Symbol>
+l_type commonSuffixLengthScalar(const Symbol* aEnd, const Symbol* bEnd, 
+                                l_type offset, l_type limit) {
+  l_type i;
+  for (i = offset; i < limit; i++) {
+    if (aEnd[-1 - i] != bEnd[-1 - i])
+      break;
+  }
+  return i;
+}
+
+
+#ifdef LIBPLUMP_X86_KERNELS
+
+/**
+ * Given the byte mask of equal bytes of a comparison of the vectors of 
+ * vectorBytes bytes ending at aEnd[-1-i] and bEnd[-1-i] (the highest bytes 
+ * hold symbol i), return the offset from i of the first mismatching symbol 
+ * going backwards.
+ */
+inline l_type firstMismatch(unsigned int equalMask, int vectorBytes, 
+                            int symbolBytes) {
+  unsigned int all = (vectorBytes == 32) ? ~0u : (1u << vectorBytes) - 1;
+  unsigned int highestByte = 31 - __builtin_clz(~equalMask & all);
+  return (vectorBytes - 1 - highestByte) / symbolBytes;
+}
+
+__attribute__((target("sse2")))
+inline __m128i equal128(__m128i a, __m128i b, const uint8_t*) {
+  return _mm_cmpeq_epi8(a, b);
+}
+
+__attribute__((target("sse2")))
+inline __m128i equal128(__m128i a, __m128i b, const uint16_t*) {
+  return _mm_cmpeq_epi16(a, b);
+}
+
+__attribute__((target("sse2")))
+inline __m128i equal128(__m128i a, __m128i b, const int32_t*) {
+  return _mm_cmpeq_epi32(a, b);
+}
+
+__attribute__((target("avx2")))
+inline __m256i equal256(__m256i a, __m256i b, const uint8_t*) {
+  return _mm256_cmpeq_epi8(a, b);
+}
+
+__attribute__((target("avx2")))
+inline __m256i equal256(__m256i a, __m256i b, const uint16_t*) {
+  return _mm256_cmpeq_epi16(a, b);
+}
+
+__attribute__((target("avx2")))
+inline __m256i equal256(__m256i a, __m256i b, const int32_t*) {
+  return _mm256_cmpeq_epi32(a, b);
+}
+
+template<typename Symbol>
+__attribute__((target("sse2")))
+l_type commonSuffixLengthSSE2(const Symbol* aEnd, const Symbol* bEnd, 
+                              l_type offset, l_type limit) {
+  const l_type lanes = 16 / sizeof(Symbol);
+  l_type i = offset;
+  for (; i + lanes <= limit; i += lanes) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(aEnd - i - lanes));
+    __m128i b = _mm_loadu_si128((const __m128i*)(bEnd - i - lanes));
+    unsigned int equal = _mm_movemask_epi8(equal128(a, b, aEnd));
+    if (equal != 0xFFFFu) {
+      return i + firstMismatch(equal, 16, sizeof(Symbol));
+    }
+  }
+  return commonSuffixLengthScalar(aEnd, bEnd, i, limit);
+}
+
+template<typename Symbol>
+__attribute__((target("avx2")))
+l_type commonSuffixLengthAVX2(const Symbol* aEnd, const Symbol* bEnd, 
+                              l_type offset, l_type limit) {
+  const l_type lanes = 32 / sizeof(Symbol);
+  l_type i = offset;
+  for (; i + lanes <= limit; i += lanes) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(aEnd - i - lanes));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(bEnd - i - lanes));
+    unsigned int equal = _mm256_movemask_epi8(equal256(a, b, aEnd));
+    if (equal != 0xFFFFFFFFu) {
+      return i + firstMismatch(equal, 32, sizeof(Symbol));
+    }
+  }
+  return commonSuffixLengthScalar(aEnd, bEnd, i, limit);
+}
+
+template<typename Symbol>
+SuffixCompareKernels<Symbol> makeKernels() {
+  SuffixCompareKernels<Symbol> kernels;
+  kernels.scalar = &commonSuffixLengthScalar<Symbol>;
+  kernels.sse2 = &commonSuffixLengthSSE2<Symbol>;
+  kernels.avx2 = &commonSuffixLengthAVX2<Symbol>;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.selected = kernels.avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    kernels.selected = kernels.sse2;
+  } else {
+    kernels.selected = kernels.scalar;
+  }
+  return kernels;
+}
+
+#else
+
+template<typename Symbol>
+SuffixCompareKernels<Symbol> makeKernels() {
+  SuffixCompareKernels<Symbol> kernels;
+  kernels.scalar = &commonSuffixLengthScalar<Symbol>;
+  kernels.sse2 = NULL;
+  kernels.avx2 = NULL;
+  kernels.selected = kernels.scalar;
+  return kernels;
+}
+
+#endif
+
+} // namespace
+
+
+const SuffixCompareKernels<uint8_t> suffixCompareKernels8 = 
+    makeKernels<uint8_t>();
+const SuffixCompareKernels<uint16_t> suffixCompareKernels16 = 
+    makeKernels<uint16_t>();
+const SuffixCompareKernels<int32_t> suffixCompareKernels32 = 
+    makeKernels<int32_t>();
+
+
+const char* commonSuffixLengthKernelName() {
+  const SuffixCompareKernels<int32_t>& kernels = suffixCompareKernels32;
+  if (kernels.selected == kernels.avx2) {
+    return "avx2";
+  }
+  if (kernels.selected == kernels.sse2) {
+    return "sse2";
+  }
+  return "scalar";
+}
+
+}} // namespace gatsby::libplump
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SUFFIX_COMPARE_H_
+#define SUFFIX_COMPARE_H_
+
+#include <stdint.h>
+#include "libplump/config.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Kernels computing the longest common suffix of two sequences of symbols
+ * of type Symbol (uint8_t, uint16_t or int32_t). 
+ *
+ * Each kernel returns the smallest i in [offset, limit) for which 
+ * aEnd[-1-i] != bEnd[-1-i], or limit if there is no such i. aEnd and bEnd 
+ * point one past the last symbol of the two sequences, which are compared 
+ * backwards; both must have at least limit symbols.
+ *
+ * sse2 and avx2 are NULL if they are not compiled in; avx2 must only be 
+ * called if the CPU supports AVX2. selected is the fastest kernel supported
+ * by the CPU, chosen when the library is loaded.
+ */
+template<typename Symbol>
+struct SuffixCompareKernels {
+  typedef l_type (*Kernel)(const Symbol* aEnd, 
+                           const Symbol* bEnd, 
+                           l_type offset, 
+                           l_type limit);
+  Kernel scalar;
+  Kernel sse2;
+  Kernel avx2;
+  Kernel selected;
+};
+
+extern const SuffixCompareKernels<uint8_t> suffixCompareKernels8;
+extern const SuffixCompareKernels<uint16_t> suffixCompareKernels16;
+extern const SuffixCompareKernels<int32_t> suffixCompareKernels32;
+
+/**
+ * Kernels for the symbol type pointed to by the (unused) argument.
+ */
+inline const SuffixCompareKernels<uint8_t>& suffixCompareKernels(
+    const uint8_t*) {
+  return suffixCompareKernels8;
+}
+
+inline const SuffixCompareKernels<uint16_t>& suffixCompareKernels(
+    const uint16_t*) {
+  return suffixCompareKernels16;
+}
+
+inline const SuffixCompareKernels<int32_t>& suffixCompareKernels(
+    const int32_t*) {
+  return suffixCompareKernels32;
+}
+
+/**
+ * Name of the selected kernels ("avx2", "sse2" or "scalar").
+ */
+const char* commonSuffixLengthKernelName();
+
+/**
+ * Return the length of the longest common suffix of the sequences ending
+ * before aEnd and bEnd, considering at most limit symbols and assuming that 
+ * the first offset symbols are known to match; if offset >= limit, offset
+ * is returned.
+ *
+ * The first symbol is compared inline, as most comparisons in a context
+ * tree fail there; longer matches are handed to the selected kernel.
+ */
+template<typename Symbol>
+inline l_type commonSuffixLength(const Symbol* aEnd, 
+                                 const Symbol* bEnd, 
+                                 l_type offset, 
+                                 l_type limit) {
+  if (offset >= limit || aEnd[-1 - offset] != bEnd[-1 - offset]) {
+    return offset;
+  }
+  return suffixCompareKernels(aEnd).selected(aEnd, bEnd, offset + 1, limit);
+}
+
+}} // namespace gatsby::libplump
+
+#endif /* SUFFIX_COMPARE_H_ */
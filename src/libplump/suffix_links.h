@@ -0,0 +1,143 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SUFFIX_LINKS_H_
+#define SUFFIX_LINKS_H_
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+#include "libplump/config.h"
+#include "libplump/node_manager_interface.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Suffix links of a context tree, stored in reverse: for a node V and a
+ * symbol a, find(V, a) returns the node whose context is that of V with a
+ * prepended, i.e. V extended by one more (most recent) symbol, if such a
+ * node has been added. The suffix link of that node points back to V.
+ *
+ * The links form an open-addressing hash table with linear probing that is
+ * grown by doubling when it gets half full. Links are never removed, so the
+ * table has to be cleared whenever nodes are destroyed.
+ */
+class SuffixLinks {
+  public:
+    typedef INodeManager::NodeId NodeId;
+
+    SuffixLinks() : entries(), _size(0) {}
+
+    /**
+     * Return the node extending node by symbol, or NULL if there is no
+     * link.
+     */
+    NodeId find(NodeId node, e_type symbol) const {
+      if (this->entries.empty()) {
+        return NULL;
+      }
+      size_t mask = this->entries.size() - 1;
+      for (size_t slot = hashSlot(node, symbol, mask);
+           this->entries[slot].node != NULL; slot = (slot + 1) & mask) {
+        const Entry& entry = this->entries[slot];
+        if (entry.node == node && entry.symbol == symbol) {
+          return entry.extension;
+        }
+      }
+      return NULL;
+    }
+
+    /**
+     * Add the link from node and symbol to extension, replacing an existing
+     * link for node and symbol.
+     */
+    void insert(NodeId node, e_type symbol, NodeId extension) {
+      if (2 * (this->_size + 1) > this->entries.size()) {
+        this->grow();
+      }
+      if (this->insertEntry(node, symbol, extension)) {
+        ++this->_size;
+      }
+    }
+
+    void clear() {
+      std::vector<Entry>().swap(this->entries);
+      this->_size = 0;
+    }
+
+    size_t size() const {
+      return this->_size;
+    }
+
+    size_t memoryUsage() const {
+      return this->entries.capacity() * sizeof(Entry);
+    }
+
+  private:
+    struct Entry {
+      // NULL if the slot is empty
+      NodeId node;
+      NodeId extension;
+      e_type symbol;
+    };
+
+    static size_t hashSlot(NodeId node, e_type symbol, size_t mask) {
+      uint64_t h = ((uint64_t)(uintptr_t)node
+                    + (uint64_t)symbol * 0x9E3779B97F4A7C15ull)
+                   * 0xBF58476D1CE4E5B9ull;
+      return (size_t)(h ^ (h >> 31)) & mask;
+    }
+
+    /**
+     * Store the link; returns false if it replaced an existing one.
+     */
+    bool insertEntry(NodeId node, e_type symbol, NodeId extension) {
+      size_t mask = this->entries.size() - 1;
+      size_t slot = hashSlot(node, symbol, mask);
+      for (; this->entries[slot].node != NULL; slot = (slot + 1) & mask) {
+        Entry& entry = this->entries[slot];
+        if (entry.node == node && entry.symbol == symbol) {
+          entry.extension = extension;
+          return false;
+        }
+      }
+      Entry& entry = this->entries[slot];
+      entry.node = node;
+      entry.extension = extension;
+      entry.symbol = symbol;
+      return true;
+    }
+
+    void grow() {
+      std::vector<Entry> old;
+      old.swap(this->entries);
+      Entry empty = {NULL, NULL, 0};
+      this->entries.assign(old.empty() ? 1024 : 2 * old.size(), empty);
+      for (size_t i = 0; i < old.size(); ++i) {
+        if (old[i].node != NULL) {
+          this->insertEntry(old[i].node, old[i].symbol, old[i].extension);
+        }
+      }
+    }
+
+    std::vector<Entry> entries;
+    size_t _size;
+};
+
+}} // namespace gatsby::libplump
+
+#endif /* SUFFIX_LINKS_H_ */
@@ -67,6 +67,19 @@ double SwitchingRestaurant::computeProbability(void*  payloadPtr,
 }
 
 
+void SwitchingRestaurant::updatePredictiveDistribution(void* payloadPtr,
+                                                       double discount,
+                                                       double concentration,
+                                                       double* distribution,
+                                                       int numTypes) const {
+  this->switchedRestaurant->updatePredictiveDistribution(getCurrent(payloadPtr),
+                                                         discount,
+                                                         concentration,
+                                                         distribution,
+                                                         numTypes);
+}
+
+
 IHPYPBaseRestaurant::TypeVector SwitchingRestaurant::getTypeVector(
     void* payloadPtr) const {
   return this->switchedRestaurant->getTypeVector(getCurrent(payloadPtr));
@@ -192,6 +205,14 @@ void SwitchingRestaurant::PayloadFactory::recycle(void* payloadPtr) const {
   delete (Payload*)payloadPtr;
 }
 
+void SwitchingRestaurant::PayloadFactory::reset(void* payloadPtr) const {
+  for (int i = 0; i < this->switchingRestaurant.numSlots; ++i) {
+    this->switchingRestaurant.switchedRestaurant->getFactory().reset(
+        ((Payload*)payloadPtr)->payloads[i]);
+  }
+}
+
+
 void SwitchingRestaurant::PayloadFactory::save(void* payloadPtr, 
                                                OutArchive& oa) const {
 
@@ -43,6 +43,12 @@ class SwitchingRestaurant : public IAddRemoveRestaurant {
                               double discount, 
                               double concentration) const;
 
+    void updatePredictiveDistribution(void* payloadPtr,
+                                      double discount,
+                                      double concentration,
+                                      double* distribution,
+                                      int numTypes) const;
+
     TypeVector getTypeVector(void* payloadPtr) const;
     
     const IPayloadFactory& getFactory() const;
@@ -97,6 +103,7 @@ class SwitchingRestaurant : public IAddRemoveRestaurant {
         
         void* make() const;
         void recycle(void* payloadPtr) const;
+        void reset(void* payloadPtr) const;
         void save(void* payloadPtr, OutArchive& oa) const;
         void* load(InArchive& ia) const;
 
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/symbol_sequence.h"
+
+#include <algorithm>
+#include <fstream>
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace gatsby { namespace libplump {
+
+namespace io = boost::iostreams;
+
+SymbolSequence::SymbolSequence(const std::vector<e_type>& symbols, 
+                               Width width) 
+    : width_(width), size_(0), data_(NULL), head_(NULL), headSize_(0) {
+  this->reserve(symbols.size());
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    this->push_back(symbols[i]);
+  }
+}
+
+
+SymbolSequence::SymbolSequence(const std::string& fileName, Width width,
+                               size_t limit) 
+    : width_(width), size_(0), data_(NULL), head_(NULL), headSize_(0) {
+  size_t length = boost::filesystem::file_size(fileName) / width;
+  if (limit != 0) {
+    length = std::min(length, limit);
+  }
+  if (length == 0) {
+    // empty files cannot be mapped
+    return;
+  }
+  this->mapping.reset(new io::mapped_file_source(fileName, length * width));
+  this->head_ = this->mapping->data();
+  this->headSize_ = length;
+  this->size_ = length;
+}
+
+
+SymbolSequence::SymbolSequence(const SymbolSequence& other) 
+    : width_(other.width_), size_(other.size_), data_(NULL),
+      head_(other.head_), headSize_(other.headSize_),
+      bytes(other.bytes), shorts(other.shorts), ints(other.ints),
+      mapping(other.mapping) {
+  this->updateData();
+}
+
+
+SymbolSequence& SymbolSequence::operator=(const SymbolSequence& other) {
+  if (this != &other) {
+    this->width_ = other.width_;
+    this->bytes = other.bytes;
+    this->shorts = other.shorts;
+    this->ints = other.ints;
+    this->mapping = other.mapping;
+    this->head_ = other.head_;
+    this->headSize_ = other.headSize_;
+    this->updateData();
+  }
+  return *this;
+}
+
+
+SymbolSequence::~SymbolSequence() {}
+
+
+void SymbolSequence::reserve(size_t n) {
+  // only the symbols after the mapped ones are stored in the vectors
+  n = (n > headSize_) ? n - headSize_ : 0;
+  switch (width_) {
+    case BYTE: bytes.reserve(n); break;
+    case SHORT: shorts.reserve(n); break;
+    default: ints.reserve(n);
+  }
+  this->updateData();
+}
+
+
+void SymbolSequence::clear() {
+  this->mapping.reset();
+  this->head_ = NULL;
+  this->headSize_ = 0;
+  bytes.clear();
+  shorts.clear();
+  ints.clear();
+  this->updateData();
+}
+
+
+void SymbolSequence::pop_back() {
+  assert(size_ > 0);
+  if (size_ == headSize_) {
+    // dropping the last symbol of a view does not need a copy
+    --headSize_;
+    --size_;
+    return;
+  }
+  switch (width_) {
+    case BYTE: bytes.pop_back(); break;
+    case SHORT: shorts.pop_back(); break;
+    default: ints.pop_back();
+  }
+  this->updateData();
+}
+
+
+size_t SymbolSequence::appendFile(const std::string& fileName, 
+                                  Width fileWidth, size_t limit) {
+  std::ifstream in(fileName.c_str(), std::ios::binary | std::ios_base::in);
+  size_t available = boost::filesystem::file_size(fileName) / fileWidth;
+  if (limit == 0 || limit > available) {
+    limit = available;
+  }
+  this->reserve(size_ + limit);
+  // read in blocks rather than one symbol at a time
+  const size_t blockSize = 1 << 16;
+  std::vector<char> buffer(blockSize * fileWidth);
+  size_t appended = 0;
+  while (in && appended < limit) {
+    size_t want = std::min(blockSize, limit - appended);
+    in.read(&buffer[0], want * fileWidth);
+    size_t got = in.gcount() / fileWidth;
+    if (fileWidth == width_) {
+      // no conversion needed
+      const char* begin = &buffer[0];
+      switch (width_) {
+        case BYTE: 
+          bytes.insert(bytes.end(), (const uint8_t*)begin, 
+                       (const uint8_t*)begin + got);
+          break;
+        case SHORT: 
+          shorts.insert(shorts.end(), (const uint16_t*)begin, 
+                        (const uint16_t*)begin + got);
+          break;
+        default: 
+          ints.insert(ints.end(), (const int32_t*)begin, 
+                      (const int32_t*)begin + got);
+      }
+      this->updateData();
+      appended += got;
+      continue;
+    }
+    for (size_t i = 0; i < got; ++i) {
+      switch (fileWidth) {
+        case BYTE: 
+          this->push_back(((const uint8_t*)&buffer[0])[i]); 
+          break;
+        case SHORT: 
+          this->push_back(((const uint16_t*)&buffer[0])[i]); 
+          break;
+        default: 
+          this->push_back(((const int32_t*)&buffer[0])[i]);
+      }
+    }
+    appended += got;
+  }
+  return appended;
+}
+
+
+void SymbolSequence::set(size_t i, e_type symbol) {
+  assert(i < size_);
+  if (i < headSize_) {
+    this->detach();
+  }
+  i -= headSize_;
+  switch (width_) {
+    case BYTE: 
+      assert(symbol >= 0 && symbol <= 0xFF);
+      bytes[i] = (uint8_t)symbol; 
+      break;
+    case SHORT: 
+      assert(symbol >= 0 && symbol <= 0xFFFF);
+      shorts[i] = (uint16_t)symbol; 
+      break;
+    default: 
+      ints[i] = symbol;
+  }
+}
+
+
+void SymbolSequence::detach() {
+  switch (width_) {
+    case BYTE: {
+      const uint8_t* head = (const uint8_t*)head_;
+      bytes.insert(bytes.begin(), head, head + headSize_);
+      break;
+    }
+    case SHORT: {
+      const uint16_t* head = (const uint16_t*)head_;
+      shorts.insert(shorts.begin(), head, head + headSize_);
+      break;
+    }
+    default: {
+      const int32_t* head = (const int32_t*)head_;
+      ints.insert(ints.begin(), head, head + headSize_);
+    }
+  }
+  this->mapping.reset();
+  this->head_ = NULL;
+  this->headSize_ = 0;
+  this->updateData();
+}
+
+
+void SymbolSequence::updateData() {
+  switch (width_) {
+    case BYTE: 
+      data_ = bytes.empty() ? NULL : &bytes[0];
+      size_ = headSize_ + bytes.size();
+      break;
+    case SHORT: 
+      data_ = shorts.empty() ? NULL : &shorts[0];
+      size_ = headSize_ + shorts.size();
+      break;
+    default: 
+      data_ = ints.empty() ? NULL : &ints[0];
+      size_ = headSize_ + ints.size();
+  }
+}
+
+}} // namespace gatsby::libplump
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYMBOL_SEQUENCE_H_
+#define SYMBOL_SEQUENCE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include "libplump/config.h"
+#include "libplump/suffix_compare.h"
+
+namespace boost { namespace iostreams {
+class mapped_file_source;
+}}
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A growable sequence of symbols stored with a fixed width of 1, 2 or 4 
+ * bytes per symbol, chosen at construction. 
+ *
+ * Byte and 16-bit sequences need a quarter resp. half the memory of an
+ * int32 sequence, and more of them fits into a cache line when suffixes
+ * are compared. Symbols are always read and written as e_type; pushing a 
+ * symbol that does not fit into the width is an error.
+ *
+ * A sequence can also be a read-only view of a memory-mapped file of raw
+ * symbols, which is available immediately and whose pages are shared with
+ * all other processes mapping the same file. Symbols appended to a mapped
+ * sequence (e.g. test data) are stored in memory owned by the sequence 
+ * after the mapped ones, so the mapped symbols are never copied unless one
+ * of them is changed with set.
+ */
+class SymbolSequence {
+  public:
+    enum Width {BYTE = 1, SHORT = 2, INT = 4};
+
+    explicit SymbolSequence(Width width = INT) 
+        : width_(width), size_(0), data_(NULL), head_(NULL), headSize_(0) {}
+
+    /**
+     * Construct a sequence holding a copy of the given symbols.
+     */
+    SymbolSequence(const std::vector<e_type>& symbols, Width width = INT);
+
+    /**
+     * Construct a read-only view of the file fileName, which holds raw 
+     * symbols of the given width, by memory-mapping it. 
+     *
+     * @param limit if not 0, only the first limit symbols are used
+     */
+    SymbolSequence(const std::string& fileName, Width width, 
+                   size_t limit = 0);
+
+    SymbolSequence(const SymbolSequence& other);
+
+    SymbolSequence& operator=(const SymbolSequence& other);
+
+    ~SymbolSequence();
+
+    Width width() const {
+      return width_;
+    }
+
+    size_t size() const {
+      return size_;
+    }
+
+    bool empty() const {
+      return size_ == 0;
+    }
+
+    /**
+     * Whether the first symbols are a view of a memory-mapped file.
+     */
+    bool isMapped() const {
+      return mapping.get() != NULL;
+    }
+
+    void reserve(size_t n);
+
+    void clear();
+
+    void push_back(e_type symbol) {
+      switch (width_) {
+        case BYTE: 
+          assert(symbol >= 0 && symbol <= 0xFF);
+          bytes.push_back((uint8_t)symbol); 
+          data_ = &bytes[0];
+          break;
+        case SHORT: 
+          assert(symbol >= 0 && symbol <= 0xFFFF);
+          shorts.push_back((uint16_t)symbol); 
+          data_ = &shorts[0];
+          break;
+        default: 
+          ints.push_back(symbol);
+          data_ = &ints[0];
+      }
+      ++size_;
+    }
+
+    void pop_back();
+
+    /**
+     * Append the raw symbols of the given width in the file fileName; 
+     * returns the number of symbols appended.
+     *
+     * @param limit if not 0, at most limit symbols are appended
+     */
+    size_t appendFile(const std::string& fileName, Width fileWidth, 
+                      size_t limit = 0);
+
+    e_type operator[](size_t i) const {
+      if (i < headSize_) {
+        return this->symbolAt(head_, i);
+      }
+      return this->symbolAt(data_, i - headSize_);
+    }
+
+    e_type at(size_t i) const {
+      assert(i < this->size());
+      return (*this)[i];
+    }
+
+    void set(size_t i, e_type symbol);
+
+    /**
+     * Length of the longest common suffix of the subsequences ending before
+     * positions aEnd and bEnd; see commonSuffixLength in suffix_compare.h.
+     */
+    l_type commonSuffixLength(l_type aEnd, l_type bEnd, 
+                              l_type offset, l_type limit) const {
+      if (offset >= limit) {
+        return offset;
+      }
+      switch (width_) {
+        case BYTE: 
+          return this->commonSuffixLength((const uint8_t*)data_, aEnd, bEnd,
+                                          offset, limit);
+        case SHORT: 
+          return this->commonSuffixLength((const uint16_t*)data_, aEnd, bEnd,
+                                          offset, limit);
+        default: 
+          return this->commonSuffixLength((const int32_t*)data_, aEnd, bEnd,
+                                          offset, limit);
+      }
+    }
+
+    /**
+     * Number of bytes allocated for storing the symbols; does not include
+     * mapped files.
+     */
+    size_t memoryUsage() const {
+      return bytes.capacity() * sizeof(uint8_t) 
+             + shorts.capacity() * sizeof(uint16_t) 
+             + ints.capacity() * sizeof(int32_t);
+    }
+
+  private:
+    e_type symbolAt(const void* data, size_t i) const {
+      switch (width_) {
+        case BYTE: return ((const uint8_t*)data)[i];
+        case SHORT: return ((const uint16_t*)data)[i];
+        default: return ((const int32_t*)data)[i];
+      }
+    }
+
+    /**
+     * commonSuffixLength for owned symbols data of type Symbol; the mapped
+     * and the owned symbols are compared in runs that lie within one of 
+     * them.
+     */
+    template<typename Symbol>
+    l_type commonSuffixLength(const Symbol* data, l_type aEnd, l_type bEnd,
+                              l_type offset, l_type limit) const {
+      if (headSize_ == 0) {
+        return libplump::commonSuffixLength(data + aEnd, data + bEnd, 
+                                            offset, limit);
+      }
+      const Symbol* head = (const Symbol*)head_;
+      const l_type headSize = headSize_;
+      while (offset < limit) {
+        // one past the next symbols to compare
+        l_type a = aEnd - offset;
+        l_type b = bEnd - offset;
+        const Symbol* aPtr = (a > headSize) ? data + (a - headSize) : head + a;
+        const Symbol* bPtr = (b > headSize) ? data + (b - headSize) : head + b;
+        l_type run = std::min(limit - offset, 
+                              std::min((a > headSize) ? a - headSize : a,
+                                       (b > headSize) ? b - headSize : b));
+        l_type matched = libplump::commonSuffixLength(aPtr, bPtr, 0, run);
+        offset += matched;
+        if (matched < run) {
+          break;
+        }
+      }
+      return offset;
+    }
+
+    /**
+     * Copy the mapped symbols into owned storage before the owned symbols
+     * and drop the mapping.
+     */
+    void detach();
+
+    /**
+     * Point data_ at the vector matching width_ and update size_.
+     */
+    void updateData();
+
+    Width width_;
+    size_t size_;
+    // start of the owned symbols, in the vector matching width_
+    const void* data_;
+    // the first headSize_ symbols, in the mapping
+    const void* head_;
+    size_t headSize_;
+    // only the vector matching width_ is used
+    std::vector<uint8_t> bytes;
+    std::vector<uint16_t> shorts;
+    std::vector<int32_t> ints;
+    boost::shared_ptr<boost::iostreams::mapped_file_source> mapping;
+};
+
+}} // namespace gatsby::libplump
+
+#endif /* SYMBOL_SEQUENCE_H_ */
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libplump/tracking_node_manager.h"
+
+namespace gatsby { namespace libplump {
+
+INodeManager::NodeId TrackingNodeManager::setChild(NodeId node, e_type key,
+                                                   l_type start, l_type end,
+                                                   void* payload) {
+  NodeId child = this->nm.setChild(node, key, start, end, payload);
+  if (!this->allModified) {
+    StructureChange change;
+    change.type = StructureChange::SET_CHILD;
+    change.parent = this->keyOf(node);
+    change.key = key;
+    change.node = NodeKey(start, end);
+    change.newKey = 0;
+    this->structureChanges.push_back(change);
+    this->markModified(start, end, this->nm.getPayload(child));
+  }
+  return child;
+}
+
+
+INodeManager::NodeId TrackingNodeManager::insertBetween(NodeId parent,
+                                                        e_type oldKey,
+                                                        l_type newStart,
+                                                        l_type newEnd,
+                                                        e_type newKey) {
+  NodeId node = this->nm.insertBetween(parent, oldKey, newStart, newEnd,
+                                       newKey);
+  if (!this->allModified) {
+    StructureChange change;
+    change.type = StructureChange::INSERT_BETWEEN;
+    change.parent = this->keyOf(parent);
+    change.key = oldKey;
+    change.node = NodeKey(newStart, newEnd);
+    change.newKey = newKey;
+    this->structureChanges.push_back(change);
+    this->markModified(newStart, newEnd, this->nm.getPayload(node));
+  }
+  return node;
+}
+
+
+void TrackingNodeManager::setPayload(NodeId node, void* payload) {
+  this->nm.setPayload(node, payload);
+  NodeKey key = this->keyOf(node);
+  this->markModified(key.first, key.second, payload);
+}
+
+
+void TrackingNodeManager::markAllModified() {
+  this->allModified = true;
+  this->structureChanges.clear();
+  this->modified.clear();
+}
+
+
+void TrackingNodeManager::clearChanges() {
+  this->allModified = false;
+  this->structureChanges.clear();
+  this->modified.clear();
+}
+
+}} // namespace gatsby::libplump
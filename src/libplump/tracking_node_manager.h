@@ -0,0 +1,173 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRACKING_NODE_MANAGER_H_
+#define TRACKING_NODE_MANAGER_H_
+
+#include <vector>
+#include <utility>
+#include <boost/unordered_map.hpp>
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/node_manager_interface.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A TrackingNodeManager forwards all operations to another node manager
+ * and records which nodes were created and which payloads were changed
+ * since the changes were last cleared, so that Serializer::saveChanges can
+ * write a delta checkpoint whose size depends on the number of updates
+ * rather than on the size of the tree.
+ *
+ * Nodes are identified by their start and end positions, which never change
+ * once a node has been created and are unique within a context tree.
+ * Structural changes are kept in the order in which they were made, so that
+ * they can be replayed on a copy of the tree.
+ *
+ * Recording is not thread safe; the only concurrent updates in HPYPModel
+ * (parallel Gibbs sampling) are preceded by a call to markAllModified, after
+ * which individual changes are no longer recorded.
+ */
+class TrackingNodeManager : public INodeManager {
+  public:
+    /**
+     * A node identified by its start and end positions.
+     */
+    typedef std::pair<l_type, l_type> NodeKey;
+
+    /**
+     * Map from the nodes whose payloads changed to their current payloads.
+     */
+    typedef boost::unordered_map<NodeKey, void*> ModifiedMap;
+
+    /**
+     * A call to setChild or insertBetween.
+     */
+    struct StructureChange {
+      enum Type {SET_CHILD, INSERT_BETWEEN};
+
+      Type type;
+      NodeKey parent;
+      e_type key;
+      NodeKey node;
+      // key of the displaced child in the new node (INSERT_BETWEEN only)
+      e_type newKey;
+    };
+
+    explicit TrackingNodeManager(INodeManager& nodeManager)
+      : nm(nodeManager), structureChanges(), modified(),
+        allModified(false) {}
+
+    NodeId getRoot() const {
+      return this->nm.getRoot();
+    }
+
+    NodeId getChild(NodeId node, e_type key) const {
+      return this->nm.getChild(node, key);
+    }
+
+    NodeId setChild(NodeId node, e_type key, l_type start, l_type end,
+                    void* payload = NULL);
+
+    NodeId insertBetween(NodeId parent, e_type oldKey,
+                         l_type newStart, l_type newEnd,  e_type newKey);
+
+    void removeChild(NodeId node, e_type key) {
+      this->nm.removeChild(node, key);
+    }
+
+    void* getPayload(NodeId node) const {
+      return this->nm.getPayload(node);
+    }
+
+    void setPayload(NodeId node, void* payload);
+
+    l_type getStart(NodeId node) const {
+      return this->nm.getStart(node);
+    }
+
+    l_type getEnd(NodeId node) const {
+      return this->nm.getEnd(node);
+    }
+
+    ChildMap& getChildren(NodeId node) const {
+      return this->nm.getChildren(node);
+    }
+
+    DiscountCache* getDiscountCache(NodeId node) const {
+      return this->nm.getDiscountCache(node);
+    }
+
+    void destroyNode(NodeId node) {
+      this->nm.destroyNode(node);
+    }
+
+    /**
+     * Destroy the given node and all its children; all nodes are marked
+     * as modified.
+     */
+    void destroyNodeRecursive(NodeId node) {
+      this->nm.destroyNodeRecursive(node);
+      this->markAllModified();
+    }
+
+    void markModified(l_type start, l_type end, void* payload) {
+      if (!this->allModified) {
+        this->modified[NodeKey(start, end)] = payload;
+      }
+    }
+
+    /**
+     * Mark all nodes as modified; the recorded individual changes are
+     * dropped as the next checkpoint has to contain the whole tree.
+     */
+    void markAllModified();
+
+    /**
+     * Forget all changes, e.g. after a checkpoint has been written.
+     */
+    void clearChanges();
+
+    bool isAllModified() const {
+      return this->allModified;
+    }
+
+    const std::vector<StructureChange>& getStructureChanges() const {
+      return this->structureChanges;
+    }
+
+    const ModifiedMap& getModified() const {
+      return this->modified;
+    }
+
+  private:
+    NodeKey keyOf(NodeId node) const {
+      return NodeKey(this->nm.getStart(node), this->nm.getEnd(node));
+    }
+
+    INodeManager& nm;
+    std::vector<StructureChange> structureChanges;
+    ModifiedMap modified;
+    bool allModified;
+
+    DISALLOW_COPY_AND_ASSIGN(TrackingNodeManager);
+};
+
+}} // namespace gatsby::libplump
+
+#endif
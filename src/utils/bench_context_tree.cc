@@ -0,0 +1,232 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark for building and querying a context tree.
+ *
+ * The input file is read either as bytes or as words (whitespace separated
+ * tokens, numbered in order of first occurrence). Every context of the
+ * sequence is inserted into a context tree, as HPYPModel does when
+ * training, and then looked up again using findLongestSuffix; reported are
+ * the time per insert and per lookup. With --suffix-links, the tree keeps 
+ * suffix links and both passes continue each lookup from the previous one
+ * using a cursor. With --bulk, the tree is instead built at once from the 
+ * suffix array (ContextTree::insertAll), and the time per context is 
+ * reported as the time per insert. As the number of children of a node
+ * determines how its child map is searched, the time per getChild is also
+ * reported separately for nodes with few, some and many children.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cassert>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace std;
+using namespace gatsby::libplump;
+namespace po = boost::program_options;
+
+/**
+ * Read the file as a sequence of word ids.
+ */
+void readWords(const std::string& fileName, size_t limit, seq_type& seq) {
+  std::ifstream in(fileName.c_str());
+  boost::unordered_map<std::string, e_type> ids;
+  std::string word;
+  while (in >> word && (limit == 0 || seq.size() < limit)) {
+    boost::unordered_map<std::string, e_type>::iterator it = ids.find(word);
+    if (it == ids.end()) {
+      it = ids.insert(std::make_pair(word, (e_type)ids.size())).first;
+    }
+    seq.push_back(it->second);
+  }
+  cout << "vocabulary size: " << ids.size() << endl;
+}
+
+
+const int NUM_CLASSES = 5;
+const char* CLASS_LABELS[NUM_CLASSES] = {"0", "1", "2-8", "9-63", ">=64"};
+
+int fanoutClass(size_t children) {
+  return (children == 0) ? 0 : (children == 1) ? 1 : (children <= 8) ? 2 
+                         : (children < 64) ? 3 : 4;
+}
+
+struct Edge {
+  INodeManager::NodeId node;
+  e_type key;
+};
+
+/**
+ * Collect the edges of the tree, grouped by the number of children of
+ * their parent, print the number of nodes in each group, and time getChild
+ * on the edges of each group (in random order).
+ */
+void timeChildLookups(const INodeManager& nm, int reps) {
+  std::vector<std::vector<Edge> > edges(NUM_CLASSES);
+  std::vector<size_t> nodes(NUM_CLASSES, 0);
+  size_t maxChildren = 0;
+  std::vector<INodeManager::NodeId> stack(1, nm.getRoot());
+  while (!stack.empty()) {
+    INodeManager::NodeId node = stack.back();
+    stack.pop_back();
+    const INodeManager::ChildMap& children = nm.getChildren(node);
+    int c = fanoutClass(children.size());
+    nodes[c]++;
+    maxChildren = std::max(maxChildren, (size_t)children.size());
+    for (INodeManager::ChildMapIterator it = children.begin();
+         it != children.end(); ++it) {
+      Edge edge = {node, (*it).first};
+      edges[c].push_back(edge);
+      stack.push_back((*it).second);
+    }
+  }
+  cout << "nodes by number of children:";
+  for (int c = 0; c < NUM_CLASSES; ++c) {
+    cout << " " << CLASS_LABELS[c] << ": " << nodes[c];
+  }
+  cout << "; max: " << maxChildren << endl;
+
+  cout << "ns per getChild by number of children:";
+  for (int c = 2; c < NUM_CLASSES; ++c) {
+    std::vector<Edge>& e = edges[c];
+    for (size_t i = e.size(); i > 1; --i) {
+      std::swap(e[i - 1], e[uniform_int(i)]);
+    }
+    size_t found = 0;
+    clock_t start = clock();
+    for (int r = 0; r < reps; ++r) {
+      for (size_t i = 0; i < e.size(); ++i) {
+        found += (nm.getChild(e[i].node, e[i].key) != NULL);
+      }
+    }
+    double seconds = (clock() - start) / (double)CLOCKS_PER_SEC;
+    assert(found == e.size() * reps);
+    cout << " " << CLASS_LABELS[c] << ": " << fixed << setprecision(1)
+         << (e.empty() ? 0 : 1e9 * seconds / ((double)e.size() * reps));
+  }
+  cout << endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  po::options_description options("Options");
+  options.add_options()
+    ("help", "produce help message")
+    ("words,w", "read the input as whitespace separated words")
+    ("head", po::value<int>()->default_value(0),
+     "if given, cuts input to this number of symbols")
+    ("node-manager", po::value<int>()->default_value(0),
+     "0: Simple, 1: Flat")
+    ("suffix-links", "keep suffix links and look up contexts using a cursor")
+    ("bulk", "build the tree at once from the suffix array")
+    ("reps,r", po::value<int>()->default_value(3),
+     "number of times the tree is built");
+  po::options_description hidden("Hidden options");
+  hidden.add_options()
+    ("input-file", po::value<string>(), "input file");
+  po::options_description all;
+  all.add(options).add(hidden);
+  po::positional_options_description p;
+  p.add("input-file", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).
+      options(all).positional(p).run(), vm);
+  po::notify(vm);
+  if (vm.count("help") || !vm.count("input-file")) {
+    cout << "Usage: bench_context_tree [OPTIONS]... FILENAME" << endl;
+    cout << options << endl;
+    return vm.count("help") ? 0 : 1;
+  }
+  const std::string fileName = vm["input-file"].as<string>();
+  const size_t head = vm["head"].as<int>();
+  const int reps = vm["reps"].as<int>();
+  const bool suffixLinks = vm.count("suffix-links");
+  const bool bulk = vm.count("bulk");
+
+  seq_type seq(vm.count("words") ? SymbolSequence::INT
+                                 : SymbolSequence::BYTE);
+  if (vm.count("words")) {
+    readWords(fileName, head, seq);
+  } else {
+    seq.appendFile(fileName, SymbolSequence::BYTE, head);
+  }
+  const l_type n = seq.size();
+  cout << "sequence length: " << n << endl;
+
+  KneserNeyRestaurant restaurant;
+  double insertSeconds = 0, lookupSeconds = 0;
+  long long checksum = 0;
+  for (int r = 0; r < reps; ++r) {
+    boost::scoped_ptr<INodeManager> nm;
+    if (vm["node-manager"].as<int>() == 1) {
+      nm.reset(new FlatNodeManager(restaurant.getFactory()));
+    } else {
+      nm.reset(new SimpleNodeManager(restaurant.getFactory()));
+    }
+    ContextTree tree(*nm, seq);
+    if (suffixLinks) {
+      tree.enableSuffixLinks();
+    }
+    ContextTree::InsertionResult result;
+    WrappedNodeList path;
+
+    clock_t start = clock();
+    ContextTree::Cursor insertCursor;
+    if (bulk) {
+      tree.insertAll(0, n - 1);
+    } else {
+      for (l_type i = 0; i < n; ++i) {
+        if (suffixLinks) {
+          tree.insert(0, i, result, insertCursor);
+        } else {
+          tree.insert(0, i, result);
+        }
+      }
+    }
+    insertSeconds += (clock() - start) / (double)CLOCKS_PER_SEC;
+
+    start = clock();
+    ContextTree::Cursor lookupCursor;
+    for (l_type i = 0; i < n; ++i) {
+      if (suffixLinks) {
+        tree.findLongestSuffix(0, i, path, lookupCursor);
+      } else {
+        tree.findLongestSuffix(0, i, path);
+      }
+      checksum += path.back().depth;
+    }
+    lookupSeconds += (clock() - start) / (double)CLOCKS_PER_SEC;
+
+    if (r == reps - 1) {
+      timeChildLookups(*nm, 10);
+    }
+  }
+  cout << "checksum: " << checksum << endl;
+  cout << "ns per insert: " << fixed << setprecision(1)
+       << 1e9 * insertSeconds / ((double)n * reps) << endl;
+  cout << "ns per findLongestSuffix: "
+       << 1e9 * lookupSeconds / ((double)n * reps) << endl;
+  return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark for the per-observation cost of an HPYPModel with generic
+ * and with specialized path operations.
+ *
+ * The first --train fraction of the input file (read as bytes) is used to
+ * train a model with computeLosses, and the rest is predicted with 
+ * predictSequence; both are done with the model calling the restaurant and
+ * the parameters through their interfaces (generic) and with a 
+ * PathOperations specialized for their classes. Reported are the time per
+ * observation for training and for prediction (the fastest of --reps runs,
+ * as other load only ever adds time) and the total losses, which are the 
+ * same for both variants.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <ctime>
+#include <string>
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace std;
+using namespace gatsby::libplump;
+namespace po = boost::program_options;
+
+double sum(const d_vec& losses) {
+  double total = 0;
+  for (size_t i = 0; i < losses.size(); ++i) {
+    total += losses[i];
+  }
+  return total;
+}
+
+/**
+ * Time training on [0, trainEnd) and predicting [trainEnd, seq.size()) 
+ * with generic and with specialized path operations for Restaurant and
+ * SimpleParameters, and print the results.
+ */
+template <class Restaurant>
+void run(seq_type& seq, l_type trainEnd, int reps, const d_vec& discounts,
+         double alpha) {
+  Restaurant restaurant;
+  SimpleParameters parameters(discounts, alpha);
+  boost::scoped_ptr<IPathOperations> specialized(
+      makePathOperations<Restaurant, SimpleParameters>(restaurant, 
+                                                       parameters));
+  const IPathOperations* pathOperations[2] = {NULL, specialized.get()};
+  const char* labels[2] = {"generic", "specialized"};
+  double trainSeconds[2] = {HUGE_VAL, HUGE_VAL};
+  double predictSeconds[2] = {HUGE_VAL, HUGE_VAL};
+  double trainLoss[2] = {0, 0};
+  double predictLoss[2] = {0, 0};
+
+  // each training run starts from an empty model; the variants take turns
+  // after a first round that is not timed, so that both see the heap in 
+  // the same state
+  for (int r = -1; r < reps; ++r) {
+    for (int v = 0; v < 2; ++v) {
+      // same random numbers for both variants
+      RngContext rng(1);
+      ThreadRngScope rngScope(rng);
+      SimpleNodeManager nodeManager(restaurant.getFactory());
+      HPYPModel model(seq, nodeManager, restaurant, parameters, 256);
+      model.setPathOperations(pathOperations[v]);
+      clock_t start = clock();
+      trainLoss[v] = sum(model.computeLosses(0, trainEnd));
+      if (r >= 0) {
+        trainSeconds[v] = std::min(
+            trainSeconds[v], (clock() - start) / (double)CLOCKS_PER_SEC);
+      }
+    }
+  }
+
+  // both variants predict from the same trained model
+  SimpleNodeManager nodeManager(restaurant.getFactory());
+  HPYPModel model(seq, nodeManager, restaurant, parameters, 256);
+  model.computeLosses(0, trainEnd);
+  for (int r = 0; r < reps; ++r) {
+    for (int v = 0; v < 2; ++v) {
+      model.setPathOperations(pathOperations[v]);
+      clock_t start = clock();
+      d_vec probabilities = model.predictSequence(trainEnd, seq.size());
+      predictSeconds[v] = std::min(
+          predictSeconds[v], (clock() - start) / (double)CLOCKS_PER_SEC);
+      log2_vec(probabilities);
+      predictLoss[v] = -sum(probabilities);
+    }
+  }
+
+  for (int v = 0; v < 2; ++v) {
+    cout << labels[v] << ": " << fixed << setprecision(1)
+         << "ns per training observation: " 
+         << 1e9 * trainSeconds[v] / trainEnd
+         << ", ns per prediction: " 
+         << 1e9 * predictSeconds[v] / (seq.size() - trainEnd)
+         << setprecision(6)
+         << ", losses: " << trainLoss[v] << " " << predictLoss[v] << endl;
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  po::options_description options("Options");
+  options.add_options()
+    ("help", "produce help message")
+    ("head", po::value<int>()->default_value(0),
+     "if given, cuts input to this number of symbols")
+    ("restaurant", po::value<int>()->default_value(4),
+     "0: KN, 4: StirlingCompact")
+    ("train", po::value<double>()->default_value(0.9),
+     "fraction of the input used for training")
+    ("reps,r", po::value<int>()->default_value(3),
+     "number of times each variant is run");
+  po::options_description hidden("Hidden options");
+  hidden.add_options()
+    ("input-file", po::value<string>(), "input file");
+  po::options_description all;
+  all.add(options).add(hidden);
+  po::positional_options_description p;
+  p.add("input-file", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).
+      options(all).positional(p).run(), vm);
+  po::notify(vm);
+  if (vm.count("help") || !vm.count("input-file")) {
+    cout << "Usage: bench_model [OPTIONS]... FILENAME" << endl;
+    cout << options << endl;
+    return vm.count("help") ? 0 : 1;
+  }
+  const int restaurantType = vm["restaurant"].as<int>();
+  if (restaurantType != 0 && restaurantType != 4) {
+    cerr << "Unknown restaurant type (--restaurant)!" << endl;
+    return 1;
+  }
+  const int reps = vm["reps"].as<int>();
+
+  seq_type seq(SymbolSequence::BYTE);
+  seq.appendFile(vm["input-file"].as<string>(), SymbolSequence::BYTE,
+                 vm["head"].as<int>());
+  const l_type n = seq.size();
+  const l_type trainEnd = (l_type)(vm["train"].as<double>() * n);
+  cout << "sequence length: " << n << ", training on " << trainEnd << endl;
+
+  // the default discounts of score_file
+  const double defaultDiscounts[] = {0.05, 0.7, 0.8, 0.82, 0.84, 0.88, 0.91,
+                                     0.92, 0.93, 0.94, 0.95};
+  const d_vec discounts(defaultDiscounts, defaultDiscounts + 11);
+  if (restaurantType == 0) {
+    run<KneserNeyRestaurant>(seq, trainEnd, reps, discounts, 5);
+  } else {
+    run<StirlingCompactRestaurant>(seq, trainEnd, reps, discounts, 5);
+  }
+  return 0;
+}
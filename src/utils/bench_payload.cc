@@ -0,0 +1,261 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark for the per-type counts of the compact restaurants.
+ *
+ * For each number of types per restaurant, a set of restaurants is filled
+ * with customers of that many types, once using a MiniMap of (cw, tw) pairs
+ * (the former BaseCompactRestaurant payload) and once using
+ * CompactArrangements (the current one). Reported are the bytes per
+ * restaurant (object plus the heap chunks of the allocated blocks, 
+ * including malloc's header) and the time per addCustomer, getC and getT.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <ctime>
+#include <vector>
+#include <malloc.h>
+#include <boost/program_options.hpp>
+
+#include <libplump/libplump.h>
+#include <libplump/mini_map.h>
+#include <libplump/compact_arrangements.h>
+
+using namespace std;
+using namespace gatsby::libplump;
+namespace po = boost::program_options;
+
+/**
+ * Heap allocator that counts the bytes of the heap chunks currently 
+ * allocated. It holds a pointer, so that the containers have the same size
+ * as with an ArenaAllocator.
+ */
+class CountingAllocator {
+  public:
+    CountingAllocator() : counter(&allocated) {}
+
+    void* allocate(size_t size) const {
+      void* p = ::operator new(size);
+      *this->counter += malloc_usable_size(p) + sizeof(size_t);
+      return p;
+    }
+
+    void deallocate(void* p, size_t size) const {
+      *this->counter -= malloc_usable_size(p) + sizeof(size_t);
+      ::operator delete(p);
+    }
+
+    static size_t allocated;
+
+  private:
+    size_t* counter;
+};
+
+size_t CountingAllocator::allocated = 0;
+
+
+/**
+ * Restaurant counts stored in a MiniMap, as BaseCompactRestaurant did.
+ */
+struct MiniMapCounts {
+  typedef MiniMap<e_type, std::pair<int, int>, unsigned int,
+                  CountingAllocator> TableMap;
+  TableMap tableMap;
+  l_type sumCustomers;
+  l_type sumTables;
+
+  MiniMapCounts() : tableMap(), sumCustomers(0), sumTables(0) {}
+
+  void addCustomer(e_type type) {
+    std::pair<int, int>& arrangement = this->tableMap[type];
+    ++this->sumCustomers;
+    if (arrangement.first++ % 4 == 0) {
+      ++arrangement.second;
+      ++this->sumTables;
+    }
+  }
+
+  l_type getC(e_type type) const {
+    TableMap::iterator it = this->tableMap.find(type);
+    return (it != this->tableMap.end()) ? (*it).second.first : 0;
+  }
+
+  l_type getT(e_type type) const {
+    TableMap::iterator it = this->tableMap.find(type);
+    return (it != this->tableMap.end()) ? (*it).second.second : 0;
+  }
+};
+
+
+/**
+ * Restaurant counts stored in CompactArrangements, as BaseCompactRestaurant
+ * does.
+ */
+struct CompactCounts {
+  typedef CompactArrangements<4, CountingAllocator> TableMap;
+  TableMap tableMap;
+  l_type sumCustomers;
+  l_type sumTables;
+
+  CompactCounts() : tableMap(), sumCustomers(0), sumTables(0) {}
+
+  void addCustomer(e_type type) {
+    TableMap::size_type i = this->tableMap.insert(type);
+    ++this->sumCustomers;
+    if (this->tableMap.cw(i)++ % 4 == 0) {
+      ++this->tableMap.tw(i);
+      ++this->sumTables;
+    }
+  }
+
+  l_type getC(e_type type) const {
+    TableMap::size_type i = this->tableMap.find(type);
+    return (i != this->tableMap.size()) ? this->tableMap.cw(i) : 0;
+  }
+
+  l_type getT(e_type type) const {
+    TableMap::size_type i = this->tableMap.find(type);
+    return (i != this->tableMap.size()) ? this->tableMap.tw(i) : 0;
+  }
+};
+
+
+/**
+ * Fill numRestaurants restaurants with the customers in types (customers
+ * per restaurant each), look all of them up again, and print bytes per
+ * restaurant and ns per operation; returns a checksum of the counts.
+ */
+template<class Counts>
+long long timeCounts(int numRestaurants, int customers,
+                     const std::vector<e_type>& types, int reps) {
+  long long checksum = 0;
+  double addSeconds = 0, getCSeconds = 0, getTSeconds = 0;
+  size_t bytes = 0;
+  for (int r = 0; r < reps; ++r) {
+    size_t allocatedBefore = CountingAllocator::allocated;
+    std::vector<Counts> restaurants(numRestaurants);
+
+    clock_t start = clock();
+    for (int i = 0; i < numRestaurants; ++i) {
+      const e_type* t = &types[(size_t)i * customers];
+      for (int j = 0; j < customers; ++j) {
+        restaurants[i].addCustomer(t[j]);
+      }
+    }
+    addSeconds += (clock() - start) / (double)CLOCKS_PER_SEC;
+    bytes = CountingAllocator::allocated - allocatedBefore;
+
+    start = clock();
+    for (int i = 0; i < numRestaurants; ++i) {
+      const e_type* t = &types[(size_t)i * customers];
+      for (int j = 0; j < customers; ++j) {
+        checksum += restaurants[i].getC(t[j]);
+      }
+    }
+    getCSeconds += (clock() - start) / (double)CLOCKS_PER_SEC;
+
+    start = clock();
+    for (int i = 0; i < numRestaurants; ++i) {
+      const e_type* t = &types[(size_t)i * customers];
+      for (int j = 0; j < customers; ++j) {
+        checksum += restaurants[i].getT(t[j]);
+      }
+    }
+    getTSeconds += (clock() - start) / (double)CLOCKS_PER_SEC;
+  }
+  double ops = (double)numRestaurants * customers * reps;
+  cout << setw(10) << sizeof(Counts) + bytes / numRestaurants
+       << setw(10) << fixed << setprecision(2) << 1e9 * addSeconds / ops
+       << setw(10) << 1e9 * getCSeconds / ops
+       << setw(10) << 1e9 * getTSeconds / ops;
+  return checksum;
+}
+
+
+int main(int argc, char* argv[]) {
+  po::options_description options("Options");
+  options.add_options()
+    ("help", "produce help message")
+    ("restaurants,n", po::value<int>()->default_value(100000),
+     "number of restaurants")
+    ("customers,c", po::value<int>()->default_value(16),
+     "number of customers per restaurant")
+    ("reps,r", po::value<int>()->default_value(5),
+     "number of times the restaurants are built");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << options << endl;
+    return 0;
+  }
+  const int n = vm["restaurants"].as<int>();
+  const int reps = vm["reps"].as<int>();
+
+  init_rng();
+
+  const int numTypes[] = {1, 2, 3, 4, 5, 8, 16, 64};
+  const int numSizes = sizeof(numTypes) / sizeof(numTypes[0]);
+
+  cout << "bytes per restaurant, ns per operation" << endl;
+  cout << setw(10) << "";
+  cout << setw(40) << "MiniMap" << setw(40) << "CompactArrangements" << endl;
+  cout << setw(10) << "types";
+  for (int k = 0; k < 2; ++k) {
+    cout << setw(10) << "bytes" << setw(10) << "add"
+         << setw(10) << "getC" << setw(10) << "getT";
+  }
+  cout << endl;
+
+  for (int s = 0; s < numSizes; ++s) {
+    // every type occurs at least once
+    const int customers = std::max(vm["customers"].as<int>(), numTypes[s]);
+    std::vector<e_type> types;
+    types.reserve((size_t)n * customers);
+    for (int i = 0; i < n; ++i) {
+      // draw the types of each restaurant from a random subset of the
+      // alphabet
+      std::vector<e_type> alphabet;
+      while ((int)alphabet.size() < numTypes[s]) {
+        e_type type = uniform_int(256);
+        if (std::find(alphabet.begin(), alphabet.end(), type) 
+            == alphabet.end()) {
+          alphabet.push_back(type);
+        }
+      }
+      for (int j = 0; j < customers; ++j) {
+        types.push_back((j < numTypes[s]) ? alphabet[j]
+                        : alphabet[uniform_int(numTypes[s])]);
+      }
+    }
+
+    cout << setw(10) << numTypes[s];
+    long long miniMapChecksum = timeCounts<MiniMapCounts>(n, customers,
+                                                          types, reps);
+    long long compactChecksum = timeCounts<CompactCounts>(n, customers,
+                                                          types, reps);
+    cout << endl;
+    if (miniMapChecksum != compactChecksum) {
+      cerr << "counts disagree" << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
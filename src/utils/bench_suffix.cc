@@ -0,0 +1,183 @@
+/*
+ * Copyright 2008-2016 Jan Gasthaus
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark for the longest-common-suffix kernels in suffix_compare.h.
+ *
+ * For each label-length distribution, a set of pairs of positions in a 
+ * random sequence is prepared whose common suffixes have lengths drawn from
+ * that distribution; each available kernel is then timed on the same pairs,
+ * with the sequence stored using 1, 2 and 4 bytes per symbol.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include <libplump/libplump.h>
+#include <libplump/suffix_compare.h>
+
+using namespace std;
+using namespace gatsby::libplump;
+namespace po = boost::program_options;
+
+struct Comparison {
+  l_type aEnd;
+  l_type bEnd;
+  l_type limit;
+};
+
+/**
+ * Append a pair of sequences to seq whose common suffix has exactly the
+ * given length, and record the comparison of their ends. 
+ */
+void addComparison(std::vector<e_type>& seq, l_type match, l_type limit,
+                   std::vector<Comparison>& comparisons) {
+  const l_type len = std::max(match + 1, limit);
+  l_type aStart = seq.size();
+  for (l_type i = 0; i < len; ++i) {
+    seq.push_back(uniform_int(256));
+  }
+  l_type bStart = seq.size();
+  seq.insert(seq.end(), seq.begin() + aStart, seq.begin() + bStart);
+  // break the match right before the common suffix
+  seq[bStart + len - 1 - match] = 
+      (seq[aStart + len - 1 - match] + 1) % 256;
+  Comparison c = {bStart, (l_type)seq.size(), std::min(limit, len)};
+  comparisons.push_back(c);
+}
+
+template<typename Symbol>
+double timeKernel(typename SuffixCompareKernels<Symbol>::Kernel kernel, 
+                  const std::vector<Symbol>& seq,
+                  const std::vector<Comparison>& comparisons, int reps,
+                  long long& checksum) {
+  const Symbol* base = &seq[0];
+  checksum = 0;
+  clock_t start = clock();
+  for (int r = 0; r < reps; ++r) {
+    for (size_t i = 0; i < comparisons.size(); ++i) {
+      const Comparison& c = comparisons[i];
+      checksum += kernel(base + c.aEnd, base + c.bEnd, 0, c.limit);
+    }
+  }
+  return (clock() - start) / (double)CLOCKS_PER_SEC;
+}
+
+/**
+ * Time all kernels available for the given symbol type and print the 
+ * nanoseconds per comparison; returns false if a kernel disagrees with 
+ * the scalar one.
+ */
+template<typename Symbol>
+bool timeKernels(const std::vector<e_type>& symbols,
+                 const std::vector<Comparison>& comparisons, int reps) {
+  const SuffixCompareKernels<Symbol>& kernels = 
+      suffixCompareKernels((const Symbol*)NULL);
+  std::vector<typename SuffixCompareKernels<Symbol>::Kernel> available;
+  available.push_back(kernels.scalar);
+  if (kernels.sse2 != NULL) {
+    available.push_back(kernels.sse2);
+  }
+  if (kernels.avx2 != NULL && kernels.selected == kernels.avx2) {
+    available.push_back(kernels.avx2);
+  }
+
+  std::vector<Symbol> seq(symbols.begin(), symbols.end());
+  long long reference = 0;
+  for (size_t k = 0; k < available.size(); ++k) {
+    long long checksum;
+    double seconds = timeKernel<Symbol>(available[k], seq, comparisons, 
+                                        reps, checksum);
+    if (k == 0) {
+      reference = checksum;
+    } else if (checksum != reference) {
+      cerr << "kernel " << k << " disagrees with scalar" << endl;
+      return false;
+    }
+    cout << setw(10) << fixed << setprecision(2) 
+         << 1e9 * seconds / ((double)comparisons.size() * reps);
+  }
+  for (size_t k = available.size(); k < 3; ++k) {
+    cout << setw(10) << "-";
+  }
+  return true;
+}
+
+
+int main(int argc, char* argv[]) {
+  po::options_description options("Options");
+  options.add_options()
+    ("help", "produce help message")
+    ("comparisons,n", po::value<int>()->default_value(100000), 
+     "number of comparisons per distribution")
+    ("reps,r", po::value<int>()->default_value(20), 
+     "number of passes over the comparisons");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << options << endl;
+    return 0;
+  }
+  const int n = vm["comparisons"].as<int>();
+  const int reps = vm["reps"].as<int>();
+
+  init_rng();
+
+  // mean common suffix lengths: short labels dominate near the leaves of a
+  // context tree, long ones appear on paths through repetitive data
+  const double means[] = {1, 4, 16, 64, 512};
+  const int numMeans = sizeof(means) / sizeof(means[0]);
+  const char* widths[] = {"8 bit", "16 bit", "32 bit"};
+
+  cout << "selected kernel: " << commonSuffixLengthKernelName() << endl;
+  cout << "ns per comparison" << endl;
+  cout << setw(10) << "";
+  for (int w = 0; w < 3; ++w) {
+    cout << setw(30) << widths[w];
+  }
+  cout << endl << setw(10) << "mean len";
+  for (int w = 0; w < 3; ++w) {
+    cout << setw(10) << "scalar" << setw(10) << "sse2" << setw(10) << "avx2";
+  }
+  cout << endl;
+
+  for (int m = 0; m < numMeans; ++m) {
+    std::vector<e_type> symbols;
+    std::vector<Comparison> comparisons;
+    // geometric label lengths with the given mean
+    const double p = 1.0 / (means[m] + 1);
+    for (int i = 0; i < n; ++i) {
+      l_type match = (l_type)floor(log(gsl_rng_uniform_pos(current_rng())) / 
+                                   log(1 - p));
+      addComparison(symbols, match, match + 1 + uniform_int(4), comparisons);
+    }
+
+    cout << setw(10) << fixed << setprecision(0) << means[m];
+    if (!timeKernels<uint8_t>(symbols, comparisons, reps) ||
+        !timeKernels<uint16_t>(symbols, comparisons, reps) ||
+        !timeKernels<int32_t>(symbols, comparisons, reps)) {
+      return 1;
+    }
+    cout << endl;
+  }
+  return 0;
+}
@@ -38,6 +38,17 @@ static unsigned int num_types = 256;
  * Predict probabilities on test file.
  */
 d_vec predict(po::variables_map& vm, HPYPModel& m, int start_pos, seq_type seq) {
+  if (!vm.count("sum")) {
+    // fragment options 1, 2, 3 correspond to ABOVE, FRAGMENT, BELOW
+    HPYPModel::PredictMode mode = 
+        (HPYPModel::PredictMode)(vm["fragment"].as<int>() - 1);
+    d_vec predictive = m.predictSequence(start_pos, seq.size(), mode,
+                                         vm["threads"].as<int>());
+    // the loop below starts predicting at start_pos + 1
+    predictive.erase(predictive.begin());
+    return predictive;
+  }
+
   d_vec predictive;
   for(int i = start_pos + 1; i < (int)seq.size(); ++i) {    
     if (vm.count("sum")) {
@@ -72,7 +83,7 @@ IParameters* getParameters(po::variables_map& vm) {
   }
 }
 
-IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
+IAddRemoveRestaurant* getRestaurant(po::variables_map& vm, Arena* arena) {
   switch(vm["restaurant"].as<int>()) {
     case 0:
       cerr << "getRestaurant(): Using KneserNeyRestaurant" << endl;
@@ -85,10 +96,10 @@ IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
       return new HistogramRestaurant();
     case 3:
       cerr << "getRestaurant(): Using ReinstantiatingCompactRestaurant" << endl;
-      return new ReinstantiatingCompactRestaurant();
+      return new ReinstantiatingCompactRestaurant(arena);
     case 4:
       cerr << "getRestaurant(): Using StirlingCompactRestaurant" << endl;
-      return new StirlingCompactRestaurant();
+      return new StirlingCompactRestaurant(arena);
     case 5:
       cerr << "getRestaurant(): "
            << "Using SwitchingRestaurant(SimpleFullRestaurant, 10)"
@@ -102,7 +113,7 @@ IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
       return new FractionalRestaurant();
     case 8:
       cerr << "getRestaurant(): Using ExpectedTablesCompactRestaurant" << endl;
-      return new ExpectedTablesCompactRestaurant();
+      return new ExpectedTablesCompactRestaurant(arena);
     case 9:
       cerr << "getRestaurant(): Using LocallyOptimalRestaurant" << endl;
       return new LocallyOptimalRestaurant();
@@ -111,20 +122,80 @@ IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
   exit(1);
 }
 
+/**
+ * Specialized path operations for the common combinations of restaurant and
+ * parameters, or NULL for the others (or if --generic-paths is given).
+ */
+IPathOperations* getPathOperations(po::variables_map& vm,
+    const IAddRemoveRestaurant& restaurant, const IParameters& parameters) {
+  if (vm.count("generic-paths")) {
+    return NULL;
+  }
+  IPathOperations* pathOperations = 
+      makePathOperations<StirlingCompactRestaurant, 
+                         SimpleParameters>(restaurant, parameters);
+  if (!pathOperations) {
+    pathOperations = makePathOperations<KneserNeyRestaurant, 
+                                        SimpleParameters>(restaurant, 
+                                                          parameters);
+  }
+  if (!pathOperations) {
+    pathOperations = makePathOperations<PowerLawRestaurant, 
+                                        SimpleParameters>(restaurant, 
+                                                          parameters);
+  }
+  if (!pathOperations) {
+    pathOperations = makePathOperations<StirlingCompactRestaurant, 
+                                        GradientParameters>(restaurant, 
+                                                            parameters);
+  }
+  if (pathOperations) {
+    cerr << "getPathOperations(): Using specialized path operations" << endl;
+  }
+  return pathOperations;
+}
+
 INodeManager* getNodeManager(po::variables_map& vm,
-    const IPayloadFactory& payloadFactory) {
-  return new SimpleNodeManager(payloadFactory);
+    const IPayloadFactory& payloadFactory, Arena* arena) {
+  switch(vm["node-manager"].as<int>()) {
+    case 0:
+      cerr << "getNodeManager(): Using SimpleNodeManager" << endl;
+      return new SimpleNodeManager(payloadFactory, arena);
+    case 1:
+      cerr << "getNodeManager(): Using FlatNodeManager" << endl;
+      return new FlatNodeManager(payloadFactory, vm.count("cache-discounts"));
+  }
+  cout << "Unknown node manager type (--node-manager)!";
+  exit(1);
 }
 
-void pushFileToSeq(po::variables_map& vm, std::string filename, seq_type& seq) {
-  if (vm.count("read-int32")) {
-    pushFileToVec<int>(filename, seq, vm["head"].as<int>());
-  } else {
-    pushFileToVec<unsigned char>(filename, seq, vm["head"].as<int>());
+SymbolSequence::Width getFileWidth(po::variables_map& vm) {
+  return vm.count("read-int32") ? SymbolSequence::INT : SymbolSequence::BYTE;
+}
+
+/**
+ * Use the narrowest symbol width that can hold all types.
+ */
+SymbolSequence::Width getSymbolWidth(po::variables_map& vm) {
+  if (!vm.count("read-int32")) {
+    return SymbolSequence::BYTE;
   }
+  return (num_types <= 0x10000) ? SymbolSequence::SHORT : SymbolSequence::INT;
+}
+
+void pushFileToSeq(po::variables_map& vm, std::string filename, seq_type& seq) {
+  seq.appendFile(filename, getFileWidth(vm), vm["head"].as<int>());
 }
 
 void runSampler(po::variables_map& vm, HPYPModel& model, int train_length) {
+  int threads = vm["threads"].as<int>();
+  // only the direct sampler is run in parallel (see runParallelGibbsSampler)
+  if (threads > 1 && vm["sampler"].as<int>() == 2) {
+    d_vec throughput = model.runParallelGibbsSampler(
+        true, threads, vm["split-depth"].as<int>());
+    cerr << "nodes/sec per thread: " << iterableToString(throughput) << endl;
+    return;
+  }
   if (vm["sampler"].as<int>() == 1) {
     model.runGibbsSampler(false);
   } 
@@ -137,6 +208,34 @@ void runSampler(po::variables_map& vm, HPYPModel& model, int train_length) {
 }
 
 
+/**
+ * Predict the test file from a model snapshot; the model itself can not
+ * be changed, so there is no training, sampling or online prediction.
+ */
+double scoreSnapshot(po::variables_map& vm, seq_type& seq) {
+  if (vm["fragment"].as<int>() == 2) {
+    cerr << "Snapshots do not support prediction with fragmentation!" << endl;
+    exit(1);
+  }
+  Snapshot snapshot(vm["load-snapshot"].as<string>());
+  cout << "Snapshot nodes: " << snapshot.numNodes() << endl;
+  boost::scoped_ptr<IParameters> parameters(getParameters(vm));
+  SnapshotRestaurant restaurant;
+  SnapshotNodeManager nodeManager(snapshot);
+  HPYPModel model(seq, nodeManager, restaurant, *parameters, num_types);
+
+  if (!vm.count("test-file")) {
+    return 0;
+  }
+  int start_pos = seq.size();
+  pushFileToSeq(vm, vm["test-file"].as<string>(), seq);
+  cout << "Test sequence length: " << seq.size()-start_pos << endl;
+  double loss = prob2loss<double>(predict(vm, model, start_pos, seq));
+  cout << "loss: " << loss << endl;
+  return loss;
+}
+
+
 double score_file(po::variables_map& vm) {
   string filename = vm["input-file"].as<string>();
   fs::path input_path(filename);
@@ -145,26 +244,76 @@ double score_file(po::variables_map& vm) {
     exit(1);
   }
 
-  seq_type seq;
-  pushFileToSeq(vm, filename, seq);
+  seq_type seq(getSymbolWidth(vm));
+  if (vm.count("mmap")) {
+    seq = SymbolSequence(filename, getFileWidth(vm), vm["head"].as<int>());
+  } else {
+    pushFileToSeq(vm, filename, seq);
+  }
+  if (vm.count("load-snapshot")) {
+    return scoreSnapshot(vm, seq);
+  }
   cout << "Sequence length: " << seq.size() << endl;
   cout << "Number of types:  " << num_types << endl;
   cout << seq[0] << endl;
 
+  // declared first, so that it outlives everything allocated from it
+  boost::scoped_ptr<Arena> arena(vm.count("arena") ? new Arena() : NULL);
   boost::scoped_ptr<IParameters> parameters(getParameters(vm));
-  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(getRestaurant(vm));
-  boost::scoped_ptr<INodeManager> nodeManager(
-      getNodeManager(vm, restaurant->getFactory()));
+  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(
+      getRestaurant(vm, arena.get()));
+  if (vm.count("save-snapshot") && !restaurant->predictsFromCounts()) {
+    cerr << "--save-snapshot requires a restaurant that predicts from its "
+         << "counts (KN, SimpleFull, Histogram or a compact restaurant)!" 
+         << endl;
+    exit(1);
+  }
+  boost::scoped_ptr<INodeManager> baseNodeManager(
+      getNodeManager(vm, restaurant->getFactory(), arena.get()));
+  // record the changes made after loading when a delta is to be saved
+  boost::scoped_ptr<TrackingNodeManager> trackingNodeManager(
+      vm.count("save-delta") ? new TrackingNodeManager(*baseNodeManager) 
+                             : NULL);
+  INodeManager* nodeManager = trackingNodeManager 
+      ? trackingNodeManager.get() : baseNodeManager.get();
 
   HPYPModel model(seq, *nodeManager, *restaurant, *parameters, num_types);
+  boost::scoped_ptr<IPathOperations> pathOperations(
+      getPathOperations(vm, *restaurant, *parameters));
+  model.setPathOperations(pathOperations.get());
 
   d_vec losses;
   if (vm.count("load-serialized-nodes")) {
     Serializer nodeSerializer(vm["load-serialized-nodes"].as<string>());
-    nodeSerializer.loadNodesAndPayloads(*nodeManager, restaurant->getFactory());
+    if (vm.count("load-delta")) {
+      nodeSerializer.loadNodesAndPayloads(
+          *nodeManager, restaurant->getFactory(),
+          vm["load-delta"].as<vector<string> >());
+    } else {
+      nodeSerializer.loadNodesAndPayloads(*nodeManager,
+                                          restaurant->getFactory());
+    }
+    if (trackingNodeManager) {
+      trackingNodeManager->clearChanges();
+    }
+    if (vm.count("suffix-links")) {
+      model.enableSuffixLinks();
+    }
   } else {
+    if (vm.count("suffix-links")) {
+      model.enableSuffixLinks();
+    }
     int lag = vm["lag"].as<int>();
-    if (lag == 0) {
+    if (vm.count("bulk-train")) {
+      if (!restaurant->isDeterministic() || vm["parameters"].as<int>() != 0
+          || lag != 0) {
+        cerr << "--bulk-train requires a deterministic restaurant (KN or "
+             << "PowerLaw), simple parameters and no lag!" << endl;
+        exit(1);
+      }
+      model.bulkTrain(0, seq.size(), vm["threads"].as<int>(), 
+                      vm["split-depth"].as<int>());
+    } else if (lag == 0) {
       losses = model.computeLosses(0, seq.size());
     } else {
       losses = model.computeLossesWithDeletion(0, seq.size(), lag);
@@ -246,9 +395,24 @@ double score_file(po::variables_map& vm) {
   }
 
   if (vm.count("save-serialized-nodes")) {
-    Serializer nodeSerializer(vm["save-serialized-nodes"].as<string>());
+    Serializer nodeSerializer(
+        vm["save-serialized-nodes"].as<string>(),
+        (Serializer::Compression)vm["compression"].as<int>());
     nodeSerializer.saveNodesAndPayloads(*nodeManager, restaurant->getFactory());
   }
+  if (vm.count("save-delta")) {
+    Serializer deltaSerializer(
+        vm["save-delta"].as<string>(),
+        (Serializer::Compression)vm["compression"].as<int>());
+    deltaSerializer.saveChanges(*trackingNodeManager, restaurant->getFactory());
+  }
+  if (vm.count("save-snapshot")) {
+    Snapshot::save(vm["save-snapshot"].as<string>(), *nodeManager, *restaurant);
+  }
+  if (vm["restaurant"].as<int>() == 4) {
+    cerr << "Stirling tables: " 
+         << stirling_generator_full_log::statsToString() << endl;
+  }
   cout << "Discounts: ";
   for (int i=0; i < vm["disc"].as<d_vec>().size(); ++i) {
     cout << parameters->getDiscount(i) << ", ";
@@ -277,10 +441,18 @@ int main(int argc, char* argv[]) {
     ("sum,s", "Check that probabilities sum to one")
     ("print-tree", "Print the context tree to the screen")
     ("fragment", po::value<int>()->default_value(1), "1: nofrag; 2: frag; 3:below")
+    ("threads", po::value<int>()->default_value(1), "Number of threads used for predicting the test file, for direct Gibbs sampling (--sampler 2) and for --bulk-train")
+    ("split-depth", po::value<int>()->default_value(2), "Depth of the subtrees sampled (or trained) in parallel when using more than one thread")
     ("read-int32", "Read input data as 32 bit integers")
     ("test-file", po::value<string>(), "Test file")
     ("save-serialized-nodes", po::value<string>(), "File to contain serialized nodes")
     ("load-serialized-nodes", po::value<string>(), "File to contain serialized nodes")
+    ("load-delta", po::value<vector<string> >()->composing(), "Delta to apply after loading the serialized nodes; may be given several times")
+    ("save-delta", po::value<string>(), "Write the changes made after loading the serialized nodes to this file")
+    ("compression", po::value<int>()->default_value(1), "Compression of saved nodes; 0: none, 1: bzip2, 2: gzip")
+    ("save-snapshot", po::value<string>(), "Write a memory-mappable snapshot of the model to this file")
+    ("load-snapshot", po::value<string>(), "Only predict the test file using the snapshot in this file (same input file and parameters as when saving)")
+    ("mmap", "Memory-map the input file instead of reading it; the test file is appended after the mapping")
     ("head",po::value<int>()->default_value(0), "If given, cuts input to this number of symbols")
     ("mode", po::value<int>()->default_value(1), "1: particle filter, 2: no fragment, 3: fragment")
     ("sampler", po::value<int>()->default_value(1), "1: add/remove, 2: direct gibbs; 3: remove-add")
@@ -288,6 +460,14 @@ int main(int argc, char* argv[]) {
      "0:KN, 1: SimpleFull, 2: Histogram, 3: ReinstantiatingCompact, 4: StirlingCompact, 5: Switching, 6: PowerLaw, 7: Fractional")
     ("parameters", po::value<int>()->default_value(0),
      "0:Simple, 1: Gradient")
+    ("node-manager", po::value<int>()->default_value(0),
+     "0: Simple, 1: Flat")
+    ("arena", "Allocate nodes and (compact restaurant) payloads from a per-model arena")
+    ("cache-discounts", "Cache the discount of each node with the node (flat node manager only)")
+    ("bulk-train", "Train deterministic restaurants (KN, PowerLaw) by counting over the finished context tree on --threads threads; no training loss")
+    ("generic-paths", "Do not use the path operations specialized for common restaurant and parameter combinations (for comparison)")
+    ("suffix-links", "Keep suffix links in the context tree to speed up passes over consecutive positions (not used with --load-snapshot)")
+    ("stirling-cache-mb", po::value<int>()->default_value(64), "Memory budget (in MB) of the Stirling number tables shared by the StirlingCompact restaurants")
     ("burn-in",po::value<int>()->default_value(0), "Number of Gibbs iterations for burn in")
     ("samples,s",po::value<int>()->default_value(1), "Number of samples used for prediction")
     ("lag,l",po::value<int>()->default_value(0), "Lag for deleted prediction (0=off)")
@@ -330,6 +510,8 @@ int main(int argc, char* argv[]) {
   num_types = vm["num-types"].as<int>();
 
   init_rng();
+  StirlingTableCache::instance().setMemoryBudget(
+      (size_t)vm["stirling-cache-mb"].as<int>() << 20);
 
   if (vm.count("input-file")) {
     double score;